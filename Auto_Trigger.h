@@ -0,0 +1,178 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Hands-Free Message Start/Stop (shared by both readers)
+// *****************************************************
+
+/*  With AUTO_TRIGGER set to '1' a reader does not wait for the button to start
+    and end a message. The acquisition thread keeps sampling while the reader
+    is idle and watches for signal activity:
+
+        -- An idle baseline follows the value slowly (an exponential average
+           with weight 1/2^TRIGGER_BASELINE_SHIFT) while nothing happens.
+        -- A value at least TRIGGER_CONTRAST away from the baseline is active.
+           TRIGGER_CONFIRM active values in a row start a message.
+        -- The last TRIGGER_PRETRIGGER values before that are kept in a small
+           ring. They become the start of the message, so the lead-in space
+           and the start of the first mark are not cut off.
+        -- While reading, a message ends once the signal has not changed
+           between active and idle for TRIGGER_SILENCE_WORDS word gaps
+           (7 units). The unit comes from the calibration once it is known
+           (Trigger_Set_Unit(), the acquisition thread never reads the
+           calibration lengths the decoder keeps refining), otherwise from
+           MIN_WPM (the longest unit expected). A level that
+           gets stuck ends the message the same way.
+
+    The message is then terminated like a second button press and goes
+    straight to output. The button keeps working: it starts (LED reader: sends)
+    and ends messages by hand.
+
+    TRIGGER_PRETRIGGER must stay well below array_LENGTH, so the calibration
+    still sees the pattern that follows it.
+*/
+
+#ifndef AUTO_TRIGGER_H
+#define AUTO_TRIGGER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "Sample_Rate.h"
+
+
+// _________________________________________________
+//  Trigger Configuration
+// _________________________________________________
+
+#ifndef AUTO_TRIGGER
+#define AUTO_TRIGGER 0 // Set to '1' to start messages on signal activity and end them after a silence
+#endif
+
+#ifndef TRIGGER_PRETRIGGER
+#define TRIGGER_PRETRIGGER 32 // Stored values kept from before the start of a message
+#endif
+
+#ifndef TRIGGER_CONTRAST
+#define TRIGGER_CONTRAST 100 // Distance from the idle baseline that counts as activity
+#endif
+
+#ifndef TRIGGER_CONFIRM
+#define TRIGGER_CONFIRM 2 // Active values in a row that start a message (rejects single spikes)
+#endif
+
+#ifndef TRIGGER_SILENCE_WORDS
+#define TRIGGER_SILENCE_WORDS 2 // Word gaps without a change that end a message
+#endif
+
+#define TRIGGER_BASELINE_SHIFT 4 // Baseline weight 1/16 per value
+
+
+// _________________________________________________
+//  Trigger State
+// _________________________________________________
+
+static int Trigger_VALUES[TRIGGER_PRETRIGGER];              // Pre-trigger ring
+static unsigned long long Trigger_TIMES[TRIGGER_PRETRIGGER];
+static int Trigger_COUNT = 0;                                // Values pushed since watching started
+static int Trigger_BASELINE_Q4 = -1;                         // Idle level * 16, -1 until the first value
+static int Trigger_CONFIRMED = 0;                            // Active values in a row while watching
+static int Trigger_WATCHING = 0;                             // '1' while sampling in standby
+static int Trigger_ACTIVE = 0;                               // Active state of the last value while reading
+static int Trigger_QUIET = 0;                                // Values since the active state last changed
+static atomic_int Trigger_UNIT = 0;                          // Values per unit of the calibration, 0 until it is known
+
+
+// _________________________________________________
+//  Trigger Functions
+// _________________________________________________
+
+static void Trigger_Setup(void){
+    if (AUTO_TRIGGER){
+        printf("Hands-free: a message starts on activity (%d from the idle level) and ends after %d word gaps of silence\n",
+               TRIGGER_CONTRAST, TRIGGER_SILENCE_WORDS);
+    }
+}
+
+static int Trigger_Silence_MS(void){
+    // Longest time a message can take to end after its last mark (the simulated session waits this long)
+    return AUTO_TRIGGER ? TRIGGER_SILENCE_WORDS * 7 * 1200 / MIN_WPM + 1000 : 0;
+}
+
+static inline int Trigger_Is_Active(int value){
+    return abs(value * 16 - Trigger_BASELINE_Q4) >= TRIGGER_CONTRAST * 16;
+}
+
+static int Trigger_Watch_Start(void){
+    // Returns '1' on the first call after a message, when standby sampling (re)starts
+    if (Trigger_WATCHING){
+        return 0;
+    }
+    Trigger_WATCHING = 1;
+    Trigger_COUNT = 0;
+    Trigger_CONFIRMED = 0;
+    Trigger_BASELINE_Q4 = -1; // Re-learned, the light may have changed during the message
+    return 1;
+}
+
+static int Trigger_Watch_Push(int value, unsigned long long time_US){
+    // Keeps a standby value in the pre-trigger ring, returns '1' when it confirms the start of a message
+    Trigger_VALUES[Trigger_COUNT % TRIGGER_PRETRIGGER] = value;
+    Trigger_TIMES[Trigger_COUNT % TRIGGER_PRETRIGGER] = time_US;
+    Trigger_COUNT += 1;
+    if (Trigger_BASELINE_Q4 < 0){
+        Trigger_BASELINE_Q4 = value * 16;
+        return 0;
+    }
+    if (Trigger_Is_Active(value)){
+        Trigger_CONFIRMED += 1;
+        return Trigger_CONFIRMED >= TRIGGER_CONFIRM;
+    }
+    Trigger_CONFIRMED = 0;
+    Trigger_BASELINE_Q4 += (value * 16 - Trigger_BASELINE_Q4) >> TRIGGER_BASELINE_SHIFT;
+    return 0;
+}
+
+static int Trigger_Drain(int *values, unsigned long long *times, unsigned char *weights){
+    // Copies the pre-trigger ring oldest first to the start of the message, returns the number of values
+    int count = Trigger_COUNT < TRIGGER_PRETRIGGER ? Trigger_COUNT : TRIGGER_PRETRIGGER;
+    int first = Trigger_COUNT - count;
+    for (int i = 0; i < count; i++){
+        values[i] = Trigger_VALUES[(first + i) % TRIGGER_PRETRIGGER];
+        times[i] = Trigger_TIMES[(first + i) % TRIGGER_PRETRIGGER];
+        weights[i] = 1;
+    }
+    Trigger_COUNT = 0;
+    return count;
+}
+
+static void Trigger_Message_Reset(void){
+    // Called when reading starts, by the trigger or by the button
+    Trigger_WATCHING = 0;
+    Trigger_QUIET = 0;
+    Trigger_ACTIVE = Trigger_CONFIRMED >= TRIGGER_CONFIRM;
+}
+
+static void Trigger_Set_Unit(int unit_Values){
+    // Called by the decode thread when the calibration of a message is known, with 0 when it is withdrawn
+    atomic_store_explicit(&Trigger_UNIT, unit_Values, memory_order_relaxed);
+}
+
+static int Trigger_Silence_Push(int value){
+    // Follows a value read during a message, returns '1' once the silence has lasted long enough to end it
+    if (Trigger_BASELINE_Q4 < 0){
+        Trigger_BASELINE_Q4 = value * 16; // Started by the button before any standby value
+    }
+    int active = Trigger_Is_Active(value);
+    if (active != Trigger_ACTIVE){
+        Trigger_ACTIVE = active;
+        Trigger_QUIET = 0;
+        return 0;
+    }
+    Trigger_QUIET += 1;
+    int unit_Values = atomic_load_explicit(&Trigger_UNIT, memory_order_relaxed);
+    if (unit_Values <= 0){
+        unit_Values = (int)(Reader_Session.sample_HZ * 1.2 / MIN_WPM + 0.5); // Longest expected unit
+    }
+    return Trigger_QUIET >= TRIGGER_SILENCE_WORDS * 7 * (unit_Values > 0 ? unit_Values : 1);
+}
+
+#endif
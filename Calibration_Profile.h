@@ -0,0 +1,226 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Persistent Calibration Profiles (shared by both readers)
+// *****************************************************
+
+/*  Keeps the calibration of a reader/channel in a small key=value file so a
+    fixed installation does not have to relearn the same optics every session.
+
+    With CALIBRATION_PROFILE set to '1':
+        -- at startup the profile of the reader/channel is loaded (if present)
+           and the reader starts converting straight away, skipping the
+           calibration stages
+        -- while converting, every classified run nudges its length estimate
+           (exponential moving average with weight 1/PROFILE_EWMA_WEIGHT) and
+           the BLACK and WHITE levels are tracked the same way (1/PROFILE_LEVEL_WEIGHT)
+        -- after every message the refined values are written back
+
+    Lengths are stored together with the sample rate they were measured at and
+    are rescaled when a later session samples at a different rate. Runs that
+    are more than PROFILE_OUTLIER off their estimate (word gaps, lead-in) do
+    not refine it.
+
+    The file is written to a temp file and renamed, so a crash never leaves a
+    half-written profile behind.
+*/
+
+#ifndef CALIBRATION_PROFILE_H
+#define CALIBRATION_PROFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "Sample_Rate.h"
+#include "Sample_Filter.h"
+#include "Edge_Timing.h"
+
+
+// _________________________________________________
+//  Profile Configuration
+// _________________________________________________
+
+#ifndef CALIBRATION_PROFILE
+#define CALIBRATION_PROFILE 0 // Set to '1' to load, refine and save the calibration profile
+#endif
+
+#ifndef PROFILE_DIR
+#define PROFILE_DIR "/var/tmp" // Directory holding the profiles (one file per reader and channel)
+#endif
+
+#define PROFILE_EWMA_WEIGHT 8   // A new run moves its length estimate by 1/8 of the difference
+#define PROFILE_LEVEL_WEIGHT 64 // A new value moves its level by 1/64 (edge values would otherwise pull it around)
+#define PROFILE_OUTLIER 0.5     // Runs further than this fraction from their estimate are not used
+
+
+// _________________________________________________
+//  Profile State
+// _________________________________________________
+
+typedef struct {
+    double sample_HZ;      // Sample rate the lengths were measured at
+    int decimation;
+    int filter;            // SAMPLE_FILTER the profile was recorded with
+    int filter_Window;
+    double threshold;      // BLACK/WHITE threshold
+    double low_Level;      // Average value below the threshold
+    double high_Level;     // Average value above the threshold
+    double dot;            // Lengths in stored values
+    double dash;
+    double small_Space;
+    double big_Space;
+    int sessions;          // Number of messages the profile has been refined with
+    int loaded;            // '1' when the profile came from a file
+} Calibration_Profile;
+
+static Calibration_Profile Reader_Profile;
+
+
+// _________________________________________________
+//  Profile Functions
+// _________________________________________________
+
+static void Profile_Path(char *path, size_t size, const char *reader, int channel){
+    snprintf(path, size, "%s/morse_%s_%d.profile", PROFILE_DIR, reader, channel);
+}
+
+static int Profile_Load(const char *reader, int channel){
+    // Reads the profile of this reader/channel, returns 0 when a usable profile was loaded
+    char path[256];
+    char line[128];
+    Profile_Path(path, sizeof(path), reader, channel);
+    FILE *file = fopen(path, "r");
+    if (file == NULL){
+        return -1;
+    }
+
+    Calibration_Profile profile;
+    memset(&profile, 0, sizeof(profile));
+    while (fgets(line, sizeof(line), file) != NULL){
+        char *separator = strchr(line, '=');
+        if (line[0] == '#' || separator == NULL){
+            continue;
+        }
+        *separator = '\0';
+        double value = atof(separator + 1);
+        if (strcmp(line, "sample_hz") == 0) profile.sample_HZ = value;
+        else if (strcmp(line, "decimation") == 0) profile.decimation = (int)value;
+        else if (strcmp(line, "filter") == 0) profile.filter = (int)value;
+        else if (strcmp(line, "filter_window") == 0) profile.filter_Window = (int)value;
+        else if (strcmp(line, "threshold") == 0) profile.threshold = value;
+        else if (strcmp(line, "low_level") == 0) profile.low_Level = value;
+        else if (strcmp(line, "high_level") == 0) profile.high_Level = value;
+        else if (strcmp(line, "dot") == 0) profile.dot = value;
+        else if (strcmp(line, "dash") == 0) profile.dash = value;
+        else if (strcmp(line, "small_space") == 0) profile.small_Space = value;
+        else if (strcmp(line, "big_space") == 0) profile.big_Space = value;
+        else if (strcmp(line, "sessions") == 0) profile.sessions = (int)value;
+    }
+    fclose(file);
+
+    if (profile.sample_HZ <= 0 || profile.threshold <= 0 || profile.dot <= 0 || profile.dash <= profile.dot
+        || profile.small_Space <= 0 || profile.big_Space <= profile.small_Space){
+        printf("WARNING: ignoring incomplete calibration profile %s\n", path);
+        return -1;
+    }
+
+    // Rescale the lengths when this session samples at a different rate
+    double scale = Reader_Session.sample_HZ / profile.sample_HZ;
+    if (scale < 0.99 || scale > 1.01){
+        printf("Profile recorded at %.1f values/s, rescaling lengths by %.2f\n", profile.sample_HZ, scale);
+        profile.dot *= scale;
+        profile.dash *= scale;
+        profile.small_Space *= scale;
+        profile.big_Space *= scale;
+        profile.sample_HZ = Reader_Session.sample_HZ;
+    }
+    if (profile.filter != SAMPLE_FILTER){
+        printf("Profile recorded with another filter (%d), the threshold may need a few messages to settle\n", profile.filter);
+    }
+
+    profile.loaded = 1;
+    Reader_Profile = profile;
+    printf("Loaded calibration profile %s (%d messages)\n", path, profile.sessions);
+    return 0;
+}
+
+static void Profile_Apply(atomic_int *threshold, atomic_int *dot, atomic_int *dash, atomic_int *small_Space, atomic_int *big_Space){
+    // Copies the profile into the reader's calibrating constants (published by the status flag set after this)
+    atomic_store_explicit(threshold, (int)(Reader_Profile.threshold + 0.5), memory_order_relaxed);
+    atomic_store_explicit(dot, (int)(Reader_Profile.dot * EDGE_RUN_ONE + 0.5), memory_order_relaxed);
+    atomic_store_explicit(dash, (int)(Reader_Profile.dash * EDGE_RUN_ONE + 0.5), memory_order_relaxed);
+    atomic_store_explicit(small_Space, (int)(Reader_Profile.small_Space * EDGE_RUN_ONE + 0.5), memory_order_relaxed);
+    atomic_store_explicit(big_Space, (int)(Reader_Profile.big_Space * EDGE_RUN_ONE + 0.5), memory_order_relaxed);
+}
+
+static void Profile_Capture(int threshold, int dot, int dash, int small_Space, int big_Space){
+    // Seeds the estimates from the calibration the conversion is about to use
+    Reader_Profile.sample_HZ = Reader_Session.sample_HZ;
+    Reader_Profile.decimation = Reader_Session.decimation;
+    Reader_Profile.filter = SAMPLE_FILTER;
+    Reader_Profile.filter_Window = Reader_Filter.window;
+    Reader_Profile.threshold = threshold;
+    // Keep the fractional estimates of a loaded profile unless the calibration changed them
+    // (the lengths are in run length units, the profile keeps stored values)
+    if ((int)(Reader_Profile.dot * EDGE_RUN_ONE + 0.5) != dot) Reader_Profile.dot = (double)dot / EDGE_RUN_ONE;
+    if ((int)(Reader_Profile.dash * EDGE_RUN_ONE + 0.5) != dash) Reader_Profile.dash = (double)dash / EDGE_RUN_ONE;
+    if ((int)(Reader_Profile.small_Space * EDGE_RUN_ONE + 0.5) != small_Space) Reader_Profile.small_Space = (double)small_Space / EDGE_RUN_ONE;
+    if ((int)(Reader_Profile.big_Space * EDGE_RUN_ONE + 0.5) != big_Space) Reader_Profile.big_Space = (double)big_Space / EDGE_RUN_ONE;
+    Reader_Profile.low_Level = 0;
+    Reader_Profile.high_Level = 0;
+}
+
+static void Profile_Track_Level(int value, int threshold){
+    // Follows the average value on either side of the threshold
+    if (value <= 0){
+        return; // Termination symbol or gap marker
+    }
+    double *level = (value > threshold) ? &Reader_Profile.high_Level : &Reader_Profile.low_Level;
+    if (*level == 0){
+        *level = value;
+    } else {
+        *level += (value - *level) / PROFILE_LEVEL_WEIGHT;
+    }
+}
+
+static int Profile_Refine(double *estimate, int measured){
+    // Moves a length estimate towards a measured run, returns the new length in run length units (Edge_Timing.h)
+    double difference = (double)measured / EDGE_RUN_ONE - *estimate;
+    if (difference < -PROFILE_OUTLIER * *estimate || difference > PROFILE_OUTLIER * *estimate){
+        return (int)(*estimate * EDGE_RUN_ONE + 0.5); // Outlier (word gap, lead-in or noise)
+    }
+    *estimate += difference / PROFILE_EWMA_WEIGHT;
+    return (int)(*estimate * EDGE_RUN_ONE + 0.5);
+}
+
+static void Profile_Save(const char *reader, int channel){
+    // Writes the refined profile (the threshold moves to the middle of the tracked levels)
+    char path[256];
+    char temp_Path[264];
+    Profile_Path(path, sizeof(path), reader, channel);
+    snprintf(temp_Path, sizeof(temp_Path), "%s.tmp", path);
+
+    if (Reader_Profile.low_Level > 0 && Reader_Profile.high_Level > 0){
+        Reader_Profile.threshold = (Reader_Profile.low_Level + Reader_Profile.high_Level) / 2;
+    }
+    Reader_Profile.sessions += 1;
+
+    FILE *file = fopen(temp_Path, "w");
+    if (file == NULL){
+        printf("WARNING: could not write calibration profile %s\n", path);
+        return;
+    }
+    fprintf(file, "# Morse code reader calibration profile\n");
+    fprintf(file, "reader=%s\nchannel=%d\n", reader, channel);
+    fprintf(file, "sample_hz=%.3f\ndecimation=%d\n", Reader_Profile.sample_HZ, Reader_Profile.decimation);
+    fprintf(file, "filter=%d\nfilter_window=%d\n", Reader_Profile.filter, Reader_Profile.filter_Window);
+    fprintf(file, "threshold=%.1f\nlow_level=%.1f\nhigh_level=%.1f\n",
+            Reader_Profile.threshold, Reader_Profile.low_Level, Reader_Profile.high_Level);
+    fprintf(file, "dot=%.2f\ndash=%.2f\nsmall_space=%.2f\nbig_space=%.2f\n",
+            Reader_Profile.dot, Reader_Profile.dash, Reader_Profile.small_Space, Reader_Profile.big_Space);
+    fprintf(file, "sessions=%d\n", Reader_Profile.sessions);
+    fclose(file);
+    rename(temp_Path, path);
+}
+
+#endif
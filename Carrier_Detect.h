@@ -0,0 +1,140 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Modulated Carrier and Goertzel Detection (LED reader)
+// *****************************************************
+
+/*  With CARRIER_MODE set to '1' the LED sender does not simply switch
+    LED_PIN_1 on for a mark: it flashes it as a square wave at CARRIER_HZ for
+    the length of the mark. The reader then no longer thresholds brightness but
+    the energy at the carrier frequency, so daylight, lamps being switched and
+    mains flicker (all at DC or 100/120 Hz and their harmonics) no longer move
+    the marks and spaces.
+
+    The carrier sits at a quarter of the ADC conversion rate and every stored
+    value is the output of a Goertzel filter over its block of CARRIER_BLOCK
+    conversions. At fs/4 the Goertzel coefficient 2cos(2*pi/4) is 0, so the
+    filter is
+
+        s[n] = x[n] - s[n-2]          power = s[N-1]^2 + s[N-2]^2
+
+    one subtraction per conversion and two multiplies per block, in integers.
+    The block length is a multiple of 4, so DC falls exactly on a zero of the
+    filter. The stored value is the carrier amplitude 2*sqrt(power)/N, so marks
+    still read high and the rest of the reader is unchanged.
+
+    The sender paces the square wave on the reader's clock; the carrier
+    frequency comes from the sample rate chosen at startup.
+*/
+
+#ifndef CARRIER_DETECT_H
+#define CARRIER_DETECT_H
+
+#include <stdio.h>
+#include "Stage_Metrics.h"
+#include "Sample_Rate.h"
+#include "Reader_Clock.h"
+
+
+// _________________________________________________
+//  Carrier Configuration
+// _________________________________________________
+
+#ifndef CARRIER_MODE
+#define CARRIER_MODE 0 // Set to '1' to send marks as a carrier and detect them with the Goertzel filter
+#endif
+
+#ifndef CARRIER_BLOCK
+#define CARRIER_BLOCK 16 // Conversions per stored value in carrier mode (multiple of 4, at least 8)
+#endif
+
+
+// _________________________________________________
+//  Carrier State
+// _________________________________________________
+
+static double Carrier_HZ = 0.0;                 // Carrier frequency, set by Carrier_Setup()
+static void (*Carrier_Write)(int, int) = NULL; // digitalWrite, set by Carrier_Setup()
+static long long Carrier_S1 = 0;               // Goertzel state s[n-1]
+static long long Carrier_S2 = 0;               // Goertzel state s[n-2]
+static int Carrier_PUSHED = 0;                 // Conversions in the current block
+
+
+// _________________________________________________
+//  Carrier Functions
+// _________________________________________________
+
+static void Carrier_Setup(void (*write_Pin)(int, int)){
+    // Sets the decimation to whole carrier blocks and derives the carrier frequency (call after Session_Start)
+    Carrier_Write = write_Pin;
+    if (!CARRIER_MODE){
+        return;
+    }
+    int block = CARRIER_BLOCK < 8 ? 8 : CARRIER_BLOCK - CARRIER_BLOCK % 4;
+    Reader_Session.decimation = block;
+    Reader_Session.adc_HZ = Reader_Session.sample_HZ * block;
+    atomic_store_explicit(&Reader_Metrics.decimation, (unsigned long long)block, memory_order_relaxed);
+    if (Reader_Session.adc_HZ > Reader_Session.probed_HZ * RATE_HEADROOM){
+        printf("WARNING: carrier mode needs %.0f conversions/s, the ADC only allows %.0f\n",
+               Reader_Session.adc_HZ, Reader_Session.probed_HZ * RATE_HEADROOM);
+    }
+    Carrier_HZ = Reader_Session.adc_HZ / 4.0;
+    printf("Carrier: %.1f Hz, Goertzel over %d conversions (%.0f conversions/s)\n", Carrier_HZ, block, Reader_Session.adc_HZ);
+}
+
+static inline void Carrier_Push(int conversion){
+    // Adds one ADC conversion to the Goertzel filter
+    long long s0 = conversion - Carrier_S2;
+    Carrier_S2 = Carrier_S1;
+    Carrier_S1 = s0;
+    Carrier_PUSHED += 1;
+}
+
+static unsigned long long Carrier_Square_Root(unsigned long long value){
+    // Integer square root (bit by bit), so the reader does not need libm
+    unsigned long long root = 0;
+    unsigned long long bit = 1ULL << 62;
+    while (bit > value){
+        bit >>= 2;
+    }
+    while (bit != 0){
+        if (value >= root + bit){
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+static int Carrier_Output(void){
+    // Returns the carrier amplitude of the block and starts the next one (never 0, which ends a message)
+    unsigned long long power = (unsigned long long)(Carrier_S1 * Carrier_S1 + Carrier_S2 * Carrier_S2);
+    int amplitude = Carrier_PUSHED > 0 ? (int)(2 * Carrier_Square_Root(power) / (unsigned long long)Carrier_PUSHED) : 0;
+    Carrier_S1 = 0;
+    Carrier_S2 = 0;
+    Carrier_PUSHED = 0;
+    return amplitude > 0 ? amplitude : 1;
+}
+
+static void Carrier_Hold(int pin, int milliseconds){
+    // Keeps a mark on 'pin' for the given time: a square wave at Carrier_HZ in carrier mode, otherwise just waits
+    if (!CARRIER_MODE || Carrier_HZ <= 0){
+        Clock_Delay(milliseconds);
+        return;
+    }
+    long long half_Period = (long long)(500000000.0 / Carrier_HZ);
+    long long next = Clock_Now_NS();
+    long long end = next + (long long)milliseconds * 1000000LL;
+    int level = 1;
+    while (next + half_Period <= end){
+        next += half_Period; // Absolute schedule, so the frequency does not drift with wake-up latency
+        Clock_Sleep_Until_NS(next);
+        level = !level;
+        Carrier_Write(pin, level);
+    }
+    Clock_Sleep_Until_NS(end);
+}
+
+#endif
@@ -0,0 +1,182 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Multi-LDR Diversity Combining (shared by both readers)
+// *****************************************************
+
+/*  With DIVERSITY_CHANNELS above 1 the readers sample that many ADC channels
+    (ADC_CHANNEL, ADC_CHANNEL + 1, ...) with LDRs pointed at the same signal
+    and combine them into the one value the filter and the thresholding see.
+
+    Every channel has its own gain and offset (and one may be misaligned or
+    covered), so each is first normalised against its own envelope: the
+    highest and lowest value seen, both slowly decaying towards each other
+    (by 1/2^DIVERSITY_DECAY_SHIFT per conversion) so the envelope follows
+    drifting light levels. A channel whose envelope is narrower than
+    DIVERSITY_MIN_CONTRAST takes no part. The normalised values run from 0 to
+    DIVERSITY_FULL_SCALE with BLACK at the same end as on a single channel.
+
+    DIVERSITY_COMBINER selects how the channels are combined:
+        DIVERSITY_MAX       - the channel reading the most BLACK wins (best
+                              for a strip wandering under the sensors)
+        DIVERSITY_WEIGHTED  - average weighted by each channel's contrast
+        DIVERSITY_VOTE      - every channel decides BLACK or WHITE with its own
+                              threshold (with hysteresis, so a channel holds
+                              its state for the whole run) and the majority
+                              wins; a tie keeps the previous state
+
+    All of it is integer arithmetic on a few values per conversion. The startup
+    rate probe times the combined read, so the sample rate is chosen for the
+    cost of all channels.
+*/
+
+#ifndef CHANNEL_DIVERSITY_H
+#define CHANNEL_DIVERSITY_H
+
+#include <stdio.h>
+
+
+// _________________________________________________
+//  Diversity Configuration
+// _________________________________________________
+
+#define DIVERSITY_MAX 0
+#define DIVERSITY_WEIGHTED 1
+#define DIVERSITY_VOTE 2
+
+#ifndef DIVERSITY_CHANNELS
+#define DIVERSITY_CHANNELS 1 // Number of ADC channels combined (1 = single LDR, no combining)
+#endif
+
+#ifndef DIVERSITY_COMBINER
+#define DIVERSITY_COMBINER DIVERSITY_MAX // Selects one of the three combiners above
+#endif
+
+#ifndef DIVERSITY_MIN_CONTRAST
+#define DIVERSITY_MIN_CONTRAST 64 // Narrowest envelope of a channel that takes part
+#endif
+
+#ifndef DIVERSITY_DECAY_SHIFT
+#define DIVERSITY_DECAY_SHIFT 12 // Envelope decay per conversion is 1/2^N of its width (about 13 s at 320 conversions/s)
+#endif
+
+#define DIVERSITY_FULL_SCALE 1023 // Range of the combined value (same as the 10-bit ADC)
+#define DIVERSITY_MAX_CHANNELS 8   // The MCP3004/3008 has at most 8 channels
+
+
+// _________________________________________________
+//  Diversity State
+// _________________________________________________
+
+typedef struct {
+    int high;       // Envelope in 1/256 ADC steps
+    int low;
+    int started;
+    int black;      // Current decision of the channel (DIVERSITY_VOTE)
+} Diversity_Channel;
+
+static Diversity_Channel Diversity_STATE[DIVERSITY_MAX_CHANNELS];
+static int (*Diversity_Read_ADC)(int) = NULL; // analogRead, set by Diversity_Setup()
+static int Diversity_BLACK_LOW = 0;            // '1' when BLACK reads low (paper reader)
+static int Diversity_BLACK = 0;                // Previous combined decision (DIVERSITY_VOTE)
+
+
+// _________________________________________________
+//  Diversity Functions
+// _________________________________________________
+
+static void Diversity_Setup(int (*read_Sample)(int), int black_Low){
+    // Sets the ADC read function and which end of the range is BLACK
+    Diversity_Read_ADC = read_Sample;
+    Diversity_BLACK_LOW = black_Low;
+    if (DIVERSITY_CHANNELS > 1){
+        const char *names[] = { "max", "weighted", "vote" };
+        printf("Diversity: combining %d channels (%s)\n", DIVERSITY_CHANNELS, names[DIVERSITY_COMBINER]);
+    }
+}
+
+static inline int Diversity_Track(Diversity_Channel *state, int value){
+    // Updates the envelope of one channel and returns its width in ADC steps
+    int scaled = value << 8;
+    if (!state->started){
+        state->high = scaled;
+        state->low = scaled;
+        state->started = 1;
+    }
+    int decay = (state->high - state->low) >> DIVERSITY_DECAY_SHIFT;
+    state->high = (scaled > state->high) ? scaled : state->high - decay;
+    state->low = (scaled < state->low) ? scaled : state->low + decay;
+    return (state->high - state->low) >> 8;
+}
+
+static int Diversity_Read(int first_Channel){
+    // Reads and combines DIVERSITY_CHANNELS channels starting at first_Channel
+    if (DIVERSITY_CHANNELS <= 1){
+        return Diversity_Read_ADC(first_Channel);
+    }
+    int white = Diversity_BLACK_LOW ? DIVERSITY_FULL_SCALE : 0;
+    int black = DIVERSITY_FULL_SCALE - white;
+    int best = white;
+    long weighted_SUM = 0;
+    long weight_TOTAL = 0;
+    int votes = 0;
+    int voters = 0;
+
+    for (int i = 0; i < DIVERSITY_CHANNELS && i < DIVERSITY_MAX_CHANNELS; i++){
+        Diversity_Channel *state = &Diversity_STATE[i];
+        int value = Diversity_Read_ADC(first_Channel + i);
+        int contrast = Diversity_Track(state, value);
+        if (contrast < DIVERSITY_MIN_CONTRAST){
+            continue; // No signal seen on this channel (yet)
+        }
+        int normalised = (int)(((long)((value << 8) - state->low) * DIVERSITY_FULL_SCALE) / (state->high - state->low));
+        normalised = normalised < 0 ? 0 : (normalised > DIVERSITY_FULL_SCALE ? DIVERSITY_FULL_SCALE : normalised);
+
+        if (DIVERSITY_COMBINER == DIVERSITY_MAX){
+            // Keep the value closest to BLACK
+            if (Diversity_BLACK_LOW ? normalised < best : normalised > best){
+                best = normalised;
+            }
+        } else if (DIVERSITY_COMBINER == DIVERSITY_WEIGHTED){
+            weighted_SUM += (long)normalised * contrast;
+            weight_TOTAL += contrast;
+        } else {
+            // Decide with hysteresis of an eighth of the range around the middle
+            int towards_Black = Diversity_BLACK_LOW ? DIVERSITY_FULL_SCALE - normalised : normalised;
+            if (towards_Black > DIVERSITY_FULL_SCALE / 2 + DIVERSITY_FULL_SCALE / 8){
+                state->black = 1;
+            } else if (towards_Black < DIVERSITY_FULL_SCALE / 2 - DIVERSITY_FULL_SCALE / 8){
+                state->black = 0;
+            }
+            votes += state->black;
+            voters += 1;
+        }
+    }
+
+    if (DIVERSITY_COMBINER == DIVERSITY_WEIGHTED){
+        return weight_TOTAL > 0 ? (int)(weighted_SUM / weight_TOTAL) : white;
+    }
+    if (DIVERSITY_COMBINER == DIVERSITY_VOTE){
+        if (2 * votes > voters){
+            Diversity_BLACK = 1;
+        } else if (2 * votes < voters || voters == 0){
+            Diversity_BLACK = 0;
+        }
+        return Diversity_BLACK ? black : white;
+    }
+    return best;
+}
+
+static void Diversity_Report(int first_Channel){
+    // Prints the contrast of every channel so a covered or misaligned LDR stands out
+    if (DIVERSITY_CHANNELS <= 1){
+        return;
+    }
+    printf("Diversity channels:");
+    for (int i = 0; i < DIVERSITY_CHANNELS && i < DIVERSITY_MAX_CHANNELS; i++){
+        int contrast = (Diversity_STATE[i].high - Diversity_STATE[i].low) >> 8;
+        printf(" %d: contrast %d%s", first_Channel + i, contrast, contrast < DIVERSITY_MIN_CONTRAST ? " (unused)" : "");
+    }
+    printf("\n");
+}
+
+#endif
@@ -0,0 +1,148 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Decode Confidence (shared by both readers)
+// *****************************************************
+
+/*  Input_Speed_Adjuster() snaps every run to the nearest length. This module
+    keeps what it throws away: for every run of a character
+
+        residual = (measured - chosen) / chosen
+
+    e.g. +0.25 for a dot that was a quarter too long, and a margin that is 1 for
+    a run of exactly the chosen length and 0 for one right on the decision
+    boundary between the two lengths (halfway between dot and dash, or small
+    and big space). Runs at or beyond the longer length (dashes, and big
+    spaces including word gaps) have nothing past them to be mistaken for,
+    so their margin is 1. The confidence of a character is the margin of its weakest
+    run (elements, the gaps inside it and the gap that ended it).
+
+    Per character the residuals and the confidence go into the JSON Lines
+    record, per message Output() prints the mean and lowest confidence, and
+    the metrics keep a confidence histogram, the number of characters below
+    CONFIDENCE_LOW and the summed absolute residual.
+*/
+
+#ifndef DECODE_CONFIDENCE_H
+#define DECODE_CONFIDENCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Stage_Metrics.h"
+
+
+// _________________________________________________
+//  Confidence Configuration
+// _________________________________________________
+
+#ifndef CONFIDENCE_LOW
+#define CONFIDENCE_LOW 0.5 // Characters below this confidence are counted (and listed by Output())
+#endif
+
+#define CONFIDENCE_MAX_RUNS 16 // Runs kept per character (7 elements, 6 inner gaps, the ending gap)
+
+#define RUN_DOT '.'
+#define RUN_DASH '-'
+#define RUN_SMALL_SPACE 's' // Gap inside a character
+#define RUN_BIG_SPACE 'S'   // Gap that ended the character
+
+
+// _________________________________________________
+//  Confidence State
+// _________________________________________________
+
+typedef struct {
+    double residual[CONFIDENCE_MAX_RUNS];
+    char kind[CONFIDENCE_MAX_RUNS + 1];   // RUN_* of every residual, as a string
+    int count;
+    double confidence;                    // Lowest margin of the runs so far
+} Char_Confidence;
+
+typedef struct {
+    int count;
+    double sum;
+    double lowest;
+    int lowest_Index;
+    char lowest_Symbol;
+    int low_COUNT;                        // Characters below CONFIDENCE_LOW
+} Message_Confidence;
+
+static Char_Confidence Char_CONFIDENCE;       // Character being decoded by Conversion()
+static Message_Confidence Message_CONFIDENCE; // Message being decoded
+
+
+// _________________________________________________
+//  Confidence Functions
+// _________________________________________________
+
+static void Confidence_Reset(Char_Confidence *confidence){
+    confidence->count = 0;
+    confidence->kind[0] = '\0';
+    confidence->confidence = 1.0;
+}
+
+static void Confidence_Run(Char_Confidence *confidence, char kind, int measured, int chosen, int other){
+    // Records one classified run: 'chosen' is the length it was snapped to, 'other' the length it was not
+    double residual = chosen > 0 ? (double)(measured - chosen) / (double)chosen : 0.0;
+    double half_Distance = abs(other - chosen) / 2.0;
+    double margin = half_Distance > 0 ? 1.0 - abs(measured - chosen) / half_Distance : 1.0;
+    if (chosen > other && measured >= chosen){
+        margin = 1.0; // Only the boundary below the longer length can be crossed
+    }
+    if (margin < 0.0){
+        margin = 0.0;
+    }
+    if (margin < confidence->confidence){
+        confidence->confidence = margin;
+    }
+    if (confidence->count < CONFIDENCE_MAX_RUNS){
+        confidence->residual[confidence->count] = residual;
+        confidence->kind[confidence->count] = kind;
+        confidence->count += 1;
+        confidence->kind[confidence->count] = '\0';
+    }
+    Metrics_Count(&Reader_Metrics.residual_abs_permille_total, (unsigned long long)(abs(measured - chosen) * 1000.0 / (chosen > 0 ? chosen : 1)));
+}
+
+static void Confidence_Char_Done(const Char_Confidence *confidence, char symbol, int index){
+    // Adds an emitted character to the message statistics and the metrics
+    Message_Confidence *message = &Message_CONFIDENCE;
+    if (message->count == 0 || confidence->confidence < message->lowest){
+        message->lowest = confidence->confidence;
+        message->lowest_Index = index;
+        message->lowest_Symbol = symbol;
+    }
+    message->count += 1;
+    message->sum += confidence->confidence;
+    if (confidence->confidence < CONFIDENCE_LOW){
+        message->low_COUNT += 1;
+        Metrics_Count(&Reader_Metrics.low_confidence_chars_total, 1);
+    }
+    int bucket = (int)(confidence->confidence * CONFIDENCE_BUCKET_COUNT);
+    Metrics_Count(&Reader_Metrics.confidence_bucket[bucket < CONFIDENCE_BUCKET_COUNT ? bucket : CONFIDENCE_BUCKET_COUNT - 1], 1);
+    Metrics_Count(&Reader_Metrics.confidence_permille_total, (unsigned long long)(confidence->confidence * 1000.0));
+}
+
+static double Confidence_Mean(const Message_Confidence *message){
+    return message->count > 0 ? message->sum / message->count : 0.0;
+}
+
+static void Confidence_Report(void){
+    // Prints the confidence of the current message (nothing when no character was decoded)
+    const Message_Confidence *message = &Message_CONFIDENCE;
+    if (message->count == 0){
+        return;
+    }
+    printf("Confidence: mean %.2f, lowest %.2f ('%c' at position %d)", Confidence_Mean(message), message->lowest,
+           message->lowest_Symbol, message->lowest_Index + 1);
+    if (message->low_COUNT > 0){
+        printf(", %d character(s) below %.2f", message->low_COUNT, CONFIDENCE_LOW);
+    }
+    printf("\n");
+}
+
+static void Confidence_Message_Reset(void){
+    Message_CONFIDENCE = (Message_Confidence){ 0, 0.0, 0.0, 0, ' ', 0 };
+    Confidence_Reset(&Char_CONFIDENCE);
+}
+
+#endif
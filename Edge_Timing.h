@@ -0,0 +1,80 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Sub-Sample Edge Timing (shared by both readers)
+// *****************************************************
+
+/*  Run lengths are counted in stored values, so an edge can only be placed on
+    a stored value and every measured dot or space is off by up to one value.
+    At the low end of the sample rate range (MIN_UNIT_SAMPLES values per unit)
+    that is a quarter of a unit, which is what limits MAX_WPM for a given ADC.
+
+    With EDGE_INTERPOLATION set to '1' the edge is placed where the straight
+    line between the two stored values around it crosses
+    BLACK_WHITE_Differentiator:
+
+        fraction = (threshold - previous) / (current - previous)
+
+    The LDR's response and the averaging of the decimation and the filter turn
+    every change of light into a ramp over a value or two, so the values next
+    to an edge say where between them it happened.
+
+    All run lengths (calibration, conversion and the calibration profile) are
+    then counted in 1/EDGE_RUN_ONE of a stored value (Q8 fixed point). A run
+    that starts at an edge gets the part of the previous value after the
+    crossing added, and the run it ends loses it. The classification only
+    compares lengths with each other, so nothing else changes. Without
+    interpolation EDGE_RUN_ONE is 1 and the lengths are whole stored values,
+    exactly as before.
+
+    Because edges are now found to a fraction of a value, MIN_UNIT_SAMPLES
+    defaults to 2 instead of 4, which halves the sample rate (and the CPU and
+    SPI time) chosen at startup for the same MAX_WPM.
+*/
+
+#ifndef EDGE_TIMING_H
+#define EDGE_TIMING_H
+
+#include <stdio.h>
+
+
+// _________________________________________________
+//  Edge Configuration
+// _________________________________________________
+
+#ifndef EDGE_INTERPOLATION
+#define EDGE_INTERPOLATION 0 // Set to '1' to place edges between stored values and count runs in Q8
+#endif
+
+#define EDGE_FRACTION_BITS 8
+#define EDGE_RUN_ONE (EDGE_INTERPOLATION ? (1 << EDGE_FRACTION_BITS) : 1) // One stored value in run length units
+
+
+// _________________________________________________
+//  Edge Functions
+// _________________________________________________
+
+static inline int Edge_Correction(int previous, int current, int threshold, int weight){
+    // Returns the part of the step from 'previous' to 'current' after the threshold crossing, in run length units
+    // (the new run starts that much earlier than 'current'); 0 without interpolation
+    if (!EDGE_INTERPOLATION || current == previous || previous <= 0){
+        return 0;
+    }
+    int fraction = (int)(((long long)(threshold - previous) * EDGE_RUN_ONE) / (current - previous));
+    if (fraction < 0){
+        fraction = 0;
+    } else if (fraction > EDGE_RUN_ONE){
+        fraction = EDGE_RUN_ONE;
+    }
+    return (EDGE_RUN_ONE - fraction) * weight;
+}
+
+static inline void Edge_Print_Length(const char *label, int length){
+    // Prints a run length in stored values
+    if (EDGE_INTERPOLATION){
+        printf("%s: %.2f\n", label, (double)length / EDGE_RUN_ONE);
+    } else {
+        printf("%s: %d\n", label, length);
+    }
+}
+
+#endif
@@ -0,0 +1,280 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Flight Recorder (shared by both readers)
+// *****************************************************
+
+/*  With FLIGHT_RECORDER set to '1' the readers keep the last
+    FLIGHT_RECORDER_MINUTES of the signal in a memory-mapped file ring
+    (FLIGHT_RECORDER_DIR/morse_<reader>_<channel>.flight), so the input of a
+    misdecoded message can still be looked at afterwards.
+
+    Every stored value goes into the ring with the FLIGHT_EDGE bit set where it
+    crossed the threshold the reader was using at that moment (the run
+    boundaries the decoder saw), and the end of every message is marked. The
+    acquisition thread only writes to memory: the write position is published
+    in the file header every FLIGHT_BATCH values, and a separate thread calls
+    msync(MS_ASYNC) every FLIGHT_SYNC_MS, so the hot path never makes a system
+    call. The whole file is touched once at startup so recording never faults
+    in a page either.
+
+    Dumping the ring into a capture file (replayable with --decode):
+        -- send SIGUSR1 to a running reader, the dump is written next to the
+           flight file as morse_<reader>_<channel>_<unix time>.mcr
+        -- or, after a crash, run  ./reader --dump-flight <flight file> <capture file>
+
+    The flight file of the previous run is kept as <file>.prev.
+*/
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "Offline_Decode.h"
+
+
+// _________________________________________________
+//  Recorder Configuration
+// _________________________________________________
+
+#ifndef FLIGHT_RECORDER
+#define FLIGHT_RECORDER 0 // Set to '1' to keep the recent signal in the flight recorder ring
+#endif
+
+#ifndef FLIGHT_RECORDER_MINUTES
+#define FLIGHT_RECORDER_MINUTES 10 // Length of signal kept in the ring
+#endif
+
+#ifndef FLIGHT_RECORDER_DIR
+#define FLIGHT_RECORDER_DIR "/var/tmp"
+#endif
+
+#define FLIGHT_SYNC_MS 1000  // How often the ring is handed to the kernel for writeback
+#define FLIGHT_BATCH 64      // Values between two publications of the write position
+#define FLIGHT_EDGE 0x4000   // Set on values that crossed the threshold (10-bit ADC values never use it)
+#define FLIGHT_MAGIC "MCFR"
+#define FLIGHT_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t channel;
+    uint32_t flags;              // CAPTURE_FLAG_* of the reader
+    uint32_t capacity;           // Number of values in the ring
+    double sample_HZ;
+    atomic_ullong written;       // Values written since the start (published every FLIGHT_BATCH)
+    char reader[16];
+} Flight_Header;
+
+
+// _________________________________________________
+//  Recorder State
+// _________________________________________________
+
+static Flight_Header *Flight_HEADER = NULL; // Start of the mapping
+static int16_t *Flight_RING = NULL;         // Values follow the header
+static size_t Flight_SIZE = 0;
+static uint32_t Flight_INDEX = 0;           // Next ring slot (acquisition thread only)
+static unsigned long long Flight_WRITTEN = 0;
+static int Flight_ABOVE = 0;                // Side of the threshold of the previous value
+static char Flight_PATH[256];
+static volatile sig_atomic_t Flight_Dump_REQUESTED = 0;
+static pthread_t Flight_Sync_THREAD;
+
+
+// _________________________________________________
+//  Recording (acquisition thread)
+// _________________________________________________
+
+static inline void Flight_Record(int value, int threshold){
+    // Stores one value, flagged when it crossed the threshold
+    if (Flight_RING == NULL){
+        return;
+    }
+    int above = value > threshold;
+    Flight_RING[Flight_INDEX] = (int16_t)(value | (above != Flight_ABOVE ? FLIGHT_EDGE : 0));
+    Flight_ABOVE = above;
+    Flight_INDEX = (Flight_INDEX + 1 == Flight_HEADER->capacity) ? 0 : Flight_INDEX + 1;
+    Flight_WRITTEN += 1;
+    if ((Flight_WRITTEN & (FLIGHT_BATCH - 1)) == 0){
+        atomic_store_explicit(&Flight_HEADER->written, Flight_WRITTEN, memory_order_release);
+    }
+}
+
+static void Flight_Message_End(void){
+    // Marks the end of a message and publishes it straight away
+    if (Flight_RING == NULL){
+        return;
+    }
+    Flight_RING[Flight_INDEX] = CAPTURE_MESSAGE_MARKER;
+    Flight_INDEX = (Flight_INDEX + 1 == Flight_HEADER->capacity) ? 0 : Flight_INDEX + 1;
+    Flight_WRITTEN += 1;
+    atomic_store_explicit(&Flight_HEADER->written, Flight_WRITTEN, memory_order_release);
+}
+
+
+// _________________________________________________
+//  Dumping
+// _________________________________________________
+
+static int Flight_Dump(const Flight_Header *header, const char *capture_Path){
+    // Writes the published part of the ring, oldest value first, as a capture file
+    unsigned long long written = atomic_load_explicit(&header->written, memory_order_acquire);
+    const int16_t *ring = (const int16_t *)(header + 1);
+    unsigned long long count = written < header->capacity ? written : header->capacity;
+    if (count > FLIGHT_BATCH && written > header->capacity){
+        count -= FLIGHT_BATCH; // The oldest values may be overwritten while copying
+    }
+
+    FILE *file = fopen(capture_Path, "wb");
+    if (file == NULL){
+        printf("WARNING: could not write flight recorder dump %s\n", capture_Path);
+        return -1;
+    }
+    Capture_Header capture;
+    memset(&capture, 0, sizeof(capture));
+    memcpy(capture.magic, CAPTURE_MAGIC, 4);
+    capture.version = CAPTURE_VERSION;
+    capture.channel = header->channel;
+    capture.flags = header->flags;
+    capture.sample_HZ = header->sample_HZ;
+    fwrite(&capture, sizeof(capture), 1, file);
+
+    int16_t batch[1024];
+    int batch_COUNT = 0;
+    for (unsigned long long i = written - count; i < written; i++){
+        int16_t value = ring[i % header->capacity];
+        batch[batch_COUNT++] = value >= 0 ? (int16_t)(value & ~FLIGHT_EDGE) : value;
+        if (batch_COUNT == 1024){
+            fwrite(batch, sizeof(int16_t), (size_t)batch_COUNT, file);
+            batch_COUNT = 0;
+        }
+    }
+    fwrite(batch, sizeof(int16_t), (size_t)batch_COUNT, file);
+    fclose(file);
+    printf("Flight recorder: %llu value(s) (%.1f s) written to %s\n",
+           count, header->sample_HZ > 0 ? count / header->sample_HZ : 0.0, capture_Path);
+    return 0;
+}
+
+static int Flight_Dump_File(const char *flight_Path, const char *capture_Path){
+    // Converts a flight file (e.g. left behind by a crashed reader) into a capture file
+    int descriptor = open(flight_Path, O_RDONLY);
+    if (descriptor < 0){
+        printf("Could not open flight recorder file %s\n", flight_Path);
+        return 1;
+    }
+    off_t size = lseek(descriptor, 0, SEEK_END);
+    if (size < (off_t)sizeof(Flight_Header)){
+        printf("%s is not a flight recorder file\n", flight_Path);
+        close(descriptor);
+        return 1;
+    }
+    Flight_Header *header = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (header == MAP_FAILED || memcmp(header->magic, FLIGHT_MAGIC, 4) != 0 || header->version != FLIGHT_VERSION
+        || sizeof(Flight_Header) + (size_t)header->capacity * sizeof(int16_t) > (size_t)size){
+        printf("%s is not a flight recorder file\n", flight_Path);
+        if (header != MAP_FAILED){
+            munmap(header, (size_t)size);
+        }
+        return 1;
+    }
+    int status = Flight_Dump(header, capture_Path) == 0 ? 0 : 1;
+    munmap(header, (size_t)size);
+    return status;
+}
+
+
+// _________________________________________________
+//  Writeback Thread
+// _________________________________________________
+
+static void Flight_Request_Dump(int signal_Number){
+    (void)signal_Number;
+    Flight_Dump_REQUESTED = 1; // Dumped by Flight_Sync_Thread(), nothing else is safe in a handler
+}
+
+static void *Flight_Sync_Thread(void *vargp){
+    (void)vargp;
+    Realtime_Enter_Decode();
+    while (1){
+        usleep(FLIGHT_SYNC_MS * 1000);
+        msync(Flight_HEADER, Flight_SIZE, MS_ASYNC);
+        if (Flight_Dump_REQUESTED){
+            Flight_Dump_REQUESTED = 0;
+            char dump_Path[300];
+            snprintf(dump_Path, sizeof(dump_Path), "%s/morse_%s_%d_%ld.mcr",
+                     FLIGHT_RECORDER_DIR, Flight_HEADER->reader, Flight_HEADER->channel, (long)time(NULL));
+            Flight_Dump(Flight_HEADER, dump_Path);
+        }
+    }
+    return NULL;
+}
+
+static void Flight_Recorder_Start(const char *reader, int channel, int flags){
+    // Maps the ring file for this session (nothing when FLIGHT_RECORDER is off)
+    if (!FLIGHT_RECORDER){
+        return;
+    }
+    uint32_t capacity = (uint32_t)(Reader_Session.sample_HZ * 60.0 * FLIGHT_RECORDER_MINUTES);
+    if (capacity < FLIGHT_BATCH){
+        capacity = FLIGHT_BATCH;
+    }
+    Flight_SIZE = sizeof(Flight_Header) + (size_t)capacity * sizeof(int16_t);
+
+    char previous_Path[264];
+    snprintf(Flight_PATH, sizeof(Flight_PATH), "%s/morse_%s_%d.flight", FLIGHT_RECORDER_DIR, reader, channel);
+    snprintf(previous_Path, sizeof(previous_Path), "%s.prev", Flight_PATH);
+    rename(Flight_PATH, previous_Path); // Keeps the recording of the previous run
+
+    int descriptor = open(Flight_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (descriptor < 0 || ftruncate(descriptor, (off_t)Flight_SIZE) != 0){
+        printf("WARNING: could not create flight recorder file %s\n", Flight_PATH);
+        if (descriptor >= 0){
+            close(descriptor);
+        }
+        return;
+    }
+    void *mapping = mmap(NULL, Flight_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED){
+        printf("WARNING: could not map flight recorder file %s\n", Flight_PATH);
+        return;
+    }
+    memset(mapping, 0, Flight_SIZE); // Faults every page in now rather than while sampling
+
+    Flight_HEADER = (Flight_Header *)mapping;
+    memcpy(Flight_HEADER->magic, FLIGHT_MAGIC, 4);
+    Flight_HEADER->version = FLIGHT_VERSION;
+    Flight_HEADER->channel = (uint16_t)channel;
+    Flight_HEADER->flags = (uint32_t)flags;
+    Flight_HEADER->capacity = capacity;
+    Flight_HEADER->sample_HZ = Reader_Session.sample_HZ;
+    atomic_store_explicit(&Flight_HEADER->written, 0, memory_order_release);
+    snprintf(Flight_HEADER->reader, sizeof(Flight_HEADER->reader), "%s", reader);
+    Flight_RING = (int16_t *)(Flight_HEADER + 1);
+
+    if (pthread_create(&Flight_Sync_THREAD, NULL, Flight_Sync_Thread, NULL) != 0){
+        printf("WARNING: could not start the flight recorder sync thread\n");
+        munmap(mapping, Flight_SIZE);
+        Flight_HEADER = NULL;
+        Flight_RING = NULL;
+        return;
+    }
+    pthread_detach(Flight_Sync_THREAD);
+    signal(SIGUSR1, Flight_Request_Dump);
+    printf("Flight recorder: last %d minute(s) kept in %s (kill -USR1 %d to dump)\n",
+           FLIGHT_RECORDER_MINUTES, Flight_PATH, (int)getpid());
+}
+
+#endif
@@ -0,0 +1,392 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Framed Messages with Sync Preamble and CRC (shared by both readers)
+// *****************************************************
+
+/*  With FRAME_MODE set to '1' the readers do not expect the message to start
+    with the calibration pattern. Instead they look for frames anywhere in the
+    signal, e.g. when reading starts halfway through or catches a beacon that
+    repeats the same frame:
+
+        sync preamble   marks and spaces of 5,1,1,1,5,1,1 units
+        length          two decimal digits, the number of payload characters
+        payload         that many characters
+        CRC             CRC-8 (polynomial 0x07) of the length digits and the
+                        payload, as two hex digits
+
+    The sync preamble holds marks five units long, which no Morse character
+    has. The decoder follows the signal with a decaying envelope (no
+    calibration needed) and, at the end of every mark, correlates the last
+    FRAME_SYNC_RUNS run lengths with the preamble. It locks when the
+    correlation reaches FRAME_SYNC_CORRELATION and the long runs are at least
+    FRAME_SYNC_MIN_RATIO times the short ones. The unit of the frame is taken
+    from the preamble; marks and spaces of at least 1.5 units are dashes and
+    letter gaps (so both the 1:2 timing of the LED sender and 1:3 Morse work).
+
+    A frame that fails its CRC or length, or is cut off by a silence of
+    FRAME_ABORT_UNITS, is rejected and the decoder hunts for the next sync.
+    Frame_Report() prints the accepted and rejected frames and how long it
+    took to lock onto the first one.
+*/
+
+#ifndef FRAME_SYNC_H
+#define FRAME_SYNC_H
+
+#include <stdio.h>
+#include <string.h>
+#include "Run_Calibration.h"
+#include "Overrun_Policy.h"
+
+
+// _________________________________________________
+//  Frame Configuration
+// _________________________________________________
+
+// FRAME_MODE itself is set in Run_Calibration.h (it turns the calibration pattern off)
+
+#ifndef FRAME_SYNC_CORRELATION
+#define FRAME_SYNC_CORRELATION 0.95 // Lowest correlation of the last runs with the preamble that locks
+#endif
+
+#ifndef FRAME_SYNC_MIN_RATIO
+#define FRAME_SYNC_MIN_RATIO 3.5 // Long preamble runs must be this many times the short ones (a dash is at most 3)
+#endif
+
+#ifndef FRAME_ABORT_UNITS
+#define FRAME_ABORT_UNITS 5 // A silence this long inside a frame cuts it off
+#endif
+
+#ifndef FRAME_TEXT
+#define FRAME_TEXT "TEST" // Payload sent by the LED reader's frame sender
+#endif
+
+#ifndef FRAME_REPEAT
+#define FRAME_REPEAT 2 // Frames sent per message by the LED reader (a beacon repeats the same frame)
+#endif
+
+#define FRAME_SYNC_RUNS 7
+#define FRAME_MAX_PAYLOAD 99
+#define FRAME_DECAY_SHIFT 9 // Envelope decay per value is 1/2^N of its width
+
+static const int Frame_SYNC_UNITS[FRAME_SYNC_RUNS] = { 5, 1, 1, 1, 5, 1, 1 }; // Mark, space, mark, ... mark
+
+typedef enum {
+    FRAME_NONE = 0,
+    FRAME_LOCKED,       // Sync preamble found
+    FRAME_ACCEPTED,     // Frame complete and its CRC matched
+    FRAME_REJECTED      // Bad length or CRC, or cut off
+} Frame_Event;
+
+typedef enum {
+    FRAME_HUNT = 0,
+    FRAME_LENGTH,
+    FRAME_PAYLOAD,
+    FRAME_CRC
+} Frame_Field;
+
+
+// _________________________________________________
+//  Frame State
+// _________________________________________________
+
+typedef struct {
+    // Envelope and runs
+    int high;                     // Envelope in 1/256 steps
+    int low;
+    int started;
+    int mark;                     // Current side of the threshold
+    int run_Length;
+    int runs[FRAME_SYNC_RUNS];    // Last run lengths, oldest first (only complete ones)
+    int run_COUNT;
+
+    // Frame being read
+    Frame_Field field;
+    double unit;                  // Unit length from the preamble (in values)
+    char pattern[8];
+    int pattern_COUNT;
+    char text[2 + FRAME_MAX_PAYLOAD + 2 + 1]; // Length, payload and CRC characters
+    int text_COUNT;
+    int payload_LENGTH;
+    char payload[FRAME_MAX_PAYLOAD + 1];      // Payload of the last accepted frame
+
+    // Statistics of the message
+    unsigned long long start_US;  // Time of the first value
+    unsigned long long lock_US;   // Time of the first lock (0 = never locked)
+    int accepted;
+    int rejected;
+    int cut_Off;
+} Frame_Decoder;
+
+static Frame_Decoder Frame_STATE;
+static const char *Frame_SYMBOLS = NULL;
+static const char (*Frame_PATTERNS)[8] = NULL;
+static int Frame_Symbol_COUNT = 0;
+static int Frame_MARK_LOW = 0; // '1' when BLACK reads low (paper reader)
+
+
+// _________________________________________________
+//  Frame Building (sender)
+// _________________________________________________
+
+static unsigned char Frame_CRC8(const char *text, int count){
+    // CRC-8, polynomial x^8 + x^2 + x + 1, initial value 0
+    unsigned char crc = 0;
+    for (int i = 0; i < count; i++){
+        crc ^= (unsigned char)text[i];
+        for (int bit = 0; bit < 8; bit++){
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static inline int Frame_Build(const char *payload, char *frame, int size){
+    // Writes the characters of a frame (without the preamble) into 'frame', returns their number
+    int length = (int)strlen(payload);
+    length = length > FRAME_MAX_PAYLOAD ? FRAME_MAX_PAYLOAD : length;
+    if (size < length + 5){
+        return 0;
+    }
+    snprintf(frame, (size_t)size, "%02d%.*s", length, length, payload);
+    snprintf(frame + length + 2, (size_t)size - (size_t)length - 2, "%02X", Frame_CRC8(frame, length + 2));
+    return length + 4;
+}
+
+
+// _________________________________________________
+//  Frame Decoding
+// _________________________________________________
+
+static void Frame_Setup(const char *symbols, const char patterns[][8], int symbol_COUNT, int mark_Low){
+    Frame_SYMBOLS = symbols;
+    Frame_PATTERNS = patterns;
+    Frame_Symbol_COUNT = symbol_COUNT;
+    Frame_MARK_LOW = mark_Low;
+}
+
+static void Frame_Reset(void){
+    // Called at the start of every message
+    memset(&Frame_STATE, 0, sizeof(Frame_STATE));
+}
+
+static int Frame_Sync_Found(Frame_Decoder *frame){
+    // Correlates the last FRAME_SYNC_RUNS runs with the preamble, sets the unit when they match
+    if (frame->run_COUNT < FRAME_SYNC_RUNS){
+        return 0;
+    }
+    double run_MEAN = 0, sync_MEAN = 0;
+    for (int i = 0; i < FRAME_SYNC_RUNS; i++){
+        run_MEAN += frame->runs[i];
+        sync_MEAN += Frame_SYNC_UNITS[i];
+    }
+    double unit = run_MEAN / sync_MEAN;
+    run_MEAN /= FRAME_SYNC_RUNS;
+    sync_MEAN /= FRAME_SYNC_RUNS;
+
+    double covariance = 0, run_VARIANCE = 0, sync_VARIANCE = 0;
+    double long_SUM = 0, short_SUM = 0;
+    int long_COUNT = 0, short_COUNT = 0;
+    for (int i = 0; i < FRAME_SYNC_RUNS; i++){
+        double run = frame->runs[i] - run_MEAN;
+        double sync = Frame_SYNC_UNITS[i] - sync_MEAN;
+        covariance += run * sync;
+        run_VARIANCE += run * run;
+        sync_VARIANCE += sync * sync;
+        if (Frame_SYNC_UNITS[i] > 1){
+            long_SUM += frame->runs[i];
+            long_COUNT += 1;
+        } else {
+            short_SUM += frame->runs[i];
+            short_COUNT += 1;
+        }
+    }
+    // correlation = covariance / sqrt(run_VARIANCE * sync_VARIANCE), compared squared so no libm is needed
+    if (covariance <= 0 || covariance * covariance < FRAME_SYNC_CORRELATION * FRAME_SYNC_CORRELATION * run_VARIANCE * sync_VARIANCE){
+        return 0;
+    }
+    if ((long_SUM / long_COUNT) < FRAME_SYNC_MIN_RATIO * (short_SUM / short_COUNT)){
+        return 0; // Same shape, but the long runs are only dashes
+    }
+    frame->unit = unit;
+    return 1;
+}
+
+static Frame_Event Frame_Char(Frame_Decoder *frame, char symbol){
+    // Adds one decoded character to the frame being read
+    frame->text[frame->text_COUNT++] = symbol;
+    if (frame->field == FRAME_LENGTH && frame->text_COUNT == 2){
+        if (frame->text[0] < '0' || frame->text[0] > '9' || frame->text[1] < '0' || frame->text[1] > '9'){
+            frame->rejected += 1;
+            frame->field = FRAME_HUNT;
+            return FRAME_REJECTED;
+        }
+        frame->payload_LENGTH = (frame->text[0] - '0') * 10 + (frame->text[1] - '0');
+        frame->field = frame->payload_LENGTH > 0 ? FRAME_PAYLOAD : FRAME_CRC;
+    } else if (frame->field == FRAME_PAYLOAD && frame->text_COUNT == 2 + frame->payload_LENGTH){
+        frame->field = FRAME_CRC;
+    } else if (frame->field == FRAME_CRC && frame->text_COUNT == 2 + frame->payload_LENGTH + 2){
+        char expected[3];
+        snprintf(expected, sizeof(expected), "%02X", Frame_CRC8(frame->text, 2 + frame->payload_LENGTH));
+        frame->field = FRAME_HUNT;
+        if (memcmp(expected, frame->text + 2 + frame->payload_LENGTH, 2) != 0){
+            frame->rejected += 1;
+            return FRAME_REJECTED;
+        }
+        memcpy(frame->payload, frame->text + 2, (size_t)frame->payload_LENGTH);
+        frame->payload[frame->payload_LENGTH] = '\0';
+        frame->accepted += 1;
+        return FRAME_ACCEPTED;
+    }
+    return FRAME_NONE;
+}
+
+static Frame_Event Frame_Lookup(Frame_Decoder *frame){
+    // Ends the current character (same matching as Conversion())
+    if (frame->pattern_COUNT == 0){
+        return FRAME_NONE;
+    }
+    frame->pattern[frame->pattern_COUNT] = '.';
+    frame->pattern_COUNT = 0;
+    for (int i = 0; i < Frame_Symbol_COUNT; i++){
+        for (int j = 0; j < 7 && frame->pattern[j] == Frame_PATTERNS[i][j]; j++){
+            if (j == 6 || frame->pattern[j] == '.'){
+                return Frame_Char(frame, Frame_SYMBOLS[i]);
+            }
+        }
+    }
+    return Frame_Char(frame, '?'); // Unknown pattern: the CRC rejects the frame
+}
+
+static Frame_Event Frame_Run(Frame_Decoder *frame, int mark, int length, unsigned long long time_US){
+    // Handles one finished run: hunting for the preamble, or reading the frame it started
+    if (frame->run_COUNT == FRAME_SYNC_RUNS){
+        memmove(frame->runs, frame->runs + 1, sizeof(int) * (FRAME_SYNC_RUNS - 1));
+        frame->run_COUNT -= 1;
+    }
+    frame->runs[frame->run_COUNT++] = length;
+
+    if (frame->field == FRAME_HUNT){
+        if (mark && Frame_Sync_Found(frame)){
+            frame->field = FRAME_LENGTH;
+            frame->text_COUNT = 0;
+            frame->pattern_COUNT = 0;
+            frame->run_COUNT = 0;
+            if (frame->lock_US == 0){
+                frame->lock_US = time_US;
+            }
+            return FRAME_LOCKED;
+        }
+        return FRAME_NONE;
+    }
+
+    int is_Long = 2 * length >= 3 * frame->unit; // At least 1.5 units
+    if (mark){
+        if (frame->pattern_COUNT < 7){
+            frame->pattern[frame->pattern_COUNT++] = is_Long ? '1' : '0';
+        }
+        return FRAME_NONE;
+    }
+    Frame_Event event = FRAME_NONE;
+    if (is_Long){
+        event = Frame_Lookup(frame);
+    }
+    if (frame->field != FRAME_HUNT && length >= FRAME_ABORT_UNITS * frame->unit && frame->text_COUNT > 0){
+        // Silence inside the frame: it was cut off
+        frame->field = FRAME_HUNT;
+        frame->rejected += 1;
+        frame->cut_Off += 1;
+        return FRAME_REJECTED;
+    }
+    return event;
+}
+
+static Frame_Event Frame_Push(int value, int weight, unsigned long long time_US){
+    // Feeds one stored value (decimated values count 'weight' times), returns what it completed
+    Frame_Decoder *frame = &Frame_STATE;
+    if (frame->start_US == 0){
+        frame->start_US = time_US;
+    }
+    int scaled = value << 8;
+    if (!frame->started){
+        frame->high = scaled;
+        frame->low = scaled;
+        frame->started = 1;
+    }
+    int decay = (frame->high - frame->low) >> FRAME_DECAY_SHIFT;
+    frame->high = (scaled > frame->high) ? scaled : frame->high - decay;
+    frame->low = (scaled < frame->low) ? scaled : frame->low + decay;
+    int contrast = (frame->high - frame->low) >> 8;
+    if (contrast < AUTO_CALIBRATION_CONTRAST){
+        frame->run_Length += weight;
+        return FRAME_NONE; // Nothing seen yet
+    }
+
+    // Hysteresis of an eighth of the envelope around its middle
+    int middle = (frame->high + frame->low) >> 9;
+    int towards_Mark = Frame_MARK_LOW ? middle - value : value - middle;
+    int mark = frame->mark;
+    if (towards_Mark > contrast / 8){
+        mark = 1;
+    } else if (towards_Mark < -contrast / 8){
+        mark = 0;
+    }
+    if (mark == frame->mark){
+        frame->run_Length += weight;
+        return FRAME_NONE;
+    }
+    Frame_Event event = Frame_Run(frame, frame->mark, frame->run_Length, time_US);
+    frame->mark = mark;
+    frame->run_Length = weight;
+    return event;
+}
+
+static Frame_Event Frame_Gap(void){
+    // Values were dropped: the frame being read cannot be trusted
+    Frame_Decoder *frame = &Frame_STATE;
+    frame->run_COUNT = 0;
+    frame->run_Length = 0;
+    if (frame->field != FRAME_HUNT){
+        frame->field = FRAME_HUNT;
+        frame->rejected += 1;
+        return FRAME_REJECTED;
+    }
+    return FRAME_NONE;
+}
+
+static Frame_Event Frame_Finish(void){
+    // The message ended: the last character ends with it
+    Frame_Decoder *frame = &Frame_STATE;
+    if (frame->field == FRAME_HUNT){
+        return FRAME_NONE;
+    }
+    if (frame->mark && frame->pattern_COUNT < 7){
+        frame->pattern[frame->pattern_COUNT++] = 2 * frame->run_Length >= 3 * frame->unit ? '1' : '0';
+    }
+    Frame_Event event = Frame_Lookup(frame);
+    if (frame->field != FRAME_HUNT){
+        frame->field = FRAME_HUNT;
+        frame->rejected += 1;
+        frame->cut_Off += 1;
+        return FRAME_REJECTED;
+    }
+    return event;
+}
+
+static void Frame_Report(void){
+    // Prints the frames of the message and how long locking took
+    if (!FRAME_MODE){
+        return;
+    }
+    const Frame_Decoder *frame = &Frame_STATE;
+    printf("Frames: %d accepted, %d rejected", frame->accepted, frame->rejected);
+    if (frame->cut_Off > 0){
+        printf(" (%d cut off)", frame->cut_Off);
+    }
+    if (frame->lock_US != 0){
+        printf(", locked after %.2f s\n", (frame->lock_US - frame->start_US) / 1e6);
+    } else {
+        printf(", no sync preamble found\n");
+    }
+}
+
+#endif
@@ -0,0 +1,148 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Idle Sampling Rate (shared by both readers)
+// *****************************************************
+
+/*  The acquisition thread converts 'decimation' times per stored value even
+    while the LED is dark or the paper stands still, and the waiting threads
+    poll every millisecond. With IDLE_SAMPLING set to '1':
+
+        -- Once no value has moved IDLE_CONTRAST away from the quiet level for
+           IDLE_AFTER_MS, the reader is idle: each stored value then takes a
+           single conversion (the first of its slots) and the thread sleeps
+           through the other decimation - 1 slots. The single conversion is
+           held for them, so every filter keeps its timing.
+        -- Waking is immediate: a conversion IDLE_CONTRAST away from the quiet
+           level makes the same stored value take its remaining conversions
+           at the full rate. The stored values keep their spacing and the
+           value that wakes is fully filtered, so no edge is lost or moved,
+           including the start of the first mark. A single noisy conversion
+           only costs that one burst.
+        -- The threads waiting for the next message poll every IDLE_POLL_MS
+           instead of every millisecond.
+
+    Idle conversions are single ones, so IDLE_CONTRAST must stay below half of
+    the difference between the two signal levels (otherwise an idle value
+    could cross BLACK_WHITE_Differentiator). The conversion rate drops by the
+    decimation factor, so the saving depends on how far the ADC outruns the
+    stored sample rate. CARRIER_MODE needs every conversion and ignores it.
+*/
+
+#ifndef IDLE_SAMPLING_H
+#define IDLE_SAMPLING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Sample_Rate.h"
+#include "Sample_Filter.h"
+
+
+// _________________________________________________
+//  Idle Configuration
+// _________________________________________________
+
+#ifndef IDLE_SAMPLING
+#define IDLE_SAMPLING 0 // Set to '1' to drop to one conversion per stored value while nothing changes
+#endif
+
+#ifndef IDLE_AFTER_MS
+#define IDLE_AFTER_MS 2000 // Time without a transition before the reader goes idle
+#endif
+
+#ifndef IDLE_CONTRAST
+#define IDLE_CONTRAST 64 // Distance from the quiet level that counts as a transition and wakes the reader
+#endif
+
+#ifndef IDLE_POLL_MS
+#define IDLE_POLL_MS 20 // Polling period of the threads waiting for the next message
+#endif
+
+
+// _________________________________________________
+//  Idle State
+// _________________________________________________
+
+static int Idle_ENABLED = 0;                   // Off for CARRIER_MODE
+static int Idle_AFTER_VALUES = 0;              // IDLE_AFTER_MS in stored values
+static int Idle_LEVEL = -1;                    // Quiet level, -1 until the first value
+static int Idle_QUIET = 0;                     // Values within IDLE_CONTRAST of the quiet level
+static unsigned long long Idle_VALUES = 0;     // Stored values since the last summary
+static unsigned long long Idle_SKIPPED = 0;    // Conversions slept through since the last summary
+static unsigned long long Idle_WAKES = 0;
+
+
+// _________________________________________________
+//  Idle Functions
+// _________________________________________________
+
+static void Idle_Setup(int supported){
+    // Call after Session_Start(), 'supported' is '0' when every conversion is needed
+    Idle_ENABLED = IDLE_SAMPLING && supported;
+    Idle_AFTER_VALUES = (int)(Reader_Session.sample_HZ * IDLE_AFTER_MS / 1000.0 + 0.5);
+    if (Idle_AFTER_VALUES < 1){
+        Idle_AFTER_VALUES = 1;
+    }
+    if (Idle_ENABLED){
+        printf("Idle sampling: 1 of %d conversions per value after %d ms without a transition (contrast %d)\n",
+               Reader_Session.decimation, IDLE_AFTER_MS, IDLE_CONTRAST);
+    } else if (IDLE_SAMPLING){
+        printf("Idle sampling: not available in this mode, every conversion is kept\n");
+    }
+}
+
+static int Idle_Poll_US(void){
+    // Sleep of the threads waiting for the next message
+    return IDLE_SAMPLING ? IDLE_POLL_MS * 1000 : 1000;
+}
+
+static void Idle_Reset(void){
+    // Full rate again, called when reading or standby sampling starts
+    Idle_LEVEL = -1;
+    Idle_QUIET = 0;
+}
+
+static inline int Idle_Is_Idle(void){
+    return Idle_ENABLED && Idle_QUIET >= Idle_AFTER_VALUES;
+}
+
+static inline int Idle_Wakes(int conversion){
+    return abs(conversion - Idle_LEVEL) >= IDLE_CONTRAST;
+}
+
+static void Idle_Hold(int conversion, int remaining){
+    // Stands in for the conversions skipped while idle: the filter sees the held conversion, the clock skips their slots
+    for (int count = 0; count < remaining; count++){
+        Sample_Filter_Push(conversion);
+    }
+    Sample_Clock_Skip(remaining);
+    Idle_SKIPPED += (unsigned long long)remaining;
+}
+
+static void Idle_Push(int value){
+    // Follows every stored value: a transition restarts the quiet time
+    Idle_VALUES += 1;
+    if (Idle_LEVEL < 0 || abs(value - Idle_LEVEL) >= IDLE_CONTRAST){
+        if (Idle_Is_Idle()){
+            Idle_WAKES += 1;
+        }
+        Idle_LEVEL = value;
+        Idle_QUIET = 0;
+    } else if (Idle_QUIET < Idle_AFTER_VALUES){
+        Idle_QUIET += 1;
+    }
+}
+
+static void Idle_Print(void){
+    // Prints and clears the conversions saved since the last call (once per message)
+    if (!Idle_ENABLED){
+        return;
+    }
+    unsigned long long slots = Idle_VALUES * (unsigned long long)Reader_Session.decimation;
+    printf("Idle sampling: %llu of %llu conversions skipped (%.1f%%), %llu wake-ups\n",
+           Idle_SKIPPED, slots, slots > 0 ? 100.0 * Idle_SKIPPED / slots : 0.0, Idle_WAKES);
+    Idle_VALUES = 0;
+    Idle_SKIPPED = 0;
+    Idle_WAKES = 0;
+}
+
+#endif
@@ -0,0 +1,322 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: JSON Lines Output Stream (shared by both readers)
+// *****************************************************
+
+/*  Headless output for running a reader as a daemon. With DAEMON_MODE set to
+    '1' every decoded character and every completed message is published as
+    one JSON object per line (JSON Lines) to JSON_STREAM, which is one of:
+
+        unix:/path  - Unix domain stream socket the reader listens on
+                      (one consumer at a time, e.g. 'socat - UNIX:/path')
+        fifo:/path  - named pipe, created if missing ('cat /path')
+        file:/path  - plain file, appended to
+
+    Records are formatted by the decode threads into a fixed JSON_BUFFER_SIZE
+    byte ring and written out by a separate writer thread with non-blocking
+    I/O. If the consumer is slow the ring fills up and new records are dropped
+    (counted in morse_json_dropped_total) rather than stalling the decoder.
+    Records produced while no consumer is connected to a socket or FIFO are
+    discarded, so a new consumer only sees live output.
+
+    Record types:
+        {"type":"char", ...}    - a character as soon as Conversion() emits it
+        {"type":"message", ...} - the whole message with its calibration and
+                                  timing statistics once Output() runs
+*/
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "Stage_Metrics.h"
+#include "Overrun_Policy.h"
+#include "Realtime_Profile.h"
+#include "Sample_Rate.h"
+#include "Edge_Timing.h"
+#include "Decode_Confidence.h"
+
+
+// _________________________________________________
+//  Stream Configuration
+// _________________________________________________
+
+#ifndef DAEMON_MODE
+#define DAEMON_MODE 0 // Set to '1' to publish the decoded output as JSON Lines
+#endif
+
+#ifndef JSON_BUFFER_SIZE
+#define JSON_BUFFER_SIZE (64*1024) // Bytes of records buffered between the decoder and the writer thread
+#endif
+
+#define JSON_RECORD_LENGTH 2048 // Longest single record
+#define JSON_RETRY_MS 100       // How long the writer waits before retrying a missing consumer or a full pipe
+
+
+// _________________________________________________
+//  Stream State
+// _________________________________________________
+
+typedef enum { JSON_TARGET_UNIX, JSON_TARGET_FIFO, JSON_TARGET_FILE } Json_Target_Type;
+
+static char Json_Stream_BUFFER[JSON_BUFFER_SIZE];
+static size_t Json_Stream_HEAD = 0;  // Next byte to write out
+static size_t Json_Stream_USED = 0;  // Bytes waiting to be written out
+static pthread_mutex_t Json_Stream_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Json_Stream_READY = PTHREAD_COND_INITIALIZER;
+static pthread_t Json_Stream_THREAD;
+
+static Json_Target_Type Json_Target = JSON_TARGET_FILE;
+static char Json_Target_PATH[108];
+static int Json_Listen_FD = -1;      // Listening socket (unix target)
+static int Json_Output_FD = -1;      // Connected consumer, open FIFO or file
+static int Json_Stream_ENABLED = 0;
+
+static const char *Json_Reader_NAME = "reader";
+static int Json_Channel = 0;
+static int Json_Message_INDEX = 0;  // Number of the message being decoded (from 0)
+
+
+// _________________________________________________
+//  Record Functions
+// _________________________________________________
+
+static unsigned long long Json_Wall_MS(unsigned long long monotonic_us){
+    // Converts a Metrics_Now_US() time stamp into Unix time in milliseconds, on the same clock (simulated or real)
+    return (unsigned long long)(Clock_Unix_NS((long long)monotonic_us * 1000LL) / 1000000LL);
+}
+
+static void Json_Emit(const char *format, ...){
+    // Formats one record and queues it for the writer thread (dropped if the buffer is full)
+    if (!Json_Stream_ENABLED){
+        return;
+    }
+    char record[JSON_RECORD_LENGTH];
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(record, sizeof(record) - 1, format, arguments);
+    va_end(arguments);
+    if (length < 0 || length >= (int)sizeof(record) - 1){
+        Metrics_Count(&Reader_Metrics.json_dropped_total, 1);
+        return;
+    }
+    record[length] = '\n';
+    length += 1;
+
+    pthread_mutex_lock(&Json_Stream_LOCK);
+    if (Json_Stream_USED + (size_t)length > JSON_BUFFER_SIZE){
+        pthread_mutex_unlock(&Json_Stream_LOCK);
+        Metrics_Count(&Reader_Metrics.json_dropped_total, 1);
+        return;
+    }
+    size_t tail = (Json_Stream_HEAD + Json_Stream_USED) % JSON_BUFFER_SIZE;
+    for (int i = 0; i < length; i++){
+        Json_Stream_BUFFER[(tail + (size_t)i) % JSON_BUFFER_SIZE] = record[i];
+    }
+    Json_Stream_USED += (size_t)length;
+    pthread_cond_signal(&Json_Stream_READY);
+    pthread_mutex_unlock(&Json_Stream_LOCK);
+}
+
+static void Json_Escape(char *escaped, size_t size, const char *text, int length){
+    // Copies 'length' characters of 'text' as the contents of a JSON string
+    size_t used = 0;
+    for (int i = 0; i < length && used + 7 < size; i++){
+        unsigned char character = (unsigned char)text[i];
+        if (character == '"' || character == '\\'){
+            escaped[used++] = '\\';
+            escaped[used++] = (char)character;
+        } else if (character < 0x20){
+            used += (size_t)snprintf(escaped + used, size - used, "\\u%04x", character);
+        } else {
+            escaped[used++] = (char)character;
+        }
+    }
+    escaped[used] = '\0';
+}
+
+static void Json_Char(char character, int index, const char *pattern, unsigned long long start_US,
+                      unsigned long long edge_US, unsigned long long emitted_US, const Char_Confidence *confidence){
+    // Publishes one decoded character ('pattern' is the dot/dash pattern ending in '.')
+    char escaped[8];
+    char morse[8];
+    char residuals[CONFIDENCE_MAX_RUNS * 12 + 1];
+    int used = 0;
+    for (int i = 0; i < confidence->count && used < (int)sizeof(residuals) - 12; i++){
+        used += snprintf(residuals + used, sizeof(residuals) - (size_t)used, "%s%.3f", i > 0 ? "," : "", confidence->residual[i]);
+    }
+    residuals[used] = '\0';
+    int length = 0;
+    while (length < 7 && pattern[length] != '.' && pattern[length] != '\0'){
+        morse[length] = (pattern[length] == '1') ? '-' : '.';
+        length += 1;
+    }
+    morse[length] = '\0';
+    Json_Escape(escaped, sizeof(escaped), &character, 1);
+    Json_Emit("{\"type\":\"char\",\"reader\":\"%s\",\"channel\":%d,\"message\":%d,\"index\":%d,\"char\":\"%s\",\"morse\":\"%s\","
+              "\"start_us\":%llu,\"end_us\":%llu,\"emitted_us\":%llu,\"unix_ms\":%llu,\"latency_us\":%llu,"
+              "\"confidence\":%.3f,\"runs\":\"%s\",\"residuals\":[%s]}",
+              Json_Reader_NAME, Json_Channel, Json_Message_INDEX, index, escaped, morse,
+              start_US, edge_US, emitted_US, Json_Wall_MS(emitted_US), edge_US > 0 ? emitted_US - edge_US : 0ULL,
+              confidence->confidence, confidence->kind, residuals);
+}
+
+static void Json_Message(const char *text, int length, unsigned long long started_US, unsigned long long ended_US,
+                         int threshold, int dot, int dash, int small_Space, int big_Space, const Jitter_Stats *jitter){
+    // Publishes a completed message with its calibration and timing statistics
+    char escaped[JSON_RECORD_LENGTH/2];
+    Json_Escape(escaped, sizeof(escaped), text, length);
+    double mean_US = 0.0;
+    double stddev_US = 0.0;
+    if (jitter->count > 0){
+        double mean = jitter->sum_ns / (double)jitter->count;
+        mean_US = mean / 1000.0;
+        stddev_US = Jitter_Square_Root(jitter->sum_sq_ns / (double)jitter->count - mean * mean) / 1000.0;
+    }
+    Json_Emit("{\"type\":\"message\",\"reader\":\"%s\",\"channel\":%d,\"message\":%d,\"text\":\"%s\",\"chars\":%d,"
+              "\"started_us\":%llu,\"ended_us\":%llu,\"unix_ms\":%llu,\"sample_hz\":%.3f,\"decimation\":%d,"
+              "\"threshold\":%d,\"dot\":%.6g,\"dash\":%.6g,\"small_space\":%.6g,\"big_space\":%.6g,"
+              "\"overruns\":%d,\"lost_samples\":%lld,\"period_mean_us\":%.2f,\"period_stddev_us\":%.2f,"
+              "\"confidence_mean\":%.3f,\"confidence_min\":%.3f,\"low_confidence_chars\":%d}",
+              Json_Reader_NAME, Json_Channel, Json_Message_INDEX, escaped, length,
+              started_US, ended_US, Json_Wall_MS(ended_US), Reader_Session.sample_HZ, Reader_Session.decimation,
+              threshold, (double)dot / EDGE_RUN_ONE, (double)dash / EDGE_RUN_ONE, // Lengths in stored values
+              (double)small_Space / EDGE_RUN_ONE, (double)big_Space / EDGE_RUN_ONE,
+              Overrun_Log_COUNT, Overrun_Lost_TOTAL, mean_US, stddev_US,
+              Confidence_Mean(&Message_CONFIDENCE), Message_CONFIDENCE.lowest, Message_CONFIDENCE.low_COUNT);
+    Json_Message_INDEX += 1;
+}
+
+
+// _________________________________________________
+//  Writer Thread
+// _________________________________________________
+
+static int Json_Stream_Open(void){
+    // Makes sure there is somewhere to write to, returns 0 when Json_Output_FD is usable
+    if (Json_Output_FD >= 0){
+        return 0;
+    }
+    if (Json_Target == JSON_TARGET_UNIX){
+        Json_Output_FD = accept(Json_Listen_FD, NULL, NULL);
+        if (Json_Output_FD >= 0){
+            fcntl(Json_Output_FD, F_SETFL, fcntl(Json_Output_FD, F_GETFL) | O_NONBLOCK);
+        }
+    } else if (Json_Target == JSON_TARGET_FIFO){
+        Json_Output_FD = open(Json_Target_PATH, O_WRONLY | O_NONBLOCK); // Fails with ENXIO while nobody reads
+    } else {
+        Json_Output_FD = open(Json_Target_PATH, O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK, 0644);
+    }
+    return Json_Output_FD >= 0 ? 0 : -1;
+}
+
+static void Json_Stream_Consume(size_t count){
+    pthread_mutex_lock(&Json_Stream_LOCK);
+    Json_Stream_HEAD = (Json_Stream_HEAD + count) % JSON_BUFFER_SIZE;
+    Json_Stream_USED -= count;
+    pthread_mutex_unlock(&Json_Stream_LOCK);
+}
+
+static void *Json_Stream_Writer(void *vargp){
+    // Thread that moves queued records to the consumer without ever blocking the decoder
+    (void)vargp;
+    Realtime_Enter_Decode();
+    char chunk[4096];
+    while (1){
+        pthread_mutex_lock(&Json_Stream_LOCK);
+        while (Json_Stream_USED == 0){
+            pthread_cond_wait(&Json_Stream_READY, &Json_Stream_LOCK);
+        }
+        size_t count = Json_Stream_USED < sizeof(chunk) ? Json_Stream_USED : sizeof(chunk);
+        for (size_t i = 0; i < count; i++){
+            chunk[i] = Json_Stream_BUFFER[(Json_Stream_HEAD + i) % JSON_BUFFER_SIZE];
+        }
+        pthread_mutex_unlock(&Json_Stream_LOCK);
+
+        if (Json_Stream_Open() != 0){
+            // No consumer: live records are discarded rather than replayed to a later consumer
+            if (Json_Target != JSON_TARGET_FILE){
+                Json_Stream_Consume(count);
+            }
+            usleep(JSON_RETRY_MS * 1000);
+            continue;
+        }
+
+        ssize_t written = (Json_Target == JSON_TARGET_UNIX)
+                          ? send(Json_Output_FD, chunk, count, MSG_NOSIGNAL | MSG_DONTWAIT)
+                          : write(Json_Output_FD, chunk, count);
+        if (written > 0){
+            Json_Stream_Consume((size_t)written);
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            // Consumer is slow: wait for it here, the decoder keeps going and drops if the ring fills
+            struct pollfd ready = { Json_Output_FD, POLLOUT, 0 };
+            poll(&ready, 1, JSON_RETRY_MS);
+        } else {
+            // Consumer went away
+            close(Json_Output_FD);
+            Json_Output_FD = -1;
+        }
+    }
+    return NULL;
+}
+
+static void Json_Stream_Start(const char *reader_Name, int channel, const char *target){
+    // Opens the JSON_STREAM target and starts the writer thread (does nothing unless DAEMON_MODE is '1')
+    Json_Reader_NAME = reader_Name;
+    Json_Channel = channel;
+    if (!DAEMON_MODE){
+        return;
+    }
+
+    if (strncmp(target, "unix:", 5) == 0){
+        Json_Target = JSON_TARGET_UNIX;
+    } else if (strncmp(target, "fifo:", 5) == 0){
+        Json_Target = JSON_TARGET_FIFO;
+    } else if (strncmp(target, "file:", 5) == 0){
+        Json_Target = JSON_TARGET_FILE;
+    } else {
+        printf("WARNING: JSON stream target '%s' needs a unix:, fifo: or file: prefix\n", target);
+        return;
+    }
+    snprintf(Json_Target_PATH, sizeof(Json_Target_PATH), "%s", target + 5);
+    signal(SIGPIPE, SIG_IGN); // A consumer closing its end must not terminate the reader
+
+    if (Json_Target == JSON_TARGET_UNIX){
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", Json_Target_PATH);
+        unlink(Json_Target_PATH);
+        Json_Listen_FD = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (Json_Listen_FD < 0 || bind(Json_Listen_FD, (struct sockaddr *)&address, sizeof(address)) != 0
+            || listen(Json_Listen_FD, 1) != 0){
+            printf("WARNING: could not listen on %s (%s)\n", Json_Target_PATH, strerror(errno));
+            return;
+        }
+        fcntl(Json_Listen_FD, F_SETFL, fcntl(Json_Listen_FD, F_GETFL) | O_NONBLOCK);
+    } else if (Json_Target == JSON_TARGET_FIFO){
+        if (mkfifo(Json_Target_PATH, 0644) != 0 && errno != EEXIST){
+            printf("WARNING: could not create FIFO %s (%s)\n", Json_Target_PATH, strerror(errno));
+            return;
+        }
+    }
+
+    Json_Stream_ENABLED = 1;
+    pthread_create(&Json_Stream_THREAD, NULL, Json_Stream_Writer, NULL);
+    pthread_detach(Json_Stream_THREAD);
+    printf("Publishing JSON Lines to %s\n", target);
+}
+
+#endif
@@ -0,0 +1,268 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Two-Lane Striped Transmission (LED reader)
+// *****************************************************
+
+/*  With STRIPE_MODE set to '1' the LED reader sends STRIPE_TEXT over both
+    LEDs at the same time and reads it back from two LDRs, so a message takes
+    about half as long at the same speed per LED.
+
+    The text is cut into chunks of STRIPE_CHUNK characters. Chunk k goes to
+    lane k % 2 (lane 1 = red LED_PIN_1 seen by ADC_CHANNEL, lane 2 = blue
+    LED_PIN_2 seen by ADC_CHANNEL + 1) and is preceded by the sequence marker
+    Stripe_MARKERS[k % STRIPE_MARKER_COUNT]. The markers are the six shortest
+    Morse characters, so they cost little; a lane is read strictly as
+    marker, chunk, marker, chunk, ...
+
+    Lane 1 goes through the normal acquisition, filter and Conversion()
+    pipeline. Lane 2 is read in the same conversion slots, averaged per stored
+    value into its own buffer and decoded with the offline decoder
+    (Offline_Decode.h) once the message has ended. Output() then puts the
+    chunks back in order: when a marker does not match the next chunk the lane
+    should carry, the chunks in between were lost and are printed as
+    GAP_SYMBOL.
+
+    The LDRs need to be shielded from the other LED (or fitted with red and
+    blue filters). Striping replaces the diversity combiner and the carrier
+    mode, which use the same second channel or the same decimation slots.
+*/
+
+#ifndef LANE_STRIPE_H
+#define LANE_STRIPE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "Overrun_Policy.h"
+#include "Offline_Decode.h"
+#include "Channel_Diversity.h"
+#include "Carrier_Detect.h"
+#include "Reader_Clock.h"
+
+
+// _________________________________________________
+//  Stripe Configuration
+// _________________________________________________
+
+#ifndef STRIPE_MODE
+#define STRIPE_MODE 0 // Set to '1' to send STRIPE_TEXT over both LEDs and reassemble it from two LDRs
+#endif
+
+#ifndef STRIPE_TEXT
+#define STRIPE_TEXT "THE QUICK BROWN FOX" // Text sent in striped mode
+#endif
+
+#ifndef STRIPE_CHUNK
+#define STRIPE_CHUNK 4 // Characters per chunk (after its sequence marker); longer chunks cost fewer markers
+#endif
+
+#define STRIPE_LANES 2
+#define STRIPE_MAX_VALUES 65536 // Lane 2 values kept per message
+#define STRIPE_MAX_CHUNKS 256
+#define STRIPE_MARKER_COUNT 6
+
+static const char Stripe_MARKERS[STRIPE_MARKER_COUNT + 1] = "ETIANM"; // Shortest Morse characters
+
+#if STRIPE_MODE && DIVERSITY_CHANNELS > 1
+#error "STRIPE_MODE reads the second lane on ADC_CHANNEL + 1, which DIVERSITY_CHANNELS would combine"
+#endif
+
+#if STRIPE_MODE && CARRIER_MODE
+#error "STRIPE_MODE decodes the second lane by brightness, it cannot be combined with CARRIER_MODE"
+#endif
+
+
+// _________________________________________________
+//  Stripe State
+// _________________________________________________
+
+static int (*Stripe_Read_ADC)(int) = NULL; // analogRead, set by Stripe_Setup()
+static int16_t Stripe_VALUES[STRIPE_MAX_VALUES];
+static int Stripe_COUNT = 0;
+static long Stripe_SUM = 0;                 // Lane 2 conversions of the current stored value
+static int Stripe_PUSHED = 0;
+
+
+// _________________________________________________
+//  Sender
+// _________________________________________________
+
+/*  Every sender function returns how long it keys for. Called with pin -1
+    nothing is keyed: the simulated session uses that to size its read window
+    (Sim_Session_Window()).
+*/
+
+static int Stripe_Key(int pin, int level, int wait_MS){
+    // Drives 'pin' and waits (only returns the wait when pin is -1)
+    if (pin >= 0){
+        digitalWrite(pin, level);
+        Clock_Delay(wait_MS);
+    }
+    return wait_MS;
+}
+
+static int Stripe_Key_Pattern(int pin, const char *pattern, int small_WAIT, int large_WAIT){
+    // Keys one character ('0' dot, '1' dash, '.' end) followed by a letter gap
+    int duration_MS = 0;
+    for (int i = 0; i < 7 && pattern[i] != '.'; i++){
+        duration_MS += Stripe_Key(pin, HIGH, pattern[i] == '1' ? large_WAIT : small_WAIT);
+        duration_MS += Stripe_Key(pin, LOW, pattern[i + 1] == '.' || i == 6 ? large_WAIT : small_WAIT);
+    }
+    return duration_MS;
+}
+
+static int Stripe_Key_Char(int pin, char character, const char *symbols, const char patterns[][8], int symbol_COUNT,
+                           int small_WAIT, int large_WAIT){
+    for (int s = 0; s < symbol_COUNT; s++){
+        if (symbols[s] == character){
+            return Stripe_Key_Pattern(pin, patterns[s], small_WAIT, large_WAIT);
+        }
+    }
+    return 0;
+}
+
+static int Stripe_Key_Lane(int pin, int lane, const char *symbols, const char patterns[][8], int symbol_COUNT,
+                           int small_WAIT, int large_WAIT, int preamble){
+    // Keys every chunk of STRIPE_TEXT that belongs to 'lane', each after its sequence marker
+    const char *text = STRIPE_TEXT;
+    int length = (int)strlen(text);
+    int duration_MS = Stripe_Key(pin, LOW, small_WAIT);
+    if (preamble){
+        duration_MS += Stripe_Key_Pattern(pin, "10.", small_WAIT, large_WAIT); // Calibration pattern: dash, dot
+    }
+    for (int chunk = lane; chunk * STRIPE_CHUNK < length; chunk += STRIPE_LANES){
+        duration_MS += Stripe_Key_Char(pin, Stripe_MARKERS[chunk % STRIPE_MARKER_COUNT], symbols, patterns, symbol_COUNT, small_WAIT, large_WAIT);
+        for (int c = chunk * STRIPE_CHUNK; c < length && c < (chunk + 1) * STRIPE_CHUNK; c++){
+            duration_MS += Stripe_Key_Char(pin, text[c], symbols, patterns, symbol_COUNT, small_WAIT, large_WAIT);
+        }
+    }
+    if (pin >= 0){
+        digitalWrite(pin, LOW);
+    }
+    return duration_MS;
+}
+
+
+// _________________________________________________
+//  Second Lane (acquisition thread)
+// _________________________________________________
+
+static void Stripe_Setup(int (*read_Sample)(int)){
+    Stripe_Read_ADC = read_Sample;
+    if (STRIPE_MODE){
+        printf("Striping: '%s' over %d lanes, %d characters per chunk\n", STRIPE_TEXT, STRIPE_LANES, STRIPE_CHUNK);
+    }
+}
+
+static int Stripe_Read(int first_Channel){
+    // Reads lane 1 (returned) and adds a conversion of lane 2 to its stored value, so the rate probe times both
+    Stripe_SUM += Stripe_Read_ADC(first_Channel + 1);
+    Stripe_PUSHED += 1;
+    return Diversity_Read(first_Channel);
+}
+
+static void Stripe_Reset(void){
+    // Called when reading starts
+    Stripe_COUNT = 0;
+    Stripe_SUM = 0;
+    Stripe_PUSHED = 0;
+}
+
+static inline void Stripe_Append(void){
+    // Stores the average of the lane 2 conversions since the last call
+    if (Stripe_PUSHED == 0){
+        return;
+    }
+    int value = (int)(Stripe_SUM / Stripe_PUSHED);
+    if (Stripe_COUNT < STRIPE_MAX_VALUES){
+        Stripe_VALUES[Stripe_COUNT++] = (int16_t)(value > 0 ? value : 1); // 0 would end the message
+    }
+    Stripe_SUM = 0;
+    Stripe_PUSHED = 0;
+}
+
+
+// _________________________________________________
+//  Reassembly (decode thread)
+// _________________________________________________
+
+static int Stripe_Decode_Lane(char *text, int size, const char *symbols, const char patterns[][8], int symbol_COUNT, int preamble){
+    // Decodes the lane 2 values of the message with the offline decoder, returns the number of characters
+    Offline_VALUES = Stripe_VALUES;
+    Offline_COUNT = Stripe_COUNT;
+    Offline_MARK_LOW = 0;
+    Offline_PREAMBLE = preamble;
+    Offline_Calibration calibration;
+    if (Offline_Calibrate(0, Stripe_COUNT, AUTO_CALIBRATION_RUNS, &calibration) != 0
+        && Offline_Calibrate(0, Stripe_COUNT, 1, &calibration) != 0){
+        return 0;
+    }
+    calibration.word_Space = INT_MAX; // Spaces are sent as characters
+
+    Offline_Segment segment = { 0, Stripe_COUNT, 1, NULL, 0 };
+    Offline_Decode_Segment(&segment, &calibration, symbols, patterns, symbol_COUNT);
+    int count = 0;
+    for (int i = 0; i < segment.text_COUNT && count < size - 1; i++){
+        if (segment.text[i] != '\n'){
+            text[count++] = segment.text[i];
+        }
+    }
+    text[count] = '\0';
+    free(segment.text);
+    return count;
+}
+
+static void Stripe_Place(const char *lane_Text, int lane_COUNT, int lane, const char **chunks, int *chunk_LENGTHS, int *last_Chunk){
+    // Splits one lane into marker + chunk pairs and files every chunk under its sequence number
+    int chunk = lane;
+    for (int i = 0; i < lane_COUNT && chunk < STRIPE_MAX_CHUNKS; chunk += STRIPE_LANES){
+        const char *marker = lane_Text[i] != '\0' ? strchr(Stripe_MARKERS, lane_Text[i]) : NULL;
+        if (marker != NULL){
+            // Skip ahead to the next chunk of this lane with that marker (the ones in between were lost)
+            int wanted = (int)(marker - Stripe_MARKERS);
+            for (int ahead = 0; ahead < STRIPE_MARKER_COUNT && chunk % STRIPE_MARKER_COUNT != wanted; ahead++){
+                chunk += STRIPE_LANES;
+            }
+            if (chunk % STRIPE_MARKER_COUNT != wanted || chunk >= STRIPE_MAX_CHUNKS){
+                break; // Not a marker of this lane
+            }
+        }
+        i += 1;
+        chunks[chunk] = lane_Text + i;
+        chunk_LENGTHS[chunk] = lane_COUNT - i < STRIPE_CHUNK ? lane_COUNT - i : STRIPE_CHUNK;
+        i += chunk_LENGTHS[chunk];
+        if (chunk > *last_Chunk){
+            *last_Chunk = chunk;
+        }
+    }
+}
+
+static void Stripe_Output(const char *lane1_Text, int lane1_COUNT, const char *symbols, const char patterns[][8], int symbol_COUNT, int preamble){
+    // Decodes lane 2, prints both lanes and the message put back together from their chunks
+    if (!STRIPE_MODE){
+        return;
+    }
+    static char lane2_Text[STRIPE_MAX_VALUES / 2];
+    int lane2_COUNT = Stripe_Decode_Lane(lane2_Text, (int)sizeof(lane2_Text), symbols, patterns, symbol_COUNT, preamble);
+
+    const char *chunks[STRIPE_MAX_CHUNKS] = { NULL };
+    int chunk_LENGTHS[STRIPE_MAX_CHUNKS] = { 0 };
+    int last_Chunk = -1;
+    Stripe_Place(lane1_Text, lane1_COUNT, 0, chunks, chunk_LENGTHS, &last_Chunk);
+    Stripe_Place(lane2_Text, lane2_COUNT, 1, chunks, chunk_LENGTHS, &last_Chunk);
+
+    printf("Lane 1: %.*s\n", lane1_COUNT, lane1_Text);
+    printf("Lane 2: %.*s\n", lane2_COUNT, lane2_Text);
+    printf("Reassembled: ");
+    for (int chunk = 0; chunk <= last_Chunk; chunk++){
+        if (chunks[chunk] == NULL){
+            printf("%c", GAP_SYMBOL); // Chunk lost
+        } else {
+            printf("%.*s", chunk_LENGTHS[chunk], chunks[chunk]);
+        }
+    }
+    printf("\n");
+}
+
+#endif
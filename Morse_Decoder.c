@@ -0,0 +1,13 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Reentrant Morse Decoder library (see Morse_Decoder.h)
+// *****************************************************
+
+/*  Builds the decoder of Morse_Decoder.h with external linkage:
+
+        gcc -O2 -c -fPIC Morse_Decoder.c && ar rcs libmorse_decoder.a Morse_Decoder.o
+        gcc -O2 -shared -fPIC Morse_Decoder.c -o libmorse_decoder.so
+*/
+
+#define MORSE_DECODER_IMPLEMENTATION
+#include "Morse_Decoder.h"
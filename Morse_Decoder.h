@@ -0,0 +1,394 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Reentrant Morse Decoder (shared by both readers, also built as a library)
+// *****************************************************
+
+/*  The decoding core with all of its state in one Morse_Decoder. Any number
+    of decoders can run side by side, one per thread, channel or stream, and
+    other programs can link the decoder:
+
+        Morse_Decoder_Config config = { NULL, NULL, 0, 0, 0, print_Symbol, &context };
+        Morse_Decoder decoder;
+        Morse_Decoder_Init(&decoder, &config);
+        Morse_Decoder_Push_Samples(&decoder, values, count); // or Morse_Decoder_Push_Run()
+        Morse_Decoder_End_Message(&decoder);
+
+    The callback gets every character as soon as the space after it ends
+    it. Word gaps arrive as ' ', lost samples as MORSE_DECODER_GAP_SYMBOL
+    and the end of a message as '\n'. The decoder takes two kinds of input:
+
+        -- Samples: values from 0 up are signal levels. MORSE_SAMPLE_GAP marks
+           lost samples and MORSE_SAMPLE_END the end of a message. These are
+           the GAP_MARKER and CAPTURE_MESSAGE_MARKER codes of capture files.
+        -- Runs: a mark or a space and its length in samples.
+
+    Morse_Decoder_Calibrate() sets the threshold and lengths. Without it, the
+    decoder learns them:
+        -- the threshold from the first MORSE_DECODER_LEARN_VALUES samples,
+           halfway between the lowest and the highest once they are
+           AUTO_CALIBRATION_CONTRAST apart
+        -- the lengths from the first AUTO_CALIBRATION_RUNS runs, with
+           Run_Calibrate()
+    The samples and runs it learned from are then decoded from the start.
+    Runs are classified by the nearest length, and the dots and dashes of a
+    character are looked up in the symbol table, like Conversion() does.
+
+    The readers include this header with MORSE_DECODER_STATIC (Offline_Decode.h
+    sets it), so the functions are compiled into them. Morse_Decoder.c builds
+    the same code as a library:
+
+        gcc -O2 -c -fPIC Morse_Decoder.c && ar rcs libmorse_decoder.a Morse_Decoder.o
+        gcc -O2 -shared -fPIC Morse_Decoder.c -o libmorse_decoder.so
+
+    Other programs include this header for the declarations and link the
+    library. A reader built with -DMORSE_DECODER_LINKED links it too.
+*/
+
+#ifndef MORSE_DECODER_H
+#define MORSE_DECODER_H
+
+#include <stdint.h>
+#include "Run_Calibration.h"
+
+
+// _________________________________________________
+//  Decoder Configuration
+// _________________________________________________
+
+#ifndef MORSE_DECODER_LEARN_VALUES
+#define MORSE_DECODER_LEARN_VALUES 512 // Samples the threshold is learned from when none is set
+#endif
+
+#define MORSE_DECODER_LEARN_RUNS (AUTO_CALIBRATION_RUNS + 1) // The first run may be cut short and is not learned from
+#define MORSE_DECODER_GAP_SYMBOL '#' // Passed where samples were lost (GAP_SYMBOL of the readers)
+
+#define MORSE_SAMPLE_GAP -1 // Samples were lost here
+#define MORSE_SAMPLE_END -2 // End of a message
+
+#ifdef MORSE_DECODER_STATIC
+#define MORSE_DECODER_API static inline
+#else
+#define MORSE_DECODER_API
+#endif
+
+
+// _________________________________________________
+//  Decoder State
+// _________________________________________________
+
+typedef void (*Morse_Symbol_Callback)(void *user, char symbol);
+
+typedef struct {
+    const char *symbols;           // Symbol table, NULL for the letters and digits
+    const char (*patterns)[8];     // '0' dot, '1' dash, '.' end, as in the readers
+    int symbol_COUNT;
+    int mark_Low;                  // '1' when marks read below the threshold (paper reader)
+    int skip_Preamble;             // '1' when every message starts with the dash-dot calibration pattern
+    Morse_Symbol_Callback callback;
+    void *user;
+} Morse_Decoder_Config;
+
+typedef struct {
+    Morse_Decoder_Config config;
+
+    int threshold;                 // -1 until set or learned
+    Run_Lengths lengths;
+    int word_Space;                // Shortest space passed as a word gap
+    int calibrated;                // '1' once the lengths are set or learned
+
+    int run_Mark;                  // Run being counted from samples, -1 for none
+    int run_Length;
+    char pattern[8];               // Dots and dashes of the current character
+    int pattern_COUNT;
+    int started;                   // '1' once a mark was seen (the lead-in space is ignored like in Conversion())
+    int skip_Next;                 // '1' while the calibration pattern still has to be left out
+
+    int learn_Values[MORSE_DECODER_LEARN_VALUES];
+    int learn_VALUE_COUNT;
+    unsigned char learn_Marks[MORSE_DECODER_LEARN_RUNS];
+    int learn_Lengths[MORSE_DECODER_LEARN_RUNS];
+    int learn_RUN_COUNT;
+} Morse_Decoder;
+
+MORSE_DECODER_API void Morse_Decoder_Init(Morse_Decoder *decoder, const Morse_Decoder_Config *config);
+MORSE_DECODER_API void Morse_Decoder_Calibrate(Morse_Decoder *decoder, int threshold, const Run_Lengths *lengths, int word_Space);
+MORSE_DECODER_API void Morse_Decoder_Mid_Message(Morse_Decoder *decoder);
+MORSE_DECODER_API void Morse_Decoder_Push_Sample(Morse_Decoder *decoder, int value);
+MORSE_DECODER_API void Morse_Decoder_Push_Samples(Morse_Decoder *decoder, const int16_t *values, int count);
+MORSE_DECODER_API void Morse_Decoder_Push_Run(Morse_Decoder *decoder, int mark, int length);
+MORSE_DECODER_API void Morse_Decoder_Gap(Morse_Decoder *decoder);
+MORSE_DECODER_API void Morse_Decoder_Flush(Morse_Decoder *decoder);
+MORSE_DECODER_API void Morse_Decoder_End_Message(Morse_Decoder *decoder);
+
+static inline int Morse_Decoder_Word_Space(int big_Space){
+    // Spaces of at least this length are word gaps (7 vs 3 units), the default of Morse_Decoder_Calibrate()
+    return big_Space * 5 / 3;
+}
+
+#endif
+
+
+#if (defined(MORSE_DECODER_STATIC) || defined(MORSE_DECODER_IMPLEMENTATION)) && !defined(MORSE_DECODER_IMPLEMENTED)
+#define MORSE_DECODER_IMPLEMENTED
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// _________________________________________________
+//  Default Symbol Table
+// _________________________________________________
+
+static const char Morse_Decoder_SYMBOLS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+static const char Morse_Decoder_PATTERNS[][8] = {
+    "01.", "1000.", "1010.", "100.", "0.", "0010.", "110.", "0000.", "00.", "0111.", "101.", "0100.", "11.",
+    "10.", "111.", "0110.", "1101.", "010.", "000.", "1.", "001.", "0001.", "011.", "1001.", "1011.", "1100.",
+    "11111.", "01111.", "00111.", "00011.", "00001.", "00000.", "10000.", "11000.", "11100.", "11110."
+};
+
+
+// _________________________________________________
+//  Symbol Stage
+// _________________________________________________
+
+static inline void Morse_Decoder_Emit(Morse_Decoder *decoder, char symbol){
+    if (symbol != ' ' && symbol != '\n' && symbol != MORSE_DECODER_GAP_SYMBOL && decoder->skip_Next){
+        decoder->skip_Next = 0; // The calibration pattern
+        return;
+    }
+    if (decoder->config.callback != NULL){
+        decoder->config.callback(decoder->config.user, symbol);
+    }
+}
+
+static inline void Morse_Decoder_Lookup(Morse_Decoder *decoder){
+    // Passes on the symbol of the collected pattern (same matching as Conversion())
+    if (decoder->pattern_COUNT == 0){
+        return;
+    }
+    decoder->pattern[decoder->pattern_COUNT] = '.';
+    for (int i = 0; i < decoder->config.symbol_COUNT; i++){
+        for (int j = 0; j < 7 && decoder->pattern[j] == decoder->config.patterns[i][j]; j++){
+            if (j == 6 || decoder->pattern[j] == '.'){
+                Morse_Decoder_Emit(decoder, decoder->config.symbols[i]);
+                i = decoder->config.symbol_COUNT;
+                break;
+            }
+        }
+    }
+    decoder->pattern_COUNT = 0;
+}
+
+static inline void Morse_Decoder_Classify(Morse_Decoder *decoder, int mark, int length){
+    // Classifies one finished run with the calibrated lengths
+    const Run_Lengths *lengths = &decoder->lengths;
+    if (mark){
+        int dash = !(abs(lengths->dot - length) < abs(lengths->dash - length));
+        if (decoder->pattern_COUNT < 7){
+            decoder->pattern[decoder->pattern_COUNT] = dash ? '1' : '0';
+            decoder->pattern_COUNT += 1;
+        }
+        decoder->started = 1;
+        return;
+    }
+    if (!decoder->started){
+        return;
+    }
+    if (!(abs(lengths->small_Space - length) < abs(lengths->big_Space - length))){
+        Morse_Decoder_Lookup(decoder);
+        if (length >= decoder->word_Space){
+            Morse_Decoder_Emit(decoder, ' ');
+        }
+    }
+}
+
+
+// _________________________________________________
+//  Learning
+// _________________________________________________
+
+static inline int Morse_Decoder_Learn_Lengths(Morse_Decoder *decoder, int min_Runs){
+    // Calibrates from the buffered runs and decodes them, returns -1 when there are too few
+    int mark_Runs[MORSE_DECODER_LEARN_RUNS];
+    int space_Runs[MORSE_DECODER_LEARN_RUNS];
+    int mark_COUNT = 0;
+    int space_COUNT = 0;
+    for (int i = 1; i < decoder->learn_RUN_COUNT; i++){
+        if (decoder->learn_Marks[i]){
+            mark_Runs[mark_COUNT++] = decoder->learn_Lengths[i];
+        } else {
+            space_Runs[space_COUNT++] = decoder->learn_Lengths[i];
+        }
+    }
+    if (mark_COUNT + space_COUNT < min_Runs || Run_Calibrate(mark_Runs, mark_COUNT, space_Runs, space_COUNT, &decoder->lengths) != 0){
+        return -1;
+    }
+    decoder->word_Space = Morse_Decoder_Word_Space(decoder->lengths.big_Space);
+    decoder->calibrated = 1;
+    for (int i = 0; i < decoder->learn_RUN_COUNT; i++){
+        Morse_Decoder_Classify(decoder, decoder->learn_Marks[i], decoder->learn_Lengths[i]);
+    }
+    decoder->learn_RUN_COUNT = 0;
+    return 0;
+}
+
+static inline void Morse_Decoder_Level(Morse_Decoder *decoder, int value){
+    // Counts one sample into the current run (threshold known)
+    int mark = decoder->config.mark_Low ? value <= decoder->threshold : value > decoder->threshold;
+    if (mark == decoder->run_Mark){
+        decoder->run_Length += 1;
+        return;
+    }
+    if (decoder->run_Mark != -1){
+        Morse_Decoder_Push_Run(decoder, decoder->run_Mark, decoder->run_Length);
+    }
+    decoder->run_Mark = mark;
+    decoder->run_Length = 1;
+}
+
+static inline int Morse_Decoder_Learn_Threshold(Morse_Decoder *decoder){
+    // Threshold halfway between the lowest and highest buffered sample, then decodes them; -1 without contrast
+    int lowest = INT16_MAX;
+    int highest = 0;
+    for (int i = 0; i < decoder->learn_VALUE_COUNT; i++){
+        lowest = decoder->learn_Values[i] < lowest ? decoder->learn_Values[i] : lowest;
+        highest = decoder->learn_Values[i] > highest ? decoder->learn_Values[i] : highest;
+    }
+    if (highest - lowest < AUTO_CALIBRATION_CONTRAST){
+        return -1;
+    }
+    decoder->threshold = (highest + lowest) / 2;
+    int count = decoder->learn_VALUE_COUNT;
+    decoder->learn_VALUE_COUNT = 0;
+    for (int i = 0; i < count; i++){
+        Morse_Decoder_Level(decoder, decoder->learn_Values[i]);
+    }
+    return 0;
+}
+
+static inline void Morse_Decoder_Settle(Morse_Decoder *decoder, int finish_Run){
+    // Stops learning with what is buffered (at a gap or the end of the input), finishes the current run when asked
+    if (decoder->threshold < 0 && decoder->learn_VALUE_COUNT > 0 && Morse_Decoder_Learn_Threshold(decoder) != 0){
+        decoder->learn_VALUE_COUNT = 0; // No mark in sight: nothing to decode
+    }
+    if (finish_Run && decoder->run_Mark != -1){
+        Morse_Decoder_Push_Run(decoder, decoder->run_Mark, decoder->run_Length);
+    }
+    decoder->run_Mark = -1;
+    if (!decoder->calibrated && decoder->learn_RUN_COUNT > 0 && Morse_Decoder_Learn_Lengths(decoder, 1) != 0){
+        decoder->learn_RUN_COUNT = 0;
+    }
+}
+
+
+// _________________________________________________
+//  Decoder Functions
+// _________________________________________________
+
+MORSE_DECODER_API void Morse_Decoder_Init(Morse_Decoder *decoder, const Morse_Decoder_Config *config){
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->config = *config;
+    if (decoder->config.symbols == NULL){
+        decoder->config.symbols = Morse_Decoder_SYMBOLS;
+        decoder->config.patterns = Morse_Decoder_PATTERNS;
+        decoder->config.symbol_COUNT = (int)(sizeof(Morse_Decoder_PATTERNS) / sizeof(Morse_Decoder_PATTERNS[0]));
+    }
+    decoder->threshold = -1;
+    decoder->run_Mark = -1;
+    decoder->skip_Next = config->skip_Preamble;
+}
+
+MORSE_DECODER_API void Morse_Decoder_Calibrate(Morse_Decoder *decoder, int threshold, const Run_Lengths *lengths, int word_Space){
+    // Sets the threshold (-1 to learn it from the samples) and lengths (word_Space 0 for the default), then decodes what was buffered
+    decoder->threshold = threshold;
+    decoder->lengths = *lengths;
+    decoder->word_Space = word_Space > 0 ? word_Space : Morse_Decoder_Word_Space(lengths->big_Space);
+    decoder->calibrated = 1;
+    for (int i = 0; i < decoder->learn_RUN_COUNT; i++){
+        Morse_Decoder_Classify(decoder, decoder->learn_Marks[i], decoder->learn_Lengths[i]);
+    }
+    decoder->learn_RUN_COUNT = 0;
+    if (threshold >= 0){
+        int count = decoder->learn_VALUE_COUNT;
+        decoder->learn_VALUE_COUNT = 0;
+        for (int i = 0; i < count; i++){
+            Morse_Decoder_Level(decoder, decoder->learn_Values[i]);
+        }
+    }
+}
+
+MORSE_DECODER_API void Morse_Decoder_Mid_Message(Morse_Decoder *decoder){
+    // The input starts inside a message, after its calibration pattern
+    decoder->skip_Next = 0;
+}
+
+MORSE_DECODER_API void Morse_Decoder_Push_Run(Morse_Decoder *decoder, int mark, int length){
+    if (decoder->calibrated){
+        Morse_Decoder_Classify(decoder, mark, length);
+        return;
+    }
+    if (decoder->learn_RUN_COUNT == MORSE_DECODER_LEARN_RUNS){
+        decoder->learn_RUN_COUNT = 0; // Nothing to learn from (no marks): start over
+    }
+    decoder->learn_Marks[decoder->learn_RUN_COUNT] = (unsigned char)(mark != 0);
+    decoder->learn_Lengths[decoder->learn_RUN_COUNT] = length;
+    decoder->learn_RUN_COUNT += 1;
+    if (decoder->learn_RUN_COUNT == MORSE_DECODER_LEARN_RUNS){
+        Morse_Decoder_Learn_Lengths(decoder, AUTO_CALIBRATION_RUNS);
+    }
+}
+
+MORSE_DECODER_API void Morse_Decoder_Push_Sample(Morse_Decoder *decoder, int value){
+    if (value == MORSE_SAMPLE_GAP){
+        Morse_Decoder_Gap(decoder);
+        return;
+    }
+    if (value == MORSE_SAMPLE_END){
+        Morse_Decoder_End_Message(decoder);
+        return;
+    }
+    if (decoder->threshold >= 0){
+        Morse_Decoder_Level(decoder, value);
+        return;
+    }
+    if (decoder->learn_VALUE_COUNT == MORSE_DECODER_LEARN_VALUES){
+        // Still no contrast: keep the newer half
+        memmove(decoder->learn_Values, decoder->learn_Values + MORSE_DECODER_LEARN_VALUES / 2, (MORSE_DECODER_LEARN_VALUES / 2) * sizeof(int));
+        decoder->learn_VALUE_COUNT = MORSE_DECODER_LEARN_VALUES / 2;
+    }
+    decoder->learn_Values[decoder->learn_VALUE_COUNT] = value;
+    decoder->learn_VALUE_COUNT += 1;
+    if (decoder->learn_VALUE_COUNT == MORSE_DECODER_LEARN_VALUES){
+        Morse_Decoder_Learn_Threshold(decoder);
+    }
+}
+
+MORSE_DECODER_API void Morse_Decoder_Push_Samples(Morse_Decoder *decoder, const int16_t *values, int count){
+    for (int i = 0; i < count; i++){
+        Morse_Decoder_Push_Sample(decoder, values[i]);
+    }
+}
+
+MORSE_DECODER_API void Morse_Decoder_Gap(Morse_Decoder *decoder){
+    // Samples were lost: the partial run and character are abandoned like in Conversion()
+    Morse_Decoder_Settle(decoder, 0);
+    Morse_Decoder_Emit(decoder, MORSE_DECODER_GAP_SYMBOL);
+    decoder->pattern_COUNT = 0;
+    decoder->started = 0;
+}
+
+MORSE_DECODER_API void Morse_Decoder_Flush(Morse_Decoder *decoder){
+    // Finishes the current run and character (the input pauses in a long silence)
+    Morse_Decoder_Settle(decoder, 1);
+    Morse_Decoder_Lookup(decoder);
+}
+
+MORSE_DECODER_API void Morse_Decoder_End_Message(Morse_Decoder *decoder){
+    // Finishes the message; the calibration is kept for the next one
+    Morse_Decoder_Flush(decoder);
+    Morse_Decoder_Emit(decoder, '\n');
+    decoder->started = 0;
+    decoder->skip_Next = decoder->config.skip_Preamble;
+}
+
+#endif
@@ -0,0 +1,533 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Capture Files and Parallel Offline Decoding (shared by both readers)
+// *****************************************************
+
+/*  With CAPTURE_RECORD set to '1' every stored value is appended to a capture
+    file (CAPTURE_DIR/morse_<reader>_<channel>.mcr) and a message marker is
+    written whenever reading stops. Running a reader with
+
+        ./reader --decode <capture file> [threads]
+
+    decodes such a file offline (no hardware is touched) and prints one line per
+    message. Long captures are decoded in parallel:
+
+        -- the file is cut into segments of about OFFLINE_SEGMENT_VALUES values;
+           each cut is moved forward to the end of the next long silence (a word
+           gap or longer) or message marker, where the decoder holds no state,
+           so every segment decodes on its own
+        -- the segments are spread over a pool of threads; each thread works
+           through its own queue and steals from the back of the others when
+           it runs dry
+        -- every segment writes its own text, which is stitched together in
+           order afterwards
+
+    The cuts only depend on the file, not on the number of threads, so the
+    output is identical to a decode on one thread. The calibration is either
+    shared (estimated once from the start of the capture, OFFLINE_SHARED) or
+    re-estimated from every segment (OFFLINE_PER_SEGMENT, falling back to the
+    shared one for segments with too few runs).
+
+    Every segment is decoded by its own Morse_Decoder (Morse_Decoder.h), so the
+    threads share no decoder state. Runs are classified like Conversion() does
+    (nearest length), and spaces of at least 5/3 big spaces (7 vs 3 units,
+    Morse_Decoder_Word_Space()) additionally print a ' '.
+
+    File layout (host byte order): a Capture_Header followed by int16 values;
+    values are repeated by their weight, GAP_MARKER marks dropped values and
+    CAPTURE_MESSAGE_MARKER the end of a message.
+*/
+
+#ifndef OFFLINE_DECODE_H
+#define OFFLINE_DECODE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "Overrun_Policy.h"
+#include "Run_Calibration.h"
+#include "Sample_Rate.h"
+#include "Realtime_Profile.h"
+
+#ifndef MORSE_DECODER_LINKED
+#define MORSE_DECODER_STATIC // Compiled in; -DMORSE_DECODER_LINKED links libmorse_decoder instead
+#endif
+#include "Morse_Decoder.h"
+
+
+// _________________________________________________
+//  Capture Configuration
+// _________________________________________________
+
+#ifndef CAPTURE_RECORD
+#define CAPTURE_RECORD 0 // Set to '1' to append every stored value to the capture file
+#endif
+
+#ifndef CAPTURE_DIR
+#define CAPTURE_DIR "/var/tmp" // Directory of the capture files (one per reader and channel)
+#endif
+
+#define OFFLINE_SHARED 0      // One calibration from the start of the capture for all segments
+#define OFFLINE_PER_SEGMENT 1 // Every segment is calibrated from its own runs
+
+#ifndef OFFLINE_CALIBRATION
+#define OFFLINE_CALIBRATION OFFLINE_SHARED
+#endif
+
+#ifndef OFFLINE_SEGMENT_VALUES
+#define OFFLINE_SEGMENT_VALUES 65536 // Target segment size; cuts are moved to the next long silence
+#endif
+
+#define OFFLINE_CALIBRATION_VALUES 4096 // Values at the start of the capture used for the shared calibration
+#define OFFLINE_MAX_THREADS 64
+
+#define CAPTURE_MAGIC "MCRC"
+#define CAPTURE_VERSION 1
+#define CAPTURE_FLAG_PREAMBLE 1 // Messages start with the calibration pattern (left out of the text)
+#define CAPTURE_FLAG_MARK_LOW 2 // BLACK reads below the threshold (paper reader)
+#define CAPTURE_MESSAGE_MARKER -2
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t channel;
+    uint32_t flags;
+    uint32_t reserved;
+    double sample_HZ;
+} Capture_Header;
+
+
+// _________________________________________________
+//  Capture Recording
+// _________________________________________________
+
+static FILE *Capture_FILE = NULL;
+
+static void Capture_Open(const char *reader, int channel, int flags){
+    // Starts a new capture file for this session (nothing when CAPTURE_RECORD is off)
+    if (!CAPTURE_RECORD){
+        return;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/morse_%s_%d.mcr", CAPTURE_DIR, reader, channel);
+    Capture_FILE = fopen(path, "wb");
+    if (Capture_FILE == NULL){
+        printf("WARNING: could not open capture file %s, not recording\n", path);
+        return;
+    }
+    Capture_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, 4);
+    header.version = CAPTURE_VERSION;
+    header.channel = (uint16_t)channel;
+    header.flags = (uint32_t)flags;
+    header.sample_HZ = Reader_Session.sample_HZ;
+    fwrite(&header, sizeof(header), 1, Capture_FILE);
+    printf("Recording capture to %s\n", path);
+}
+
+static void Capture_Append(int value, int weight){
+    // Appends one stored value (repeated 'weight' times so run lengths stay correct)
+    if (Capture_FILE == NULL){
+        return;
+    }
+    int16_t sample = (int16_t)(value > INT16_MAX ? INT16_MAX : value);
+    for (int i = 0; i < weight; i++){
+        fwrite(&sample, sizeof(sample), 1, Capture_FILE);
+    }
+}
+
+static void Capture_Message_End(void){
+    if (Capture_FILE == NULL){
+        return;
+    }
+    int16_t marker = CAPTURE_MESSAGE_MARKER;
+    fwrite(&marker, sizeof(marker), 1, Capture_FILE);
+    fflush(Capture_FILE);
+}
+
+
+// _________________________________________________
+//  Segment Decoder
+// _________________________________________________
+
+typedef struct {
+    Run_Lengths lengths;
+    int threshold;
+    int word_Space;  // Shortest space printed as a word gap
+} Offline_Calibration;
+
+typedef struct {
+    int from;                 // First value of the segment
+    int to;                   // One past the last value
+    int message_Start;        // '1' when the segment starts a message
+    char *text;               // Decoded text of the segment
+    int text_COUNT;
+} Offline_Segment;
+
+static const int16_t *Offline_VALUES;
+static int Offline_COUNT;
+static int Offline_MARK_LOW;
+static int Offline_PREAMBLE;
+
+static inline int Offline_Is_Mark(int value, int threshold){
+    return Offline_MARK_LOW ? value <= threshold : value > threshold;
+}
+
+static void Offline_Collect(void *user, char symbol){
+    // Decoder callback: appends the symbol to the segment's text
+    Offline_Segment *segment = (Offline_Segment *)user;
+    segment->text[segment->text_COUNT] = symbol;
+    segment->text_COUNT += 1;
+}
+
+static int Offline_Threshold(int from, int to, int *threshold){
+    // Midpoint of the lowest and highest value, returns -1 when there is no contrast
+    int lowest = INT16_MAX;
+    int highest = 0;
+    for (int i = from; i < to; i++){
+        int value = Offline_VALUES[i];
+        if (value < 0){
+            continue;
+        }
+        lowest = value < lowest ? value : lowest;
+        highest = value > highest ? value : highest;
+    }
+    if (highest - lowest < AUTO_CALIBRATION_CONTRAST){
+        return -1;
+    }
+    *threshold = (highest + lowest) / 2;
+    return 0;
+}
+
+static int Offline_Calibrate(int from, int to, int min_Runs, Offline_Calibration *calibration){
+    // Derives threshold and lengths from the runs in [from, to), returns -1 when there are fewer than min_Runs
+    int threshold;
+    if (Offline_Threshold(from, to, &threshold) != 0){
+        return -1;
+    }
+    int mark_Runs[CALIBRATION_MAX_RUNS];
+    int space_Runs[CALIBRATION_MAX_RUNS];
+    int mark_COUNT = 0;
+    int space_COUNT = 0;
+    int run_Mark = -1;
+    int run_Length = 0;
+    int runs = 0;
+    for (int i = from; i < to; i++){
+        int value = Offline_VALUES[i];
+        if (value < 0){
+            run_Mark = -1; // Gap or message end: the run is incomplete and a new stretch starts
+            runs = 0;
+            continue;
+        }
+        int mark = Offline_Is_Mark(value, threshold);
+        if (mark == run_Mark){
+            run_Length += 1;
+            continue;
+        }
+        if (run_Mark != -1 && runs > 0){
+            // The first run of a stretch may be cut short, it is left out
+            if (run_Mark && mark_COUNT < CALIBRATION_MAX_RUNS){
+                mark_Runs[mark_COUNT++] = run_Length;
+            } else if (!run_Mark && space_COUNT < CALIBRATION_MAX_RUNS){
+                space_Runs[space_COUNT++] = run_Length;
+            }
+        }
+        runs += run_Mark != -1;
+        run_Mark = mark;
+        run_Length = 1;
+    }
+    if (mark_COUNT + space_COUNT < min_Runs
+        || Run_Calibrate(mark_Runs, mark_COUNT, space_Runs, space_COUNT, &calibration->lengths) != 0){
+        return -1;
+    }
+    calibration->threshold = threshold;
+    calibration->word_Space = Morse_Decoder_Word_Space(calibration->lengths.big_Space);
+    return 0;
+}
+
+static void Offline_Decode_Segment(Offline_Segment *segment, const Offline_Calibration *shared,
+                                   const char *symbols, const char patterns[][8], int symbol_COUNT){
+    // Decodes one segment into its own text
+    Offline_Calibration own;
+    const Offline_Calibration *calibration = shared;
+    if (OFFLINE_CALIBRATION == OFFLINE_PER_SEGMENT && Offline_Calibrate(segment->from, segment->to, AUTO_CALIBRATION_RUNS, &own) == 0){
+        calibration = &own;
+    }
+
+    segment->text = malloc((size_t)(segment->to - segment->from) + 2); // At most one symbol per value
+    segment->text_COUNT = 0;
+
+    Morse_Decoder_Config config = { symbols, patterns, symbol_COUNT, Offline_MARK_LOW, Offline_PREAMBLE, Offline_Collect, segment };
+    Morse_Decoder decoder;
+    Morse_Decoder_Init(&decoder, &config);
+    Morse_Decoder_Calibrate(&decoder, calibration->threshold, &calibration->lengths, calibration->word_Space);
+    if (!segment->message_Start){
+        Morse_Decoder_Mid_Message(&decoder);
+    }
+    Morse_Decoder_Push_Samples(&decoder, Offline_VALUES + segment->from, segment->to - segment->from);
+
+    // A message marker (always the last value of a segment) has ended the message; otherwise the segment ends in a long silence
+    if (Offline_VALUES[segment->to - 1] != CAPTURE_MESSAGE_MARKER){
+        if (segment->to == Offline_COUNT){
+            Morse_Decoder_End_Message(&decoder);
+        } else {
+            Morse_Decoder_Flush(&decoder);
+        }
+    }
+}
+
+
+// _________________________________________________
+//  Segmentation
+// _________________________________________________
+
+static int Offline_Next_Cut(int position, const Offline_Calibration *shared){
+    // First position at or after 'position' that follows a message marker or a silence of at least a word gap
+    for (int i = position; i < Offline_COUNT; i++){
+        if (i > 0 && Offline_VALUES[i - 1] == CAPTURE_MESSAGE_MARKER){
+            return i;
+        }
+        if (i == 0 || Offline_VALUES[i] < 0 || !Offline_Is_Mark(Offline_VALUES[i], shared->threshold)){
+            continue;
+        }
+        // A mark: measure the silence in front of it
+        int start = i - 1;
+        while (start >= 0 && Offline_VALUES[start] >= 0 && !Offline_Is_Mark(Offline_VALUES[start], shared->threshold)){
+            start -= 1;
+        }
+        if (i - 1 - start >= shared->word_Space){
+            return i;
+        }
+    }
+    return Offline_COUNT;
+}
+
+static int Offline_Segment_Capture(const Offline_Calibration *shared, Offline_Segment **segments){
+    // Cuts the capture into independent segments, returns their number
+    int capacity = Offline_COUNT / OFFLINE_SEGMENT_VALUES + 16;
+    int count = 0;
+    *segments = malloc((size_t)capacity * sizeof(Offline_Segment));
+
+    int from = 0;
+    while (from < Offline_COUNT){
+        int to = Offline_Next_Cut(from + 1, shared);
+        // Message markers always cut, so a segment never spans two messages
+        for (int i = from; i < to; i++){
+            if (Offline_VALUES[i] == CAPTURE_MESSAGE_MARKER){
+                to = i + 1;
+                break;
+            }
+        }
+        while (to - from < OFFLINE_SEGMENT_VALUES && to < Offline_COUNT && Offline_VALUES[to - 1] != CAPTURE_MESSAGE_MARKER){
+            to = Offline_Next_Cut(to + 1, shared); // Too small: extend to the next cut
+        }
+        if (count == capacity){
+            capacity *= 2;
+            *segments = realloc(*segments, (size_t)capacity * sizeof(Offline_Segment));
+        }
+        (*segments)[count].from = from;
+        (*segments)[count].to = to;
+        (*segments)[count].message_Start = (from == 0 || Offline_VALUES[from - 1] == CAPTURE_MESSAGE_MARKER);
+        (*segments)[count].text = NULL;
+        (*segments)[count].text_COUNT = 0;
+        count += 1;
+        from = to;
+    }
+    return count;
+}
+
+
+// _________________________________________________
+//  Work-Stealing Pool
+// _________________________________________________
+
+typedef struct {
+    pthread_mutex_t lock;
+    int front;   // Next segment the owner takes
+    int back;    // One past the last segment (thieves take from here)
+} Offline_Queue;
+
+typedef struct {
+    int index;
+    int thread_COUNT;
+    Offline_Queue *queues;
+    Offline_Segment *segments;
+    const Offline_Calibration *shared;
+    const char *symbols;
+    const char (*patterns)[8];
+    int symbol_COUNT;
+    int decoded;
+    int stolen;
+} Offline_Worker;
+
+static int Offline_Take(Offline_Queue *queue, int steal){
+    // Takes a segment from the front (owner) or the back (thief), returns -1 when empty
+    int segment = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->front < queue->back){
+        if (steal){
+            queue->back -= 1;
+            segment = queue->back;
+        } else {
+            segment = queue->front;
+            queue->front += 1;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return segment;
+}
+
+static void *Offline_Worker_Thread(void *vargp){
+    Offline_Worker *worker = (Offline_Worker *)vargp;
+    Realtime_Enter_Decode();
+    while (1){
+        int segment = Offline_Take(&worker->queues[worker->index], 0);
+        for (int i = 1; segment < 0 && i < worker->thread_COUNT; i++){
+            segment = Offline_Take(&worker->queues[(worker->index + i) % worker->thread_COUNT], 1);
+            worker->stolen += segment >= 0;
+        }
+        if (segment < 0){
+            return NULL; // No work is created while decoding, so every queue is empty for good
+        }
+        Offline_Decode_Segment(&worker->segments[segment], worker->shared, worker->symbols, worker->patterns, worker->symbol_COUNT);
+        worker->decoded += 1;
+    }
+}
+
+
+// _________________________________________________
+//  Offline Entry Point
+// _________________________________________________
+
+static int16_t *Offline_Load(const char *path, Capture_Header *header){
+    // Reads a capture file into Offline_VALUES, returns the buffer to free or NULL (already reported)
+    FILE *file = fopen(path, "rb");
+    if (file == NULL){
+        printf("Could not open capture file %s\n", path);
+        return NULL;
+    }
+    if (fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, CAPTURE_MAGIC, 4) != 0 || header->version != CAPTURE_VERSION){
+        printf("%s is not a capture file\n", path);
+        fclose(file);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file) - (long)sizeof(*header);
+    fseek(file, (long)sizeof(*header), SEEK_SET);
+    int16_t *values = malloc((size_t)size + sizeof(int16_t));
+    Offline_COUNT = (int)(fread(values, sizeof(int16_t), (size_t)size / sizeof(int16_t), file));
+    fclose(file);
+    Offline_VALUES = values;
+    Offline_MARK_LOW = (header->flags & CAPTURE_FLAG_MARK_LOW) != 0;
+    Offline_PREAMBLE = (header->flags & CAPTURE_FLAG_PREAMBLE) != 0;
+    return values;
+}
+
+static int Offline_Shared_Calibration(Offline_Calibration *shared){
+    // Calibration from the start of the capture (the whole capture when that is too short), returns -1 without runs
+    int calibration_END = Offline_COUNT < OFFLINE_CALIBRATION_VALUES ? Offline_COUNT : OFFLINE_CALIBRATION_VALUES;
+    if (Offline_Calibrate(0, calibration_END, AUTO_CALIBRATION_RUNS, shared) != 0 && Offline_Calibrate(0, Offline_COUNT, 1, shared) != 0){
+        return -1;
+    }
+    return 0;
+}
+
+static int Offline_Print_Text(const char *text, int count, int *pending_Spaces){
+    // Prints decoded text, spaces in front of a line end are dropped; returns the number of line ends
+    int message_COUNT = 0;
+    for (int c = 0; c < count; c++){
+        char symbol = text[c];
+        if (symbol == ' '){
+            *pending_Spaces = 1;
+            continue;
+        }
+        if (symbol == '\n'){
+            message_COUNT += 1;
+        } else if (*pending_Spaces){
+            putchar(' ');
+        }
+        *pending_Spaces = 0;
+        putchar(symbol);
+    }
+    return message_COUNT;
+}
+
+static int Offline_Decode_Main(const char *path, int thread_COUNT, const char *symbols, const char patterns[][8], int symbol_COUNT){
+    // Decodes a capture file and prints its messages, returns the process exit status
+    Capture_Header header;
+    int16_t *values = Offline_Load(path, &header);
+    if (values == NULL){
+        return 1;
+    }
+
+    if (thread_COUNT <= 0){
+        thread_COUNT = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (thread_COUNT < 1){
+        thread_COUNT = 1;
+    } else if (thread_COUNT > OFFLINE_MAX_THREADS){
+        thread_COUNT = OFFLINE_MAX_THREADS;
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start); // Wall time on purpose, also in the simulated build
+
+    Offline_Calibration shared;
+    if (Offline_Shared_Calibration(&shared) != 0){
+        printf("Not enough runs in %s to calibrate\n", path);
+        free(values);
+        return 1;
+    }
+
+    Offline_Segment *segments;
+    int segment_COUNT = Offline_Segment_Capture(&shared, &segments);
+
+    // Every thread starts with a contiguous share of the segments
+    Offline_Queue queues[OFFLINE_MAX_THREADS];
+    Offline_Worker workers[OFFLINE_MAX_THREADS];
+    pthread_t threads[OFFLINE_MAX_THREADS];
+    for (int t = 0; t < thread_COUNT; t++){
+        pthread_mutex_init(&queues[t].lock, NULL);
+        queues[t].front = (int)((long long)segment_COUNT * t / thread_COUNT);
+        queues[t].back = (int)((long long)segment_COUNT * (t + 1) / thread_COUNT);
+        workers[t] = (Offline_Worker){ t, thread_COUNT, queues, segments, &shared, symbols, patterns, symbol_COUNT, 0, 0 };
+    }
+    for (int t = 1; t < thread_COUNT; t++){
+        pthread_create(&threads[t], NULL, Offline_Worker_Thread, &workers[t]);
+    }
+    Offline_Worker_Thread(&workers[0]);
+    int stolen = 0;
+    for (int t = 1; t < thread_COUNT; t++){
+        pthread_join(threads[t], NULL);
+        stolen += workers[t].stolen;
+    }
+    stolen += workers[0].stolen;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Stitch the segments together in order
+    int pending_Spaces = 0;
+    int message_COUNT = 0;
+    for (int s = 0; s < segment_COUNT; s++){
+        message_COUNT += Offline_Print_Text(segments[s].text, segments[s].text_COUNT, &pending_Spaces);
+        free(segments[s].text);
+    }
+
+    double elapsed_MS = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("________________________________________________\n");
+    printf("Decoded %d message(s) from %d values (%.1f s at %.1f values/s)\n",
+           message_COUNT, Offline_COUNT, header.sample_HZ > 0 ? Offline_COUNT / header.sample_HZ : 0.0, header.sample_HZ);
+    printf("%d segment(s) on %d thread(s), %d stolen, in %.1f ms (%s calibration: dot %d, dash %d, spaces %d/%d, threshold %d)\n",
+           segment_COUNT, thread_COUNT, stolen, elapsed_MS, OFFLINE_CALIBRATION == OFFLINE_PER_SEGMENT ? "per-segment" : "shared",
+           shared.lengths.dot, shared.lengths.dash, shared.lengths.small_Space, shared.lengths.big_Space, shared.threshold);
+    free(segments);
+    free(values);
+    return 0;
+}
+
+#endif
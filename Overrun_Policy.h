@@ -0,0 +1,144 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Overrun Detection and Backpressure (shared by both readers)
+// *****************************************************
+
+/*  The voltage array is a ring: fill_Array() writes at array_Append_COUNT and
+    analyse_Array() reads at array_Analyse_COUNT. The readers compare the total
+    number of written and analysed values to detect when the writer is about to
+    overwrite a value that has not been analysed yet, and then apply one of the
+    policies below:
+
+        OVERRUN_BLOCK       - the writer waits for the reader (sampling stalls)
+        OVERRUN_DROP_OLDEST - the oldest OVERRUN_DROP_CHUNK values are discarded and
+                              a GAP_MARKER is left in their place
+        OVERRUN_DECIMATE    - above OVERRUN_HIGH_WATER only every
+                              OVERRUN_DECIMATE_FACTOR-th value is stored (with its
+                              weight so run lengths stay correct); if the ring still
+                              fills up the oldest values are dropped as above
+
+    Every overrun is logged with its position in the sample stream so the
+    Output() stage can report how many samples were lost and where.
+*/
+
+#ifndef OVERRUN_POLICY_H
+#define OVERRUN_POLICY_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include "Stage_Metrics.h"
+#include "Reader_Clock.h"
+
+
+// _________________________________________________
+//  Policy Configuration
+// _________________________________________________
+
+#define OVERRUN_BLOCK 0
+#define OVERRUN_DROP_OLDEST 1
+#define OVERRUN_DECIMATE 2
+
+#ifndef OVERRUN_POLICY
+#define OVERRUN_POLICY OVERRUN_DROP_OLDEST // Selects one of the three policies above
+#endif
+
+#ifndef OVERRUN_DROP_CHUNK
+#define OVERRUN_DROP_CHUNK 32 // Number of oldest values discarded per overrun (drop policies)
+#endif
+
+#ifndef OVERRUN_DECIMATE_FACTOR
+#define OVERRUN_DECIMATE_FACTOR 2 // One in every N values is kept while above the high-water mark
+#endif
+
+#define GAP_MARKER -1  // Stored in the voltage array where values were dropped
+#define GAP_SYMBOL '#' // Printed in the final message where values were dropped
+
+#define OVERRUN_LOG_LENGTH 32 // Number of overrun events kept for the report
+
+
+// _________________________________________________
+//  Overrun Log
+// _________________________________________________
+
+typedef struct {
+    long long position;            // Index (in the whole sample stream) of the first lost value
+    long long lost;                // Number of values lost (0 when the writer was only stalled)
+    unsigned long long stalled_us; // Time the writer was blocked (OVERRUN_BLOCK only)
+} Overrun_Event;
+
+static Overrun_Event Overrun_Log[OVERRUN_LOG_LENGTH];
+static int Overrun_Log_COUNT = 0;          // Number of events (may exceed OVERRUN_LOG_LENGTH)
+static long long Overrun_Lost_TOTAL = 0;
+static unsigned long long Overrun_Stalled_TOTAL_US = 0;
+
+static void Overrun_Record(long long position, long long lost, unsigned long long stalled_us){
+    // Logs an overrun event. Must be called with the voltage array lock held
+    if (Overrun_Log_COUNT < OVERRUN_LOG_LENGTH){
+        Overrun_Log[Overrun_Log_COUNT].position = position;
+        Overrun_Log[Overrun_Log_COUNT].lost = lost;
+        Overrun_Log[Overrun_Log_COUNT].stalled_us = stalled_us;
+    }
+    Overrun_Log_COUNT += 1;
+    Overrun_Lost_TOTAL += lost;
+    Overrun_Stalled_TOTAL_US += stalled_us;
+
+    Metrics_Count(&Reader_Metrics.overruns_total, 1);
+    Metrics_Count(&Reader_Metrics.dropped_total, (unsigned long long)lost);
+}
+
+static const char *Overrun_Policy_NAME(void){
+    switch (OVERRUN_POLICY){
+        case OVERRUN_BLOCK: return "block";
+        case OVERRUN_DECIMATE: return "decimate";
+        default: return "drop-oldest";
+    }
+}
+
+static void Overrun_Report(void){
+    // Prints a summary of the overruns of the current message (nothing if there were none)
+    if (Overrun_Log_COUNT == 0){
+        return;
+    }
+    printf("WARNING: %d overrun(s) under the '%s' policy: %lld sample(s) lost, writer stalled for %llu us\n",
+           Overrun_Log_COUNT, Overrun_Policy_NAME(), Overrun_Lost_TOTAL, Overrun_Stalled_TOTAL_US);
+    for (int i = 0; i < Overrun_Log_COUNT && i < OVERRUN_LOG_LENGTH; i++){
+        if (Overrun_Log[i].lost > 0){
+            printf("   samples %lld - %lld lost (marked '%c' in the message)\n",
+                   Overrun_Log[i].position, Overrun_Log[i].position + Overrun_Log[i].lost - 1, GAP_SYMBOL);
+        } else {
+            printf("   writer stalled for %llu us at sample %lld\n", Overrun_Log[i].stalled_us, Overrun_Log[i].position);
+        }
+    }
+    if (Overrun_Log_COUNT > OVERRUN_LOG_LENGTH){
+        printf("   ... %d further overrun(s) not listed\n", Overrun_Log_COUNT - OVERRUN_LOG_LENGTH);
+    }
+}
+
+static void Overrun_Reset(void){
+    // Clears the overrun log before the next message (the metrics counters keep counting)
+    Overrun_Log_COUNT = 0;
+    Overrun_Lost_TOTAL = 0;
+    Overrun_Stalled_TOTAL_US = 0;
+}
+
+static void Overrun_Timed_Wait(pthread_cond_t *condition, pthread_mutex_t *lock, long timeout_us){
+    // Waits on 'condition' for at most timeout_us so a missed signal can never hang a stage
+    if (CLOCK_SIMULATED){
+        // Only one participant runs at a time on the simulated clock: sleep so the writer can move on
+        pthread_mutex_unlock(lock);
+        Clock_Sleep_US(timeout_us);
+        pthread_mutex_lock(lock);
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += timeout_us * 1000L;
+    if (deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+    }
+    pthread_cond_timedwait(condition, lock, &deadline);
+}
+
+#endif
@@ -9,6 +9,7 @@
 //  Libraries
 // _________________________________________________
 
+#define _GNU_SOURCE      // Needed by Realtime_Profile.h for the CPU affinity functions
 #include <stdio.h>
 #include <wiringPi.h>    // Used to interface with the raspberry Pi and C code
 #include <wiringPiSPI.h> // Links ADC to Pi using SPI
@@ -17,6 +18,26 @@
 #include <pthread.h>     // Enable threads
 #include <stdlib.h>
 #include <string.h>      
+#include "Stage_Metrics.h" // Lock-free per-stage counters and latency histograms
+#include "Overrun_Policy.h" // Overrun detection and backpressure for the voltage array
+#include "Realtime_Profile.h" // Opt-in SCHED_FIFO / core pinning / mlockall profile for sampling
+#include "Sample_Rate.h"      // Startup ADC rate probe, sample rate / decimation selection and sample clock
+#include "Sample_Filter.h"    // Moving average / median / CIC filter between the ADC and the voltage array
+#include "Edge_Timing.h"      // Sub-sample edge positions and Q8 run lengths (EDGE_INTERPOLATION)
+#include "Run_Calibration.h"  // Derives the dot/dash/space lengths from the run durations (auto-calibration)
+#include "Calibration_Profile.h" // Saves/loads the calibration per reader and channel for warm starts
+#include "Json_Stream.h"       // JSON Lines output to a socket, FIFO or file in DAEMON_MODE
+#include "Reader_Clock.h"       // Real or simulated clock for every time stamp, sleep and delay
+#include "Offline_Decode.h"     // Capture recording and the parallel offline decoder (--decode)
+#include "Run_Archive.h"        // Compact run-length archives of captures (--archive, --decode-archive)
+#include "Flight_Recorder.h"    // Memory-mapped ring of the last minutes of signal (FLIGHT_RECORDER)
+#include "Decode_Confidence.h"  // Timing residuals and confidence of every decoded character
+#include "Channel_Diversity.h"  // Combines several LDR channels into one value (DIVERSITY_CHANNELS)
+#include "Stage_Trace.h"        // Scoped stage trace points, per-stage CPU summary and Chrome trace output (STAGE_TRACE)
+#include "Frame_Sync.h"         // Framed messages: sync preamble, length and CRC, lockable mid-stream (FRAME_MODE)
+#include "Auto_Trigger.h"       // Hands-free message start/stop with a pre-trigger buffer (AUTO_TRIGGER)
+#include "Idle_Sampling.h"      // One conversion per value and slower polling while nothing changes (IDLE_SAMPLING)
+#include "Reader_State.h"       // Atomic reader state machine (idle, arming, reading, draining, output, shutdown)
 
 
 
@@ -28,38 +49,52 @@
 #define LED_PIN 26 // This is the GPIO 26  connected to the LED
 #define SPI_PIN 0 // This refers to GPIO 8 (SPI0 CE0) on the Pi 
 #define ADC_CHANNEL 101 // This refers to the channel on the ADC chip being 100 - 106 (pin 0 -7)
+#define METRICS_FILE "/tmp/morse_paper_reader.prom" // Prometheus text file rewritten by the metrics writer
+#ifndef JSON_STREAM
+#define JSON_STREAM "unix:/tmp/morse_paper_reader.sock" // Where DAEMON_MODE publishes the JSON Lines records (unix:, fifo: or file:)
+#endif
+#ifndef PRINT_MEASURED_VOLTAGE
+#define PRINT_MEASURED_VOLTAGE (!REALTIME_PROFILE && !DAEMON_MODE) // Printing every value adds jitter, so it is off in the real-time profile
+#endif
 
 unsigned long previous_buttonInterrupt_time = 0;  // previous_buttonInterrupt_time 
 
 
-static volatile int Program_Mode = 3; 
-/*  The Reader has 3 possible operational modes:
-        Mode 0 - When '0' the program is to terminate
-        Mode 1 - When '1' the program is reading data
-        Mode 2 - When '2' the program is on standby
-    The varibale is set to 3 only in the beginning
+/*  The Reader's operational state (idle, arming, reading, draining, output or
+    shutdown) is kept in Reader_State.h and only changed with Reader_Transition()
 */
 
 // _________________________________________________
 //  Function Status Variables
 // _________________________________________________
-int Middle_Function_STATUS = 0;  // Is set to '1' when the function is completed
-int Dash_Dot_Space_Function_STATUS = 0; // Is set to '1' when the function is completed
-int Conversion_Function_STATUS = 0;  // Is set to '2' when the function is completed, '1' when running
-int Output_Function_STATUS = 0; // Is set to '1' when the function is completed
+atomic_int Middle_Function_STATUS = 0;  // Is set to '1' when the function is completed
+atomic_int Dash_Dot_Space_Function_STATUS = 0; // Is set to '1' when the function is completed, '2' while Auto_Calibration() runs
+atomic_int Conversion_Function_STATUS = 0;  // Is set to '2' when the function is completed, '1' when running
+atomic_int Output_Function_STATUS = 0; // Is set to '1' when the function is completed
 
 // _________________________________________________
 //  Memory Variables
 // _________________________________________________
-int input_CYCLES = 0; // This is the number of times that the Voltage Array has been filled and begun again from the beginning
+atomic_int input_CYCLES = 0; // This is the number of times that the Voltage Array has been filled and begun again from the beginning
 int analysed_CYCLES = 0; // This is the number of times the data in the Voltage Array has begun from the beginning again
 
 #define array_LENGTH 200 // This is the number of elements in the Voltage Array
-int array_Append_COUNT = 0; // This is the counter to count the appended voltages to the Voltage Array
+#define ring_LENGTH (3*array_LENGTH) // The Voltage Array is used as a ring of this many elements
+#define OVERRUN_HIGH_WATER ((3*ring_LENGTH)/4) // Unanalysed values above which OVERRUN_DECIMATE starts decimating
+#define AUTO_CALIBRATION_SAMPLES (ring_LENGTH/2) // Auto-calibration stops waiting for more runs after this many values
+atomic_int array_Append_COUNT = 0; // This is the counter to count the appended voltages to the Voltage Array
 int array_Analyse_COUNT = 0; // This is the counter to analyse the voltages in the Voltage Array
 int Final_Message_COUNT = 0; // This is the counter to reference the alphanumeric symbols in the Final_Message Array
 
-int Voltage_Values[2*array_LENGTH]; // This Array stores the measured voltage values
+int Voltage_Values[ring_LENGTH]; // This Array stores the measured voltage values
+unsigned long long Voltage_Times[ring_LENGTH]; // This Array stores the acquisition time (us) of each voltage value
+unsigned char Voltage_Weights[ring_LENGTH]; // This Array stores how many measured values each stored value stands for
+unsigned long long Analysed_Voltage_TIME = 0; // Acquisition time of the voltage value last popped by analyse_Array()
+int Analysed_Voltage_WEIGHT = 1; // Weight of the voltage value last popped by analyse_Array()
+int Decimate_PENDING = 0; // Measured values skipped since the last stored value (OVERRUN_DECIMATE)
+
+pthread_mutex_t Voltage_Array_LOCK = PTHREAD_MUTEX_INITIALIZER; // Guards the append and analyse counters
+pthread_cond_t Voltage_Array_CHANGED = PTHREAD_COND_INITIALIZER; // Signalled whenever a value is appended or analysed
 char Final_Message[4*array_LENGTH]; // This Array stores the converted alphanumeric symbols
 
 
@@ -68,11 +103,11 @@ char Final_Message[4*array_LENGTH]; // This Array stores the converted alphanume
 // _________________________________________________
 // The five variables below are used to analyse the voltage signal as defined by the respective names
 // set during analysing the calibrating pattern
-int BLACK_WHITE_Differentiator;
-int Initial_Dot_LENGTH = 0;
-int Initial_Dash_LENGTH = 0;
-int Initial_SmallSpace_LENGTH = 0;
-int Initial_BigSpace_LENGTH = 0;
+atomic_int BLACK_WHITE_Differentiator = 0;
+atomic_int Initial_Dot_LENGTH = 0;
+atomic_int Initial_Dash_LENGTH = 0;
+atomic_int Initial_SmallSpace_LENGTH = 0;
+atomic_int Initial_BigSpace_LENGTH = 0;
 
 
 
@@ -80,10 +115,7 @@ int Initial_BigSpace_LENGTH = 0;
 //  Thread Definitions
 // _________________________________________________
 pthread_t Voltage_Record_THREAD;  // Thread to fill array with voltage values
-pthread_t Voltage_Middle_THREAD;    // Thread to determine the difference between BLACK and WHITE
-pthread_t Voltage_Dash_Dot_THREAD; // Thread to analyse the Calibrating pattern
-pthread_t Voltage_Conversion_THREAD;  // Thread to convert voltages to alphanumeric symbols
-pthread_t Output_Message_THREAD;  // Thread to display the converted message
+pthread_t Decode_THREAD;  // Thread to calibrate, convert and display every message (see Decode_Loop)
 
 // MORSE CODE PATTERNS and ALPHANUMERIC ALPHABET
 
@@ -133,44 +165,244 @@ const char morseCode[37][8]= {{'0','0','0','0','0','0','0','.'} /* */,
 //  Voltage-Array Interface Definitions
 // _________________________________________________
 
+long long Voltage_Written_TOTAL(){
+    // Total number of values ever appended to the voltage array
+    return (long long)input_CYCLES * ring_LENGTH + array_Append_COUNT;
+}
+
+long long Voltage_Analysed_TOTAL(){
+    // Total number of values ever popped from the voltage array
+    return (long long)analysed_CYCLES * ring_LENGTH + array_Analyse_COUNT;
+}
+
+void Drop_Oldest_Voltages(){
+    // Discards the oldest unanalysed values and leaves a GAP_MARKER in their place
+    // so Conversion() knows the message was interrupted here (lock must be held)
+    long long dropped_FROM = Voltage_Analysed_TOTAL();
+    long long marker_POSITION = dropped_FROM + OVERRUN_DROP_CHUNK - 1;
+
+    analysed_CYCLES = (int)(marker_POSITION / ring_LENGTH);
+    array_Analyse_COUNT = (int)(marker_POSITION % ring_LENGTH);
+    Voltage_Values[array_Analyse_COUNT] = GAP_MARKER;
+    Voltage_Weights[array_Analyse_COUNT] = 0;
+
+    Overrun_Record(dropped_FROM, OVERRUN_DROP_CHUNK, 0);
+}
+
+void Message_Stop(){
+    // Ends reading: the termination symbol tells Conversion() the message is complete (button or AUTO_TRIGGER)
+    if (!Reader_Transition(READER_READING, READER_DRAINING) && !Reader_Transition(READER_ARMING, READER_DRAINING)){
+        return; // Already ended (by the button and the silence at once), or shutting down
+    }
+
+    pthread_mutex_lock(&Voltage_Array_LOCK);
+    if (Voltage_Written_TOTAL() - Voltage_Analysed_TOTAL() < ring_LENGTH){
+        // Only write into a free slot so no unanalysed value is overwritten
+        Voltage_Values[array_Append_COUNT % ring_LENGTH] = 0; // This is the termination symbol to signify the ending of the voltage input
+    }
+    pthread_cond_broadcast(&Voltage_Array_CHANGED); // Wakes Conversion() so it sees the end of the message
+    pthread_mutex_unlock(&Voltage_Array_LOCK);
+
+    if (!AUTO_TRIGGER){
+        // Deluminates the LED that aided the LDR (hands-free keeps it on for the next message)
+        digitalWrite(LED_PIN,LOW);
+    }
+}
+
+int Acquire_Voltage(unsigned long long *conversion_US){
+    // Filters 'decimation' conversions, each paced by the sample clock, into one stored value
+    // (IDLE_SAMPLING: only the first one while idle, unless it shows a transition)
+    int idle = Idle_Is_Idle();
+    *conversion_US = 0;
+    for (int conversion = 0; conversion < Reader_Session.decimation; conversion++){
+        Sample_Clock_Wait();
+        unsigned long long conversion_Start = Metrics_Now_US();
+        int value = Diversity_Read(ADC_CHANNEL);
+        Sample_Filter_Push(value);
+        *conversion_US += Metrics_Now_US() - conversion_Start;
+        if (idle && !Idle_Wakes(value)){
+            Idle_Hold(value, Reader_Session.decimation - 1 - conversion);
+            break;
+        }
+        idle = 0; // Awake: the rest of this value's conversions run at the full rate
+    }
+    int value = Sample_Filter_Output();
+    Idle_Push(value);
+    return value;
+}
+
 void *fill_Array(){
     // This function appends the measured voltage value to the voltage array
+    TRACE_SCOPE(TRACE_FILL_ARRAY);
     
    
         
-        int currentVoltage_Value = analogRead(ADC_CHANNEL);
-        printf("Measured Voltage: %d\n",currentVoltage_Value);
-        if (array_Append_COUNT < (3*array_LENGTH)){
+        unsigned long long conversion_US = 0;
+        int currentVoltage_Value = Acquire_Voltage(&conversion_US);
+        unsigned long long sample_TIME = Metrics_Now_US();
+        if (PRINT_MEASURED_VOLTAGE){
+            printf("Measured Voltage: %d\n",currentVoltage_Value);
+        }
+        Metrics_Count(&Reader_Metrics.samples_total, 1);
+        Capture_Append(currentVoltage_Value, 1); // Recorded before any overrun policy drops or decimates it
+        Flight_Record(currentVoltage_Value, Middle_Function_STATUS == 1 ? Calibration_Load(&BLACK_WHITE_Differentiator) : 0); // Flags the run boundaries the decoder sees
+
+        pthread_mutex_lock(&Voltage_Array_LOCK);
+        long long unanalysed = Voltage_Written_TOTAL() - Voltage_Analysed_TOTAL();
+
+        Decimate_PENDING += 1;
+        if (OVERRUN_POLICY == OVERRUN_DECIMATE && unanalysed >= OVERRUN_HIGH_WATER && Decimate_PENDING < OVERRUN_DECIMATE_FACTOR){
+            // Skip this value, its weight is carried by the next stored value
+            pthread_mutex_unlock(&Voltage_Array_LOCK);
+            return NULL;
+        }
+
+        if (unanalysed >= ring_LENGTH && OVERRUN_POLICY == OVERRUN_BLOCK){
+            // Wait for Conversion() to free a slot rather than overwrite unanalysed values
+            unsigned long long stall_START = Metrics_Now_US();
+            while (unanalysed >= ring_LENGTH && Reader_Reading()){
+                Overrun_Timed_Wait(&Voltage_Array_CHANGED, &Voltage_Array_LOCK, 1000);
+                unanalysed = Voltage_Written_TOTAL() - Voltage_Analysed_TOTAL();
+            }
+            Overrun_Record(Voltage_Written_TOTAL(), 0, Metrics_Now_US() - stall_START);
+            if (unanalysed >= ring_LENGTH){
+                // Reading stopped while blocked, the value is no longer needed
+                pthread_mutex_unlock(&Voltage_Array_LOCK);
+                return NULL;
+            }
+        } else if (unanalysed >= ring_LENGTH){
+            Drop_Oldest_Voltages();
+        }
+
+        if (array_Append_COUNT < ring_LENGTH){
             // While array is not yet full
             Voltage_Values[array_Append_COUNT] = currentVoltage_Value;
+            Voltage_Times[array_Append_COUNT] = sample_TIME;
+            Voltage_Weights[array_Append_COUNT] = Decimate_PENDING;
             array_Append_COUNT += 1;
         } else {
             // When array is fulled up cycle back
             array_Append_COUNT = 0;
             Voltage_Values[array_Append_COUNT] = currentVoltage_Value;
+            Voltage_Times[array_Append_COUNT] = sample_TIME;
+            Voltage_Weights[array_Append_COUNT] = Decimate_PENDING;
             input_CYCLES += 1;
             array_Append_COUNT += 1;
         }
+        Decimate_PENDING = 0;
+        pthread_cond_broadcast(&Voltage_Array_CHANGED);
+        pthread_mutex_unlock(&Voltage_Array_LOCK);
+
+        Metrics_Observe(HIST_ACQUISITION, conversion_US + (Metrics_Now_US() - sample_TIME));
+
+        if (AUTO_TRIGGER && Trigger_Silence_Push(currentVoltage_Value)){
+            printf("Silence: the message has ended\n");
+            Message_Stop(); // Same as the second button press
+        }
     
-    pthread_exit(NULL); 
+    return NULL; 
+}
+
+Jitter_Stats Acquisition_Jitter; // Sampling period statistics of the current message
+unsigned long long Message_Start_TIME = 0; // Time (us) reading of the current message started
+
+void Trigger_Watch(){
+    // Samples one standby value into the pre-trigger ring and starts reading once it confirms a message (AUTO_TRIGGER)
+    if (Trigger_Watch_Start()){
+        Sample_Clock_Reset(); // Standby sampling just (re)started
+        Sample_Filter_Reset();
+        Idle_Reset();
+    }
+    unsigned long long conversion_US = 0;
+    int value = Acquire_Voltage(&conversion_US);
+    if (!Trigger_Watch_Push(value, Metrics_Now_US())){
+        return;
+    }
+
+    pthread_mutex_lock(&Voltage_Array_LOCK);
+    array_Append_COUNT = Trigger_Drain(Voltage_Values, Voltage_Times, Voltage_Weights); // The message starts with the pre-trigger values
+    for (int count = 0; count < array_Append_COUNT; count++){
+        Capture_Append(Voltage_Values[count], 1);
+    }
+    Reader_Transition(READER_IDLE, READER_ARMING); // Acquisition_Loop() restarts the sample clock and reads
+    pthread_cond_broadcast(&Voltage_Array_CHANGED);
+    pthread_mutex_unlock(&Voltage_Array_LOCK);
+    printf("Activity: reading started\n");
+}
+
+void *Acquisition_Loop(){
+    // This is the persistent acquisition thread: it samples while in Read-Mode and idles otherwise
+    Realtime_Enter_Acquisition();
+    Trace_Thread_Name("acquisition");
+
+    long long previous_Sample_TIME = 0;
+    while (Reader_Running()){
+        Reader_State state = Reader_Get();
+        if (state == READER_ARMING){
+            // A message was just started: restart the sample schedule, then read
+            Sample_Clock_Reset();
+            Message_Start_TIME = Metrics_Now_US();
+            Sample_Filter_Reset();
+            Trigger_Message_Reset();
+            Idle_Reset();
+            previous_Sample_TIME = 0;
+            Reader_Transition(READER_ARMING, READER_READING);
+        } else if (state == READER_READING){
+            long long sample_Start = Realtime_Now_NS();
+            if (previous_Sample_TIME != 0){
+                Jitter_Add(&Acquisition_Jitter, sample_Start - previous_Sample_TIME);
+            }
+            previous_Sample_TIME = sample_Start;
+            fill_Array();
+        } else {
+            if (previous_Sample_TIME != 0){
+                Capture_Message_End(); // Reading just stopped: marks the end of the message in the capture
+                Flight_Message_End();
+            }
+            previous_Sample_TIME = 0;
+            if (AUTO_TRIGGER && state == READER_IDLE){
+                Trigger_Watch(); // Hands-free: keeps sampling until a message starts
+            } else {
+                Clock_Sleep_US(Idle_Poll_US());
+            }
+        }
+    }
+    return NULL;
 }
 
 int analyse_Array(){
     // This function pops the measured voltage values to be analysed.
 
     int popped_VOLTAGE;
-    if (array_Analyse_COUNT < (3*array_LENGTH)){
+    pthread_mutex_lock(&Voltage_Array_LOCK);
+    while (Voltage_Analysed_TOTAL() >= Voltage_Written_TOTAL()){
+        // Caught up with fill_Array(): wait for new values while reading, otherwise the message has ended
+        if (!Reader_Reading()){
+            pthread_mutex_unlock(&Voltage_Array_LOCK);
+            return 0;
+        }
+        Overrun_Timed_Wait(&Voltage_Array_CHANGED, &Voltage_Array_LOCK, 1000);
+    }
+
+    if (array_Analyse_COUNT < ring_LENGTH){
         // While array is not yet full
         popped_VOLTAGE = Voltage_Values[array_Analyse_COUNT];
+        Analysed_Voltage_TIME = Voltage_Times[array_Analyse_COUNT];
+        Analysed_Voltage_WEIGHT = Voltage_Weights[array_Analyse_COUNT];
         array_Analyse_COUNT += 1;
     } else {
         // When array is fulled up cycle back
         array_Analyse_COUNT = 0;
         analysed_CYCLES += 1;
         popped_VOLTAGE = Voltage_Values[array_Analyse_COUNT];
+        Analysed_Voltage_TIME = Voltage_Times[array_Analyse_COUNT];
+        Analysed_Voltage_WEIGHT = Voltage_Weights[array_Analyse_COUNT];
         array_Analyse_COUNT += 1;
         
     }
+    pthread_cond_broadcast(&Voltage_Array_CHANGED);
+    pthread_mutex_unlock(&Voltage_Array_LOCK);
+    Metrics_Count(&Reader_Metrics.analysed_total, 1);
     return popped_VOLTAGE;
 }
 
@@ -180,29 +412,26 @@ int analyse_Array(){
 // _________________________________________________
 void buttonInterrupt(){
     // This function handles the actions when the button is pressed
-     unsigned long buttonInterrupt_time = millis();
+     unsigned long buttonInterrupt_time = Clock_Millis();
      // Debounce condition to prevent double presses
      if (buttonInterrupt_time - previous_buttonInterrupt_time > 900) {
 
-        if (Program_Mode == 2  || Program_Mode == 3) {
-
+        Reader_State state = Reader_Get();
+        if (state == READER_DRAINING || state == READER_OUTPUT) {
+            // The previous message is still being converted, so the press is ignored
+            printf("Still converting the previous message, press again once it is shown\n");
+        } else if (state == READER_IDLE) {
             // The next line sets and illuminate the LED to aid the LDR     
             digitalWrite(LED_PIN,HIGH); 
             
-            // When pressed initially, sets the program to read mode
-            Program_Mode = 1; 
+            // When pressed initially, starts a message (Acquisition_Loop() arms and reads)
+            Reader_Transition(READER_IDLE, READER_ARMING);
             
         } else{
 
             // When pressed again, sets the program to standby mode
-            Program_Mode = 2;
             //pthread_join(Voltage_Record_THREAD,NULL);
-
-            Voltage_Values[array_Append_COUNT] = 0; // This is the termination symbol to signify the ending of the voltage input
-            
-
-            // Deluminates the LED that aided the LDR
-            digitalWrite(LED_PIN,LOW);
+            Message_Stop();
             
         }
       }
@@ -219,15 +448,11 @@ void enableADC(){
 }
 
 
-void Termination_Handler() {
-     // This is the ctrl-c/ctrl-z interrupt handler that sets all pins low again 
-     // upon termination
-
-    Program_Mode = 0; // Sets the program to termination mode
-
-    digitalWrite(LED_PIN,LOW); // Sets the LED pin low
-    printf("Morse Code Decipher TERMINATED\n");
-    exit(0);
+void Termination_Handler(int signal_Number) {
+     // This is the ctrl-z interrupt handler: it only requests the termination,
+     // main() sets the pin low again (nothing else is async-signal-safe here)
+    (void)signal_Number;
+    Reader_Request_Shutdown();
 }
 
 void *Middle_Voltage(){
@@ -237,6 +462,8 @@ void *Middle_Voltage(){
 
     The function only analyses the inital voltage values
     */
+    TRACE_SCOPE(TRACE_MIDDLE_VOLTAGE);
+    unsigned long long stage_START = Metrics_Now_US();
     int highest = 0;
     int lowest = 1000;
     int count = 0; // temp array count variable
@@ -246,7 +473,7 @@ void *Middle_Voltage(){
         while (count < array_LENGTH) {
             if (Voltage_Values[count] > highest){
                 highest = Voltage_Values[count] ;
-            } else if (Voltage_Values[count] < lowest){
+            } else if (Voltage_Values[count] < lowest && Voltage_Values[count] != GAP_MARKER){
                 lowest = Voltage_Values[count];
             }
             count += 1;
@@ -259,7 +486,7 @@ void *Middle_Voltage(){
         while (count <= array_Append_COUNT) {
             if (Voltage_Values[count] > highest){
                 highest = Voltage_Values[count] ;
-            } else if (Voltage_Values[count] < lowest && Voltage_Values[count] != 0){
+            } else if (Voltage_Values[count] < lowest && Voltage_Values[count] != 0 && Voltage_Values[count] != GAP_MARKER){
                 lowest = Voltage_Values[count];
             }
             count += 1;
@@ -268,9 +495,10 @@ void *Middle_Voltage(){
     
     
     // Then calculate Median to define difference between BLACK and WHITE data points
-    BLACK_WHITE_Differentiator = (highest + lowest) / 2;
+    Calibration_Store(&BLACK_WHITE_Differentiator, (highest + lowest) / 2);
+    Metrics_Observe(HIST_MIDDLE, Metrics_Now_US() - stage_START);
     Middle_Function_STATUS = 1; // Set function status to completed
-    pthread_exit(NULL); 
+    return NULL; 
 }
 
 
@@ -280,6 +508,8 @@ void *DashDot_AND_Space_Length(){
     // using the middle_Voltage() function to differentiate between BLACK and WHITE
 
     // This function only analyses the calibrating pattern at the beginning of the message
+    TRACE_SCOPE(TRACE_DASH_DOT);
+    unsigned long long stage_START = Metrics_Now_US();
 
     int current_Space_Count = 0;
     int current_Voltage_Count = 0;
@@ -289,56 +519,59 @@ void *DashDot_AND_Space_Length(){
     int while_CONDITION = 0;
     int Initial_Space_Ignore = 0;
      
-        while (while_CONDITION != 4) { 
+        while (while_CONDITION != 4 && count < ring_LENGTH) { // Stops at the end of the array if the pattern is incomplete
             int temp_Voltage = Voltage_Values[count];
 
-            if (temp_Voltage > BLACK_WHITE_Differentiator) { // FOR SOME REASON: BLACK = LOWER VALUES, WHITE = HIGHER VALUES
+            if (temp_Voltage > Calibration_Load(&BLACK_WHITE_Differentiator)) { // FOR SOME REASON: BLACK = LOWER VALUES, WHITE = HIGHER VALUES
                 // Found WHITE/SPACE
 
-                if (previous <= BLACK_WHITE_Differentiator && current_Voltage_Count != 0 && previous != 0){
+                if (previous <= Calibration_Load(&BLACK_WHITE_Differentiator) && current_Voltage_Count != 0 && previous != 0){
                 // Moved from BLACK to WHITE/SPACE 
+                    int edge_Correction = Edge_Correction(previous, temp_Voltage, Calibration_Load(&BLACK_WHITE_Differentiator), 1);
+                    current_Voltage_Count -= edge_Correction; // The BLACK part ended before this node
 
-                    if (Initial_Dot_LENGTH == 0 && Initial_Dash_LENGTH == 0) {
-                        Initial_Dash_LENGTH = current_Voltage_Count;
+                    if (Calibration_Load(&Initial_Dot_LENGTH) == 0 && Calibration_Load(&Initial_Dash_LENGTH) == 0) {
+                        Calibration_Store(&Initial_Dash_LENGTH, current_Voltage_Count);
                         while_CONDITION += 1;
                     } else {
-                        Initial_Dot_LENGTH = current_Voltage_Count;
+                        Calibration_Store(&Initial_Dot_LENGTH, current_Voltage_Count);
                         while_CONDITION += 1;
                     }
 
-                    current_Space_Count = 1; // include the current WHITE node
+                    current_Space_Count = EDGE_RUN_ONE + edge_Correction; // include the current WHITE node
                     current_Voltage_Count = 0; // reset BLACK part counter
 
                 } else {
                     // Still counting WHITE pattern
-                    current_Space_Count += 1; 
+                    current_Space_Count += EDGE_RUN_ONE; 
                 }
                 previous = temp_Voltage;
                 count += 1;
         
       
-            } else if (temp_Voltage <= BLACK_WHITE_Differentiator){
+            } else if (temp_Voltage <= Calibration_Load(&BLACK_WHITE_Differentiator)){
             // Found BLACK
 
 
-                if (previous > BLACK_WHITE_Differentiator && current_Space_Count != 0 && previous !=0){
+                if (previous > Calibration_Load(&BLACK_WHITE_Differentiator) && current_Space_Count != 0 && previous !=0){
                     // Moved from WHITE/SPACE to BLACK
-                   
-                    if (Initial_SmallSpace_LENGTH == 0 && Initial_BigSpace_LENGTH == 0 && Initial_Space_Ignore == 1) {
-                        Initial_SmallSpace_LENGTH = current_Space_Count;
+                    int edge_Correction = Edge_Correction(previous, temp_Voltage, Calibration_Load(&BLACK_WHITE_Differentiator), 1);
+                    current_Space_Count -= edge_Correction; // The WHITE part ended before this node
+                    if (Calibration_Load(&Initial_SmallSpace_LENGTH) == 0 && Calibration_Load(&Initial_BigSpace_LENGTH) == 0 && Initial_Space_Ignore == 1) {
+                        Calibration_Store(&Initial_SmallSpace_LENGTH, current_Space_Count);
                         while_CONDITION += 1;
                     } else if (Initial_Space_Ignore == 1) {
-                        Initial_BigSpace_LENGTH = current_Space_Count;
+                        Calibration_Store(&Initial_BigSpace_LENGTH, current_Space_Count);
                         while_CONDITION += 1;
                     }
 
                     Initial_Space_Ignore = 1;
-                    current_Voltage_Count = 1; // include the current BLACK node
+                    current_Voltage_Count = EDGE_RUN_ONE + edge_Correction; // include the current BLACK node
                     current_Space_Count = 0;
 
                 } else {
                     // Still counting BLACK pattern
-                    current_Voltage_Count += 1;
+                    current_Voltage_Count += EDGE_RUN_ONE;
                 }
 
                 previous = temp_Voltage;
@@ -347,9 +580,117 @@ void *DashDot_AND_Space_Length(){
         }
  
    
+    Metrics_Observe(HIST_DASH_DOT, Metrics_Now_US() - stage_START);
+    Trigger_Set_Unit(Calibration_Load(&Initial_SmallSpace_LENGTH) / EDGE_RUN_ONE); // Silence unit of the hands-free stop
     Dash_Dot_Space_Function_STATUS = 1; // Set function status to completed
     
-    pthread_exit(NULL); 
+    return NULL; 
+}
+
+
+void Calibration_Runs(int written, int *mark_Runs, int *mark_COUNT, int *space_Runs, int *space_COUNT){
+    // Splits the first 'written' voltage values into BLACK and WHITE run lengths
+    // The first run (begun before reading started) and the last run (still open) are left out
+    int previous_BLACK = -1;
+    int previous_VALUE = 0;
+    int run_LENGTH = 0;
+    int run_INDEX = 0;
+    *mark_COUNT = 0;
+    *space_COUNT = 0;
+
+    for (int count = 0; count < written; count++){
+        int value = Voltage_Values[count];
+        if (value <= 0){
+            break; // End of the message or a gap, the runs after it cannot be measured
+        }
+        int black = (value <= Calibration_Load(&BLACK_WHITE_Differentiator));
+
+        if (previous_BLACK != -1 && black != previous_BLACK){
+            // A run has ended
+            int edge_Correction = Edge_Correction(previous_VALUE, value, Calibration_Load(&BLACK_WHITE_Differentiator), Voltage_Weights[count]);
+            run_LENGTH -= edge_Correction; // It ended before this value
+            if (run_INDEX > 0 && previous_BLACK == 1 && *mark_COUNT < AUTO_CALIBRATION_RUNS){
+                mark_Runs[*mark_COUNT] = run_LENGTH;
+                *mark_COUNT += 1;
+            } else if (run_INDEX > 0 && previous_BLACK == 0 && *space_COUNT < AUTO_CALIBRATION_RUNS){
+                space_Runs[*space_COUNT] = run_LENGTH;
+                *space_COUNT += 1;
+            }
+            run_INDEX += 1;
+            run_LENGTH = edge_Correction;
+        }
+        previous_BLACK = black;
+        previous_VALUE = value;
+        run_LENGTH += Voltage_Weights[count] * EDGE_RUN_ONE;
+    }
+}
+
+
+void *Auto_Calibration(){
+    // This function replaces Middle_Voltage() and DashDot_AND_Space_Length() when AUTO_CALIBRATION is '1'
+    // It waits for the first AUTO_CALIBRATION_RUNS runs of the message itself and derives the
+    // BLACK/WHITE threshold and the dot, dash and space lengths from them (see Run_Calibration.h)
+    TRACE_SCOPE(TRACE_AUTO_CALIBRATION);
+    unsigned long long stage_START = Metrics_Now_US();
+
+    int mark_Runs[AUTO_CALIBRATION_RUNS];
+    int space_Runs[AUTO_CALIBRATION_RUNS];
+    int mark_COUNT = 0;
+    int space_COUNT = 0;
+
+    while (1){
+        pthread_mutex_lock(&Voltage_Array_LOCK);
+        int written = input_CYCLES > 0 ? ring_LENGTH : array_Append_COUNT;
+        int reading = Reader_Reading();
+        pthread_mutex_unlock(&Voltage_Array_LOCK);
+
+        // Threshold halfway between the highest and lowest value seen so far
+        int highest = 0;
+        int lowest = 1024;
+        for (int count = 0; count < written; count++){
+            if (Voltage_Values[count] > 0 && Voltage_Values[count] > highest){
+                highest = Voltage_Values[count];
+            }
+            if (Voltage_Values[count] > 0 && Voltage_Values[count] < lowest){
+                lowest = Voltage_Values[count];
+            }
+        }
+        Calibration_Store(&BLACK_WHITE_Differentiator, (highest + lowest) / 2);
+
+        mark_COUNT = 0;
+        space_COUNT = 0;
+        if (highest - lowest >= AUTO_CALIBRATION_CONTRAST){
+            // Only split into runs once both BLACK and WHITE have been seen
+            Calibration_Runs(written, mark_Runs, &mark_COUNT, space_Runs, &space_COUNT);
+        }
+
+        if (!reading || mark_COUNT + space_COUNT >= AUTO_CALIBRATION_RUNS || (written >= AUTO_CALIBRATION_SAMPLES && mark_COUNT > 0)){
+            break; // Enough runs, or the message ended / is about to overrun the array
+        }
+        Clock_Sleep_US(AUTO_CALIBRATION_POLL_MS * 1000);
+    }
+
+    Run_Lengths lengths;
+    if (Run_Calibrate(mark_Runs, mark_COUNT, space_Runs, space_COUNT, &lengths) == 0){
+        Calibration_Store(&Initial_Dot_LENGTH, lengths.dot);
+        Calibration_Store(&Initial_Dash_LENGTH, lengths.dash);
+        Calibration_Store(&Initial_SmallSpace_LENGTH, lengths.small_Space);
+        Calibration_Store(&Initial_BigSpace_LENGTH, lengths.big_Space);
+    } else {
+        // No marks at all: fall back to the shortest expected unit
+        printf("WARNING: auto-calibration found no marks\n");
+        Calibration_Store(&Initial_Dot_LENGTH, MIN_UNIT_SAMPLES*EDGE_RUN_ONE);
+        Calibration_Store(&Initial_Dash_LENGTH, 3*MIN_UNIT_SAMPLES*EDGE_RUN_ONE);
+        Calibration_Store(&Initial_SmallSpace_LENGTH, MIN_UNIT_SAMPLES*EDGE_RUN_ONE);
+        Calibration_Store(&Initial_BigSpace_LENGTH, 3*MIN_UNIT_SAMPLES*EDGE_RUN_ONE);
+    }
+    printf("Auto-calibrated from %d marks and %d spaces\n", mark_COUNT, space_COUNT);
+
+    Metrics_Observe(HIST_DASH_DOT, Metrics_Now_US() - stage_START);
+    Middle_Function_STATUS = 1;
+    Trigger_Set_Unit(Calibration_Load(&Initial_SmallSpace_LENGTH) / EDGE_RUN_ONE); // Silence unit of the hands-free stop
+    Dash_Dot_Space_Function_STATUS = 1; // Set function status to completed
+    return NULL;
 }
 
 
@@ -360,43 +701,61 @@ int Input_Speed_Adjuster(int Current_Length, int Message_Type){
     int New_length;
     if (Message_Type == 0){
         // Adjusting a BLACK part
-        int dot_Difference = abs(Initial_Dot_LENGTH - Current_Length);
-        int dash_Difference = abs(Initial_Dash_LENGTH - Current_Length);
+        int dot_Difference = abs(Calibration_Load(&Initial_Dot_LENGTH) - Current_Length);
+        int dash_Difference = abs(Calibration_Load(&Initial_Dash_LENGTH) - Current_Length);
         
         if (dot_Difference < dash_Difference){
-            New_length = Initial_Dot_LENGTH;
+            New_length = Calibration_Load(&Initial_Dot_LENGTH);
         } else{
-            New_length = Initial_Dash_LENGTH;
+            New_length = Calibration_Load(&Initial_Dash_LENGTH);
         }
 
     } else {
         // Adjusting a WHITE part
-        int small_Difference = abs(Initial_SmallSpace_LENGTH - Current_Length);
-        int Big_Difference = abs(Initial_BigSpace_LENGTH - Current_Length);
+        int small_Difference = abs(Calibration_Load(&Initial_SmallSpace_LENGTH) - Current_Length);
+        int Big_Difference = abs(Calibration_Load(&Initial_BigSpace_LENGTH) - Current_Length);
 
         if (small_Difference < Big_Difference){
-            New_length = Initial_SmallSpace_LENGTH;
+            New_length = Calibration_Load(&Initial_SmallSpace_LENGTH);
         } else{
-            New_length = Initial_BigSpace_LENGTH;
+            New_length = Calibration_Load(&Initial_BigSpace_LENGTH);
         }
 
     }
     return New_length;
 }
 
+void Publish_Character(const char *pattern, unsigned long long symbol_TIME, unsigned long long edge_TIME, unsigned long long emitted_TIME){
+    // Publishes the character just appended to Final_Message (the calibration pattern is left out like in Output())
+    int index = Final_Message_COUNT - 1;
+    int first = CALIBRATION_PREAMBLE ? 1 : 0;
+    if (index >= first){
+        Confidence_Char_Done(&Char_CONFIDENCE, Final_Message[index], index - first);
+        Json_Char(Final_Message[index], index - first, pattern, symbol_TIME, edge_TIME, emitted_TIME, &Char_CONFIDENCE);
+        Trace_Latency(edge_TIME, emitted_TIME);
+    }
+}
+
+
 void *Conversion(){
+    TRACE_SCOPE(TRACE_CONVERSION);
     printf("................................................\n");
     printf("Currently Converting:\n");
     Conversion_Function_STATUS = 1;
     
 
     printf("\n");
-    printf("Dot Length: %d\n",Initial_Dot_LENGTH);
-    printf("Dash Length: %d\n",Initial_Dash_LENGTH);
-    printf("Small Space Length: %d\n",Initial_SmallSpace_LENGTH);
-    printf("Large Space Length: %d\n",Initial_BigSpace_LENGTH);
-    printf("BLK/WHT Mid-Value: %d\n",BLACK_WHITE_Differentiator);
+    Edge_Print_Length("Dot Length", Calibration_Load(&Initial_Dot_LENGTH));
+    Edge_Print_Length("Dash Length", Calibration_Load(&Initial_Dash_LENGTH));
+    Edge_Print_Length("Small Space Length", Calibration_Load(&Initial_SmallSpace_LENGTH));
+    Edge_Print_Length("Large Space Length", Calibration_Load(&Initial_BigSpace_LENGTH));
+    printf("BLK/WHT Mid-Value: %d\n",Calibration_Load(&BLACK_WHITE_Differentiator));
     printf("\n");
+    if (CALIBRATION_PROFILE){
+        // Seeds the online refinement with the calibration used for this message
+        Profile_Capture(Calibration_Load(&BLACK_WHITE_Differentiator), Calibration_Load(&Initial_Dot_LENGTH), Calibration_Load(&Initial_Dash_LENGTH), Calibration_Load(&Initial_SmallSpace_LENGTH), Calibration_Load(&Initial_BigSpace_LENGTH));
+    }
+    Confidence_Reset(&Char_CONFIDENCE);
 
         int Conversion_Function_DashDot_Count = 0; // used to count the length of a dash or dot
         int Conversion_Function_Space_Count = 0;
@@ -406,58 +765,106 @@ void *Conversion(){
         int Conversion_Function_MorseCode_Current_COUNT = 0; // counter for the array
         
         int Conversion_Function_Previous_Voltage = 0;
+        unsigned long long Conversion_Function_Edge_TIME = 0; // Acquisition time of the last BLACK to WHITE edge
+        unsigned long long Conversion_Function_Symbol_TIME = 0; // Acquisition time of the first BLACK value of the current symbol
 
     
         // This means that the message has endend
         // Not possible to exceed the length of array
         int voltage_Value = analyse_Array();
         while (voltage_Value!=0) {
+
+        if (voltage_Value == GAP_MARKER){
+            // Values were dropped here: abandon the partial symbol and mark the gap in the message
+            Final_Message[Final_Message_COUNT] = GAP_SYMBOL;
+            Final_Message_COUNT += 1;
+            memset(Conversion_Function_MorseCode_Current, 0, 8);
+            Confidence_Reset(&Char_CONFIDENCE);
+            Conversion_Function_MorseCode_Current_COUNT = 0;
+            Conversion_Function_MorseCode_Current_CHECK = 0;
+            Conversion_Function_DashDot_Count = 0;
+            Conversion_Function_Space_Count = 0;
+            Conversion_Function_Previous_Voltage = 0;
+            voltage_Value = analyse_Array();
+            continue;
+        }
         
         
         
-        if ( voltage_Value > BLACK_WHITE_Differentiator){
+        if ( voltage_Value > Calibration_Load(&BLACK_WHITE_Differentiator)){
             // Found WHITE 
-            if (Conversion_Function_Previous_Voltage <= BLACK_WHITE_Differentiator && Conversion_Function_Previous_Voltage != 0){
+            if (Conversion_Function_Previous_Voltage <= Calibration_Load(&BLACK_WHITE_Differentiator) && Conversion_Function_Previous_Voltage != 0){
                 // Moved from BLACK to WHITE
-                printf("BLACK: %d\n",Conversion_Function_DashDot_Count);
+                int edge_Correction = Edge_Correction(Conversion_Function_Previous_Voltage, voltage_Value, Calibration_Load(&BLACK_WHITE_Differentiator), Analysed_Voltage_WEIGHT);
+                Conversion_Function_DashDot_Count -= edge_Correction; // The BLACK part ended before this value
+                Edge_Print_Length("BLACK", Conversion_Function_DashDot_Count);
+                Metrics_Count(&Reader_Metrics.runs_total, 1);
+                Conversion_Function_Edge_TIME = Analysed_Voltage_TIME;
 
+                int measured_Length = Conversion_Function_DashDot_Count; // Kept for the profile refinement
                 Conversion_Function_DashDot_Count = Input_Speed_Adjuster(Conversion_Function_DashDot_Count,0); // Invoke for BLACK
+                int dash_FOUND = (Conversion_Function_DashDot_Count == Calibration_Load(&Initial_Dash_LENGTH));
+                Confidence_Run(&Char_CONFIDENCE, dash_FOUND ? RUN_DASH : RUN_DOT, measured_Length,
+                               Conversion_Function_DashDot_Count, dash_FOUND ? Calibration_Load(&Initial_Dot_LENGTH) : Calibration_Load(&Initial_Dash_LENGTH));
 
 
                 // Analyse if the BLACK part is a dash or dot
-                if (Conversion_Function_DashDot_Count == Initial_Dash_LENGTH){
+                if (Conversion_Function_DashDot_Count == Calibration_Load(&Initial_Dash_LENGTH)){
                     
                     // Found a DASH
-                    Conversion_Function_MorseCode_Current[Conversion_Function_MorseCode_Current_COUNT] = '1'; // for a dash
-                    Conversion_Function_MorseCode_Current_COUNT += 1;
+                    if (Conversion_Function_MorseCode_Current_COUNT < 7){ // Longer patterns cannot match and would overflow the array
+                        Conversion_Function_MorseCode_Current[Conversion_Function_MorseCode_Current_COUNT] = '1'; // for a dash
+                        Conversion_Function_MorseCode_Current_COUNT += 1;
+                    }
                     Conversion_Function_MorseCode_Current_CHECK = 1;  // Ensures that the first white space is ignored
                 } else {
                     // Found a DOT
-                    Conversion_Function_MorseCode_Current[Conversion_Function_MorseCode_Current_COUNT] = '0'; // for a dot
-                    Conversion_Function_MorseCode_Current_COUNT += 1;
+                    if (Conversion_Function_MorseCode_Current_COUNT < 7){ // Longer patterns cannot match and would overflow the array
+                        Conversion_Function_MorseCode_Current[Conversion_Function_MorseCode_Current_COUNT] = '0'; // for a dot
+                        Conversion_Function_MorseCode_Current_COUNT += 1;
+                    }
                     Conversion_Function_MorseCode_Current_CHECK = 1;  // Ensures that the first white space is ignored
                 }
+                if (CALIBRATION_PROFILE){
+                    // Refine the length this run was classified as
+                    if (Conversion_Function_DashDot_Count == Calibration_Load(&Initial_Dash_LENGTH)){
+                        Calibration_Store(&Initial_Dash_LENGTH, Profile_Refine(&Reader_Profile.dash, measured_Length));
+                    } else {
+                        Calibration_Store(&Initial_Dot_LENGTH, Profile_Refine(&Reader_Profile.dot, measured_Length));
+                    }
+                }
                 Conversion_Function_DashDot_Count = 0;  // Reset BLACK part counter
-                Conversion_Function_Space_Count = 1; // Reset WHITE space count including current WHITE part
+                Conversion_Function_Space_Count = Analysed_Voltage_WEIGHT * EDGE_RUN_ONE + edge_Correction; // Reset WHITE space count including current WHITE part
             }
             else{
                 // Just counting WHITE
-                Conversion_Function_Space_Count += 1;
+                Conversion_Function_Space_Count += Analysed_Voltage_WEIGHT * EDGE_RUN_ONE;
             }
 
-        } else if ( voltage_Value <= BLACK_WHITE_Differentiator) { 
+        } else if ( voltage_Value <= Calibration_Load(&BLACK_WHITE_Differentiator)) { 
             // Found BLACK
-            if (Conversion_Function_Previous_Voltage > BLACK_WHITE_Differentiator && Conversion_Function_Previous_Voltage != 0){
+            if (Conversion_Function_Previous_Voltage > Calibration_Load(&BLACK_WHITE_Differentiator) && Conversion_Function_Previous_Voltage != 0){
                 // Moved from WHITE to BLACK
-                printf("White: %d\n", Conversion_Function_Space_Count);
+                int edge_Correction = Edge_Correction(Conversion_Function_Previous_Voltage, voltage_Value, Calibration_Load(&BLACK_WHITE_Differentiator), Analysed_Voltage_WEIGHT);
+                Conversion_Function_Space_Count -= edge_Correction; // The WHITE part ended before this value
+                Edge_Print_Length("White", Conversion_Function_Space_Count);
+                Metrics_Count(&Reader_Metrics.runs_total, 1);
 
 
 
+                int measured_Space = Conversion_Function_Space_Count; // Kept for the profile refinement
                 Conversion_Function_Space_Count= Input_Speed_Adjuster(Conversion_Function_Space_Count,1); // Invoke for WHITE
+                int big_SPACE = (Conversion_Function_Space_Count == Calibration_Load(&Initial_BigSpace_LENGTH));
+                if (Conversion_Function_MorseCode_Current_CHECK != 0){
+                    // The lead-in space is not part of a character
+                    Confidence_Run(&Char_CONFIDENCE, big_SPACE ? RUN_BIG_SPACE : RUN_SMALL_SPACE, measured_Space,
+                                   Conversion_Function_Space_Count, big_SPACE ? Calibration_Load(&Initial_SmallSpace_LENGTH) : Calibration_Load(&Initial_BigSpace_LENGTH));
+                }
 
                 // Analyse if the WHITE part is a short or long space
-                if (Conversion_Function_Space_Count == Initial_BigSpace_LENGTH && Conversion_Function_MorseCode_Current_CHECK != 0){
+                if (Conversion_Function_Space_Count == Calibration_Load(&Initial_BigSpace_LENGTH) && Conversion_Function_MorseCode_Current_CHECK != 0){
                     // Found a long space meaning end of a alphanumeric symbol
+                    unsigned long long lookup_START = Metrics_Now_US();
                     Conversion_Function_MorseCode_Current[Conversion_Function_MorseCode_Current_COUNT] = '.';
                     int stop = 0;
                     for (int i = 0; i<37 && stop == 0; i++){
@@ -485,20 +892,42 @@ void *Conversion(){
                         }
                     }
                     
+                    if (stop == 1){
+                        unsigned long long emitted_TIME = Metrics_Now_US();
+                        Metrics_Count(&Reader_Metrics.chars_total, 1);
+                        Metrics_Observe(HIST_CONVERSION_CHAR, emitted_TIME - lookup_START);
+                        Metrics_Observe(HIST_EDGE_TO_CHAR, emitted_TIME - Conversion_Function_Edge_TIME);
+                        Publish_Character(Conversion_Function_MorseCode_Current, Conversion_Function_Symbol_TIME, Conversion_Function_Edge_TIME, emitted_TIME);
+                    }
                     memset(Conversion_Function_MorseCode_Current, 0, 8); // Empties Array for the next BLACK pattern                    
+                    Confidence_Reset(&Char_CONFIDENCE); // The next character starts with a clean slate
                     Conversion_Function_MorseCode_Current_COUNT = 0; // reset temp array counter
                 }
+                if (CALIBRATION_PROFILE && Conversion_Function_MorseCode_Current_CHECK != 0){
+                    // Refine the length this space was classified as (the lead-in space is left out)
+                    if (big_SPACE){
+                        Calibration_Store(&Initial_BigSpace_LENGTH, Profile_Refine(&Reader_Profile.big_Space, measured_Space));
+                    } else {
+                        Calibration_Store(&Initial_SmallSpace_LENGTH, Profile_Refine(&Reader_Profile.small_Space, measured_Space));
+                    }
+                }
                 Conversion_Function_Space_Count = 0;  // Reset WHITE part counter
-                Conversion_Function_DashDot_Count = 1; // Reset BLACK space count including current BLACK part
+                Conversion_Function_DashDot_Count = Analysed_Voltage_WEIGHT * EDGE_RUN_ONE + edge_Correction; // Reset BLACK space count including current BLACK part
+                if (Conversion_Function_MorseCode_Current_COUNT == 0){
+                    Conversion_Function_Symbol_TIME = Analysed_Voltage_TIME; // First BLACK part of a new symbol
+                }
 
             }
             else{
                 // Just counting BLACK
-                Conversion_Function_DashDot_Count += 1;
+                Conversion_Function_DashDot_Count += Analysed_Voltage_WEIGHT * EDGE_RUN_ONE;
             }
         }
 
 
+        if (CALIBRATION_PROFILE){
+            Profile_Track_Level(voltage_Value, Calibration_Load(&BLACK_WHITE_Differentiator)); // Follows the BLACK and WHITE levels
+        }
         Conversion_Function_Previous_Voltage = voltage_Value;  // Save the current value for use later
         voltage_Value = analyse_Array();
     }
@@ -506,6 +935,7 @@ void *Conversion(){
 
 
     // Run the code below again to convert the last BLACK pattern
+    unsigned long long lookup_START = Metrics_Now_US();
     int stop = 0;
     Conversion_Function_MorseCode_Current[Conversion_Function_MorseCode_Current_COUNT] = '.';
     for (int i = 0; i<37 && stop == 0; i++){
@@ -533,20 +963,68 @@ void *Conversion(){
                        
         }
     }
+    if (stop == 1){
+        unsigned long long emitted_TIME = Metrics_Now_US();
+        Metrics_Count(&Reader_Metrics.chars_total, 1);
+        Metrics_Observe(HIST_CONVERSION_CHAR, emitted_TIME - lookup_START);
+        Metrics_Observe(HIST_EDGE_TO_CHAR, emitted_TIME - Conversion_Function_Edge_TIME);
+        Publish_Character(Conversion_Function_MorseCode_Current, Conversion_Function_Symbol_TIME, Conversion_Function_Edge_TIME, emitted_TIME);
+    }
     memset(Conversion_Function_MorseCode_Current, 0, 8); // Empties the array 
+    Confidence_Reset(&Char_CONFIDENCE);
     Conversion_Function_STATUS = 2;
-    pthread_exit(NULL); 
+    return NULL; 
 }
 
 
 
 
+void *Frame_Conversion(){
+    // Used instead of the calibration stages and Conversion() in FRAME_MODE: appends the payload of every accepted frame
+    TRACE_SCOPE(TRACE_CONVERSION);
+    Conversion_Function_STATUS = 1;
+    Frame_Reset();
+    int voltage_Value = analyse_Array();
+    while (1){
+        Frame_Event event;
+        if (voltage_Value == 0){
+            event = Frame_Finish(); // The message has ended
+        } else if (voltage_Value == GAP_MARKER){
+            event = Frame_Gap();
+        } else {
+            event = Frame_Push(voltage_Value, Analysed_Voltage_WEIGHT, Analysed_Voltage_TIME);
+        }
+        if (event == FRAME_LOCKED){
+            printf("Frame sync found\n");
+        } else if (event == FRAME_REJECTED){
+            printf("Frame rejected\n");
+        } else if (event == FRAME_ACCEPTED){
+            printf("Frame accepted: %s\n", Frame_STATE.payload);
+            for (int i = 0; Frame_STATE.payload[i] != '\0' && Final_Message_COUNT < (int)sizeof(Final_Message) - 1; i++){
+                Final_Message[Final_Message_COUNT++] = Frame_STATE.payload[i];
+            }
+            if (Final_Message_COUNT < (int)sizeof(Final_Message) - 1){
+                Final_Message[Final_Message_COUNT++] = ' '; // Frames are separated by a space
+            }
+        }
+        if (voltage_Value == 0){
+            break;
+        }
+        voltage_Value = analyse_Array();
+    }
+    Conversion_Function_STATUS = 2;
+    return NULL;
+}
+
+
 void *Output(){
     // This function prints the final message and symbols in the Message linked list
+    TRACE_SCOPE(TRACE_OUTPUT);
+    unsigned long long stage_START = Metrics_Now_US();
     printf("\nThe converted Morse Code Message is shown below: \n");
     printf("________________________________________________\n");
-    int count = 1; // Set to 1 to avoid the inital calibration pattern
-    while(count != Final_Message_COUNT){
+    int count = CALIBRATION_PREAMBLE ? 1 : 0; // Set to 1 to avoid the inital calibration pattern
+    while(count < Final_Message_COUNT){
 
         printf("%c",Final_Message[count]);
         count += 1;
@@ -554,8 +1032,117 @@ void *Output(){
     }
     printf("\n");
     printf("________________________________________________\n");
+    Overrun_Report(); // Reports any values lost while reading this message
+    Confidence_Report(); // Mean and lowest character confidence of this message
+    Frame_Report(); // Accepted and rejected frames and the time to lock (FRAME_MODE)
+    Diversity_Report(ADC_CHANNEL); // Contrast of every combined channel
+    Trace_Report(); // CPU and wall time per stage and the edge-to-character latency so far
+    Trace_Dump("paper", ADC_CHANNEL); // Chrome trace of the recent events
+    int skipped = CALIBRATION_PREAMBLE ? 1 : 0;
+    Json_Message(Final_Message + skipped, Final_Message_COUNT > skipped ? Final_Message_COUNT - skipped : 0, Message_Start_TIME, stage_START,
+                 Calibration_Load(&BLACK_WHITE_Differentiator), Calibration_Load(&Initial_Dot_LENGTH), Calibration_Load(&Initial_Dash_LENGTH), Calibration_Load(&Initial_SmallSpace_LENGTH), Calibration_Load(&Initial_BigSpace_LENGTH), &Acquisition_Jitter);
+    Jitter_Print("Sampling period:", &Acquisition_Jitter);
+    Idle_Print();
+    Jitter_Reset(&Acquisition_Jitter);
+    Metrics_Count(&Reader_Metrics.messages_total, 1);
+    if (CALIBRATION_PROFILE){
+        Profile_Save("paper", ADC_CHANNEL); // Keeps the refined calibration for the next session
+    }
+    Metrics_Observe(HIST_OUTPUT, Metrics_Now_US() - stage_START);
     Output_Function_STATUS = 1;
-    pthread_exit(NULL);
+    return NULL;
+}
+
+
+// _________________________________________________
+//  Session Functions
+// _________________________________________________
+
+void Reset_Message_State(){
+    // Returns every per-message variable to its initial value so the next message starts clean
+    // The buffers and threads are reused, nothing is allocated per message
+    TRACE_SCOPE(TRACE_RESET);
+    pthread_mutex_lock(&Voltage_Array_LOCK);
+    input_CYCLES = 0;
+    analysed_CYCLES = 0;
+    array_Append_COUNT = 0;
+    array_Analyse_COUNT = 0;
+    Analysed_Voltage_TIME = 0;
+    Analysed_Voltage_WEIGHT = 1;
+    Decimate_PENDING = 0;
+    memset(Voltage_Values, 0, sizeof(Voltage_Values));
+    memset(Voltage_Weights, 0, sizeof(Voltage_Weights));
+    pthread_mutex_unlock(&Voltage_Array_LOCK);
+
+    Final_Message_COUNT = 0;
+    memset(Final_Message, 0, sizeof(Final_Message));
+    Overrun_Reset();
+    Confidence_Message_Reset();
+
+    Middle_Function_STATUS = 0; // Withdrawn before the calibration values they publish
+    Dash_Dot_Space_Function_STATUS = 0;
+    Conversion_Function_STATUS = 0;
+    Output_Function_STATUS = 0;
+    Calibration_Store(&BLACK_WHITE_Differentiator, 0);
+    Calibration_Store(&Initial_Dot_LENGTH, 0);
+    Calibration_Store(&Initial_Dash_LENGTH, 0);
+    Calibration_Store(&Initial_SmallSpace_LENGTH, 0);
+    Calibration_Store(&Initial_BigSpace_LENGTH, 0);
+    Trigger_Set_Unit(0);
+
+    if (CALIBRATION_PROFILE && Reader_Profile.sessions > 0){
+        // Keep converting with the refined profile instead of recalibrating
+        Profile_Apply(&BLACK_WHITE_Differentiator, &Initial_Dot_LENGTH, &Initial_Dash_LENGTH, &Initial_SmallSpace_LENGTH, &Initial_BigSpace_LENGTH);
+        Trigger_Set_Unit(Calibration_Load(&Initial_SmallSpace_LENGTH) / EDGE_RUN_ONE);
+        Middle_Function_STATUS = 1;
+        Dash_Dot_Space_Function_STATUS = 1;
+    }
+    Reader_Transition(READER_OUTPUT, READER_IDLE); // The button may start the next message
+}
+
+
+void *Decode_Loop(){
+    /* This is the persistent decode thread. For every message it runs the stages in order:
+        calibration (Middle_Voltage and DashDot_AND_Space_Length, or Auto_Calibration)
+        -> Conversion -> Output -> Reset_Message_State
+    */
+    Realtime_Enter_Decode(); // Once for the whole session: keeps every stage off the acquisition core
+    Trace_Thread_Name("decode");
+    while (Reader_Running()){
+        if (Reader_Get() == READER_IDLE){
+            Clock_Sleep_US(Idle_Poll_US()); // Waiting for the button to start the next message
+            continue;
+        }
+
+        if (FRAME_MODE){
+            // Frames carry their own sync and unit, there is nothing to calibrate
+            Frame_Conversion(); // Returns once the message has ended
+            Reader_Transition(READER_DRAINING, READER_OUTPUT);
+            Output();
+            Reset_Message_State();
+            continue;
+        }
+
+        if (Dash_Dot_Space_Function_STATUS == 0){
+            if (AUTO_CALIBRATION){
+                Dash_Dot_Space_Function_STATUS = 2;
+                Auto_Calibration();
+            } else {
+                // Analyse the calibrating pattern once 'array_LENGTH' values are in or the message has ended
+                while (Reader_Reading() && array_Append_COUNT < array_LENGTH && input_CYCLES == 0){
+                    Clock_Sleep_US(1000);
+                }
+                Middle_Voltage();
+                DashDot_AND_Space_Length();
+            }
+        }
+
+        Conversion(); // Returns once the message has ended
+        Reader_Transition(READER_DRAINING, READER_OUTPUT);
+        Output();
+        Reset_Message_State();
+    }
+    return NULL;
 }
 
 
@@ -566,7 +1153,23 @@ void *Output(){
 //   Main Functions
 // _________________________________________________
 
-int main(){
+int main(int argc, char *argv[]){
+    if (argc >= 3 && strcmp(argv[1], "--decode") == 0){
+        // Offline mode: decodes a capture file on all cores without touching the hardware
+        return Offline_Decode_Main(argv[2], argc >= 4 ? atoi(argv[3]) : 0, symbol, morseCode, 37);
+    }
+    if (argc >= 4 && strcmp(argv[1], "--archive") == 0){
+        // Converts a capture file into a run-length archive for long-term storage
+        return Archive_Create_Main(argv[2], argv[3]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--decode-archive") == 0){
+        return Archive_Decode_Main(argv[2], symbol, morseCode, 37);
+    }
+    if (argc >= 4 && strcmp(argv[1], "--dump-flight") == 0){
+        // Converts a flight recorder file into a capture file for --decode
+        return Flight_Dump_File(argv[2], argv[3]);
+    }
+
     printf("________________________________________________\n");
     printf("            MORSE CODE DECIPHER\n");
     printf("________________________________________________\n");
@@ -585,69 +1188,68 @@ int main(){
     signal(SIGTSTP, Termination_Handler);   // This catches the termination ctrl-z in terminal
     //signal(SIGINT, Termination_Handler);    // This catches the termination ctrl-c in terminal
     enableADC();                            // Sets up the ADC 
+    Metrics_Start("paper", ADC_CHANNEL, METRICS_FILE); // Periodically writes the stage metrics
+    Json_Stream_Start("paper", ADC_CHANNEL, JSON_STREAM); // Publishes every character and message in DAEMON_MODE
     pinMode(LED_PIN,OUTPUT);                // Sets the LED pin on the Pi as a output pin
 
 
-    while(Program_Mode){ // While not in termination mode
-
-        /*
-            The function STATUS variables are used here to ensure that the functions 
-            only executed once and executed in the order that they are called
-        */
+    Realtime_Setup(); // Locks memory when the real-time profile is enabled
+    if (REALTIME_PROFILE){
+        Realtime_Prefault(Voltage_Values, sizeof(Voltage_Values));
+        Realtime_Prefault(Voltage_Times, sizeof(Voltage_Times));
+        Realtime_Prefault(Voltage_Weights, sizeof(Voltage_Weights));
+        Realtime_Prefault(Final_Message, sizeof(Final_Message));
+    }
+    if (CLOCK_SIMULATED){
+        // No LED to loop back: the simulated sensor keys SIM_TEXT (BLACK paper reads low)
+        Sim_Sensor_Setup(NULL, 0, 200, 800, symbol, morseCode, 37, CALIBRATION_PREAMBLE);
+    }
+    Diversity_Setup(analogRead, 1); // Reads ADC_CHANNEL alone, or combines DIVERSITY_CHANNELS channels from it
+    Frame_Setup(symbol, morseCode, 37, 1); // Character table and polarity of the frame decoder (FRAME_MODE)
+    Trigger_Setup(); // Prints the hands-free settings when AUTO_TRIGGER is on
+    if (AUTO_TRIGGER){
+        digitalWrite(LED_PIN,HIGH); // Hands-free: the LDR is lit all the time so a strip can arrive at any moment
+    }
+    Session_Start("paper", ADC_CHANNEL, Diversity_Read); // Probes the ADC and selects the sample rate
+    Sample_Filter_Setup(Reader_Session.adc_HZ, Reader_Session.decimation); // Sizes the filter for that rate
+    Idle_Setup(1);
+    Capture_Open("paper", ADC_CHANNEL, CAPTURE_FLAG_MARK_LOW | (CALIBRATION_PREAMBLE ? CAPTURE_FLAG_PREAMBLE : 0)); // Records every value when CAPTURE_RECORD is on
+    Flight_Recorder_Start("paper", ADC_CHANNEL, CAPTURE_FLAG_MARK_LOW | (CALIBRATION_PREAMBLE ? CAPTURE_FLAG_PREAMBLE : 0)); // Keeps the last minutes of signal when FLIGHT_RECORDER is on
+    if (CALIBRATION_PROFILE && Profile_Load("paper", ADC_CHANNEL) == 0){
+        // Warm start: convert with the cached calibration as soon as reading starts
+        Profile_Apply(&BLACK_WHITE_Differentiator, &Initial_Dot_LENGTH, &Initial_Dash_LENGTH, &Initial_SmallSpace_LENGTH, &Initial_BigSpace_LENGTH);
+        Trigger_Set_Unit(Calibration_Load(&Initial_SmallSpace_LENGTH) / EDGE_RUN_ONE);
+        Middle_Function_STATUS = 1;
+        Dash_Dot_Space_Function_STATUS = 1;
+    }
+    if (JITTER_REPORT){
+        Jitter_Report(Diversity_Read, ADC_CHANNEL); // Compares the sampling period with and without the profile
+    }
+    {
+        TRACE_SCOPE(TRACE_THREAD_CREATE); // Times the creation of both persistent threads
+        Clock_Thread_Create(&Voltage_Record_THREAD, Acquisition_Loop, NULL); // Records Voltage values while in Read-Mode
+        Clock_Thread_Create(&Decode_THREAD, Decode_Loop, NULL); // Calibrates, converts and displays every message
+    }
 
-        // Sets the button listener to call the interupt method when pressed
+    if (CLOCK_SIMULATED){
+        Sim_Session_Start(buttonInterrupt, Trigger_Silence_MS()); // Presses the button on the simulated clock instead
+    } else {
+        // Sets the button listener to call the interupt method when pressed (once, each call would add a listener)
         wiringPiISR(BUTTON_PIN, INT_EDGE_BOTH, &buttonInterrupt);  
-         
-        
-        if (Program_Mode == 1){  // This is Read-Mode
-
-            pthread_create(&Voltage_Record_THREAD, NULL, fill_Array, NULL);  // Records Voltage value
-            
-            if (array_Append_COUNT >= array_LENGTH && Middle_Function_STATUS == 0){
-                pthread_create(&Voltage_Middle_THREAD, NULL, Middle_Voltage, NULL);
-               // Calls the Middle Function thread
-            }
-
-            if (array_Append_COUNT >= array_LENGTH && Middle_Function_STATUS == 1 && Dash_Dot_Space_Function_STATUS == 0){
-                pthread_create(&Voltage_Dash_Dot_THREAD, NULL, DashDot_AND_Space_Length, NULL);
-               // Calls the Dash-Dot-Space Function thread
-            }
-            
-            
-            if (Conversion_Function_STATUS == 0 && Dash_Dot_Space_Function_STATUS == 1 ){
-                pthread_create(&Voltage_Conversion_THREAD, NULL, Conversion, NULL);
-               // Calls the Conversion Function thread
-            }
-            
-      
+    }
 
-        } else if (Program_Mode == 2){ // This is Stand-By mode
+    while(Reader_Running()){ // While not in termination mode
 
-            // Have to call the first 3 threads again incase the message is smaller then half the size of the array
-            
-            
-            if (Middle_Function_STATUS == 0){ 
-                pthread_create(&Voltage_Middle_THREAD, NULL, Middle_Voltage, NULL);
-                // Calls the Middle Function thread
-            }
-
-            if (Dash_Dot_Space_Function_STATUS == 0 && Middle_Function_STATUS == 1){
-                pthread_create(&Voltage_Dash_Dot_THREAD, NULL, DashDot_AND_Space_Length, NULL);
-                // Calls the Dash-Dot-Space Function thread
-            }
-            if (Conversion_Function_STATUS == 0 && Dash_Dot_Space_Function_STATUS == 1 ){
-                pthread_create(&Voltage_Conversion_THREAD, NULL, Conversion, NULL);
-                // Calls the Conversion Function thread
-            }
-             if (Output_Function_STATUS == 0 && Conversion_Function_STATUS == 2 ){
-                
-                pthread_create(&Output_Message_THREAD, NULL, Output, NULL);
-                // Calls the Output Function thread
-            }
-            
-        }
+        /*
+            Every button press pair is one message: the reader resets itself after each
+            message so one process handles any number of them
+        */
+        Clock_Sleep_US(Idle_Poll_US()); // Sampling runs in Acquisition_Loop() and the stages in Decode_Loop()
      
      }
-pthread_exit(NULL); // Terminates if any threads still open before exiting
+// Termination was requested: the other threads' loops end by themselves
+digitalWrite(LED_PIN,LOW); // Sets the LED pin low
+printf("Morse Code Decipher TERMINATED\n");
+exit(0);
 return 0;
 }
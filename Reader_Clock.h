@@ -0,0 +1,456 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Reader Clock (shared by both readers)
+// *****************************************************
+
+/*  Every time stamp, sleep and delay of the readers goes through this clock so
+    the whole pipeline (sender -> acquisition -> decode) can run on simulated
+    time. Two backends, selected with CLOCK_SIMULATED:
+
+    Real (default)
+        CLOCK_MONOTONIC, clock_nanosleep and the wiringPi hardware.
+
+    Simulated ('1')
+        A discrete-event clock. Threads started with Clock_Thread_Create() (and
+        any thread that sleeps on the clock) are participants. Only one
+        participant runs at a time: when the running one sleeps, the clock jumps
+        straight to the earliest deadline and wakes that participant (ties go to
+        the participant that joined first). Nothing ever waits on wall time, so
+        a 60 second message decodes in a fraction of a second and every run
+        produces the same output.
+
+        The hardware is replaced by a loopback sensor: analogRead() returns
+        the mark value while one of the loopback pins (the LED pins) is HIGH,
+        the space value otherwise, plus deterministic noise. Without loopback
+        pins (paper reader) SIM_TEXT is keyed at SIM_UNIT_MS per unit instead.
+        Sim_Session_Start() presses the button SIM_MESSAGES times and exits
+        once the last message has been output. A loopback message is read for
+        SIM_MESSAGE_MS, or longer when the reader passes the length of its
+        sender to Sim_Session_Window() (striped and framed messages). In
+        hands-free mode (AUTO_TRIGGER) it only presses to start the LED sender
+        and leaves the start and end of every message to the reader.
+
+    The simulated backend still links against wiringPi for the setup calls.
+*/
+
+#ifndef READER_CLOCK_H
+#define READER_CLOCK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// _________________________________________________
+//  Clock Configuration
+// _________________________________________________
+
+#ifndef CLOCK_SIMULATED
+#define CLOCK_SIMULATED 0 // Set to '1' to run on the simulated clock and loopback sensor
+#endif
+
+#ifndef SIM_MESSAGES
+#define SIM_MESSAGES 1 // Messages the simulated session reads before exiting
+#endif
+
+#ifndef SIM_START_MS
+#define SIM_START_MS 1500 // Simulated time before the first button press (must exceed the debounce time)
+#endif
+
+#ifndef SIM_MESSAGE_MS
+#define SIM_MESSAGE_MS 14000 // Shortest time a loopback message is read for (the LED 'TEST' message takes about 12.5 s)
+#endif
+
+#define SIM_WINDOW_TAIL_MS 1500 // Reading goes on this long after a sizing sender has finished (Sim_Session_Window())
+
+#ifndef SIM_GAP_MS
+#define SIM_GAP_MS 2000 // Pause after each message before the next press
+#endif
+
+#ifndef SIM_TEXT
+#define SIM_TEXT "PARIS" // Text keyed by the simulated sensor when there are no loopback pins
+#endif
+
+#ifndef SIM_UNIT_MS
+#define SIM_UNIT_MS 500 // Unit length of the keyed text
+#endif
+
+#ifndef SIM_NOISE
+#define SIM_NOISE 20 // Peak-to-peak noise added to every simulated conversion
+#endif
+
+#ifndef SIM_AMBIENT
+#define SIM_AMBIENT 0 // Peak ambient light added to the simulated sensor (a slow 4 s swell plus 100 Hz flicker)
+#endif
+
+#ifndef SIM_ADC_HZ
+#define SIM_ADC_HZ 20000 // Conversion rate the simulated ADC reports to the startup probe
+#endif
+
+#define CLOCK_MAX_PARTICIPANTS 16
+#define CLOCK_SIM_EPOCH_NS 1000000000LL // Simulated time starts at 1 s so no time stamp is ever 0
+#define CLOCK_SIM_UNIX_S 1767225600LL   // Unix time at the start of the simulated clock (2026-01-01 00:00 UTC), fixed so runs repeat
+#define SIM_MAX_PINS 8
+#define SIM_MAX_SEGMENTS 1024
+
+
+// _________________________________________________
+//  Simulated Clock State
+// _________________________________________________
+
+static long long Sim_NOW_NS = CLOCK_SIM_EPOCH_NS;
+static pthread_mutex_t Sim_Clock_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Sim_Clock_WAKE = PTHREAD_COND_INITIALIZER;
+static int Sim_Slot_USED[CLOCK_MAX_PARTICIPANTS];
+static int Sim_Slot_SLEEPING[CLOCK_MAX_PARTICIPANTS];
+static long long Sim_Slot_DEADLINE[CLOCK_MAX_PARTICIPANTS];
+static __thread int Clock_Slot = -1; // Participant slot of the calling thread
+
+static void Sim_Schedule_Locked(void){
+    // If every participant sleeps, jumps to the earliest deadline and wakes that participant (lock held)
+    int next = -1;
+    for (int slot = 0; slot < CLOCK_MAX_PARTICIPANTS; slot++){
+        if (!Sim_Slot_USED[slot]){
+            continue;
+        }
+        if (!Sim_Slot_SLEEPING[slot]){
+            return; // Someone is still running
+        }
+        if (next == -1 || Sim_Slot_DEADLINE[slot] < Sim_Slot_DEADLINE[next]){
+            next = slot;
+        }
+    }
+    if (next == -1){
+        return;
+    }
+    if (Sim_Slot_DEADLINE[next] > Sim_NOW_NS){
+        Sim_NOW_NS = Sim_Slot_DEADLINE[next];
+    }
+    Sim_Slot_SLEEPING[next] = 0;
+    pthread_cond_broadcast(&Sim_Clock_WAKE);
+}
+
+static int Sim_Reserve_Slot_Locked(void){
+    for (int slot = 0; slot < CLOCK_MAX_PARTICIPANTS; slot++){
+        if (!Sim_Slot_USED[slot]){
+            Sim_Slot_USED[slot] = 1;
+            Sim_Slot_SLEEPING[slot] = 0;
+            return slot;
+        }
+    }
+    fprintf(stderr, "Simulated clock: more than %d participants\n", CLOCK_MAX_PARTICIPANTS);
+    exit(1);
+}
+
+static void Clock_Leave(void){
+    // Removes the calling thread from the simulated clock (it no longer holds time back)
+    if (!CLOCK_SIMULATED || Clock_Slot < 0){
+        return;
+    }
+    pthread_mutex_lock(&Sim_Clock_LOCK);
+    Sim_Slot_USED[Clock_Slot] = 0;
+    Clock_Slot = -1;
+    Sim_Schedule_Locked();
+    pthread_mutex_unlock(&Sim_Clock_LOCK);
+}
+
+
+// _________________________________________________
+//  Clock Interface
+// _________________________________________________
+
+static inline long long Clock_Now_NS(void){
+    // Monotonic time in nanoseconds (simulated time in the simulated backend)
+    if (CLOCK_SIMULATED){
+        pthread_mutex_lock(&Sim_Clock_LOCK);
+        long long now = Sim_NOW_NS;
+        pthread_mutex_unlock(&Sim_Clock_LOCK);
+        return now;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static inline long long Clock_Unix_NS(long long monotonic_NS){
+    // Unix time of a Clock_Now_NS() time stamp (the simulated clock has its own fixed epoch)
+    if (CLOCK_SIMULATED){
+        return CLOCK_SIM_UNIX_S * 1000000000LL + (monotonic_NS - CLOCK_SIM_EPOCH_NS);
+    }
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    long long wall_NS = (long long)wall.tv_sec * 1000000000LL + wall.tv_nsec;
+    return wall_NS - (Clock_Now_NS() - monotonic_NS);
+}
+
+static inline unsigned long long Clock_Now_US(void){
+    return (unsigned long long)(Clock_Now_NS() / 1000LL);
+}
+
+static inline unsigned long Clock_Millis(void){
+    // Replaces wiringPi's millis() (only differences are used, e.g. for the button debounce)
+    return (unsigned long)(Clock_Now_NS() / 1000000LL);
+}
+
+static void Clock_Sleep_Until_NS(long long deadline_NS){
+    // Sleeps until the clock reaches deadline_NS
+    if (!CLOCK_SIMULATED){
+        struct timespec deadline;
+        deadline.tv_sec = deadline_NS / 1000000000LL;
+        deadline.tv_nsec = deadline_NS % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        return;
+    }
+    pthread_mutex_lock(&Sim_Clock_LOCK);
+    if (Clock_Slot < 0){
+        Clock_Slot = Sim_Reserve_Slot_Locked(); // First sleep joins the thread to the clock
+    }
+    Sim_Slot_DEADLINE[Clock_Slot] = deadline_NS;
+    Sim_Slot_SLEEPING[Clock_Slot] = 1;
+    Sim_Schedule_Locked();
+    while (Sim_Slot_SLEEPING[Clock_Slot]){
+        pthread_cond_wait(&Sim_Clock_WAKE, &Sim_Clock_LOCK);
+    }
+    pthread_mutex_unlock(&Sim_Clock_LOCK);
+}
+
+static void Clock_Sleep_US(long microseconds){
+    // Replaces usleep()
+    Clock_Sleep_Until_NS(Clock_Now_NS() + (long long)microseconds * 1000LL);
+}
+
+static void Clock_Delay(unsigned int milliseconds){
+    // Replaces wiringPi's delay()
+    Clock_Sleep_Until_NS(Clock_Now_NS() + (long long)milliseconds * 1000000LL);
+}
+
+typedef struct {
+    void *(*function)(void *);
+    void *argument;
+    int slot;
+} Clock_Thread_Start;
+
+static Clock_Thread_Start Clock_Thread_STARTS[CLOCK_MAX_PARTICIPANTS];
+
+static void Clock_Thread_Cleanup(void *unused){
+    (void)unused;
+    Clock_Leave();
+}
+
+static void *Clock_Thread_Trampoline(void *vargp){
+    Clock_Thread_Start *start = (Clock_Thread_Start *)vargp;
+    void *result;
+    Clock_Slot = start->slot;
+    pthread_cleanup_push(Clock_Thread_Cleanup, NULL); // Also runs when the thread calls pthread_exit()
+    result = start->function(start->argument);
+    pthread_cleanup_pop(1);
+    return result;
+}
+
+static int Clock_Thread_Create(pthread_t *thread, void *(*function)(void *), void *argument){
+    // Replaces pthread_create() for threads that take part in the simulated clock
+    if (!CLOCK_SIMULATED){
+        return pthread_create(thread, NULL, function, argument);
+    }
+    pthread_mutex_lock(&Sim_Clock_LOCK);
+    if (Clock_Slot < 0){
+        // The creating thread (main) joins as running too, so time cannot move on while it is still setting up
+        Clock_Slot = Sim_Reserve_Slot_Locked();
+    }
+    int slot = Sim_Reserve_Slot_Locked(); // Reserved as running so time cannot move on before the thread starts
+    Clock_Thread_STARTS[slot].function = function;
+    Clock_Thread_STARTS[slot].argument = argument;
+    Clock_Thread_STARTS[slot].slot = slot;
+    pthread_mutex_unlock(&Sim_Clock_LOCK);
+    return pthread_create(thread, NULL, Clock_Thread_Trampoline, &Clock_Thread_STARTS[slot]);
+}
+
+
+// _________________________________________________
+//  Simulated Sensor
+// _________________________________________________
+
+static int Sim_Loopback_PINS[SIM_MAX_PINS];
+static int Sim_Loopback_COUNT = 0;
+static int Sim_Lane_CHANNEL = -1; // When set, loopback pin i is only seen on ADC channel Sim_Lane_CHANNEL + i
+static int Sim_Mark_VALUE = 800;
+static int Sim_Space_VALUE = 200;
+
+static int Sim_Key_SEGMENTS[SIM_MAX_SEGMENTS]; // Keyed text in units: positive = mark, negative = space
+static int Sim_Key_COUNT = 0;
+static int Sim_Key_UNITS = 0;                  // Total length of the keyed text in units
+static long long Sim_Key_START_NS = -1;        // Simulated time the keying started (-1 = not keying)
+
+static void Sim_Key_Append(int units){
+    if (Sim_Key_COUNT < SIM_MAX_SEGMENTS){
+        Sim_Key_SEGMENTS[Sim_Key_COUNT] = units;
+        Sim_Key_COUNT += 1;
+        Sim_Key_UNITS += units > 0 ? units : -units;
+    }
+}
+
+static void Sim_Key_Pattern(const char *pattern){
+    // Appends one character pattern ('0' dot, '1' dash, '.' end) followed by a letter gap
+    for (int i = 0; i < 7 && pattern[i] != '.'; i++){
+        if (i > 0){
+            Sim_Key_Append(-1);
+        }
+        Sim_Key_Append(pattern[i] == '1' ? 3 : 1);
+    }
+    Sim_Key_Append(-3);
+}
+
+static void Sim_Sensor_Setup(const int *loopback_Pins, int pin_COUNT, int mark_Value, int space_Value,
+                             const char *symbols, const char patterns[][8], int symbol_COUNT, int preamble){
+    // Configures the loopback sensor, or keys SIM_TEXT with the given Morse table when there are no loopback pins
+    Sim_Loopback_COUNT = pin_COUNT < SIM_MAX_PINS ? pin_COUNT : SIM_MAX_PINS;
+    for (int i = 0; i < Sim_Loopback_COUNT; i++){
+        Sim_Loopback_PINS[i] = loopback_Pins[i];
+    }
+    Sim_Mark_VALUE = mark_Value;
+    Sim_Space_VALUE = space_Value;
+
+    Sim_Key_COUNT = 0;
+    Sim_Key_UNITS = 0;
+    Sim_Key_Append(-2); // Lead-in
+    if (preamble){
+        Sim_Key_Pattern("10."); // Calibration pattern: dash, dot
+    }
+    const char *text = SIM_TEXT;
+    for (int c = 0; text[c] != '\0'; c++){
+        if (text[c] == ' '){
+            Sim_Key_Append(-4); // Word gap = letter gap + 4 units
+            continue;
+        }
+        for (int s = 1; s < symbol_COUNT; s++){
+            if (symbols[s] == text[c]){
+                Sim_Key_Pattern(patterns[s]);
+                break;
+            }
+        }
+    }
+}
+
+static inline void Sim_Sensor_Lanes(int first_Channel){
+    // Gives every loopback pin its own ADC channel (first_Channel + i) instead of one shared sensor
+    Sim_Lane_CHANNEL = first_Channel;
+}
+
+#if CLOCK_SIMULATED
+static int Sim_Pin_STATE[64];
+static unsigned int Sim_Noise_SEED = 12345;
+
+static int Sim_Mark_Active(int channel){
+    if (Sim_Loopback_COUNT > 0){
+        for (int i = 0; i < Sim_Loopback_COUNT; i++){
+            if (Sim_Lane_CHANNEL >= 0 && channel != Sim_Lane_CHANNEL + i){
+                continue; // Every LDR sees only its own LED
+            }
+            if (Sim_Pin_STATE[Sim_Loopback_PINS[i] & 63]){
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (Sim_Key_START_NS < 0){
+        return 0;
+    }
+    long long unit = (Clock_Now_NS() - Sim_Key_START_NS) / ((long long)SIM_UNIT_MS * 1000000LL);
+    for (int i = 0; i < Sim_Key_COUNT; i++){
+        int length = Sim_Key_SEGMENTS[i] > 0 ? Sim_Key_SEGMENTS[i] : -Sim_Key_SEGMENTS[i];
+        if (unit < length){
+            return Sim_Key_SEGMENTS[i] > 0;
+        }
+        unit -= length;
+    }
+    return 0;
+}
+
+static int Sim_Analog_Read(int channel){
+    // Loopback replacement for analogRead()
+    Sim_Noise_SEED = Sim_Noise_SEED * 1103515245u + 12345u; // Fixed LCG so every run is identical
+    int noise = SIM_NOISE > 0 ? (int)((Sim_Noise_SEED >> 16) % SIM_NOISE) : 0;
+    int value = (Sim_Mark_Active(channel) ? Sim_Mark_VALUE : Sim_Space_VALUE) + noise;
+    if (SIM_AMBIENT > 0){
+        // Triangle waves keep it integer: the swell spans SIM_AMBIENT, the flicker a quarter of it
+        long long now_US = Clock_Now_NS() / 1000;
+        long long swell = now_US % 4000000;
+        long long flicker = now_US % 10000;
+        swell = swell < 2000000 ? swell : 4000000 - swell;
+        flicker = flicker < 5000 ? flicker : 10000 - flicker;
+        value += (int)(swell * SIM_AMBIENT / 2000000 + flicker * (SIM_AMBIENT / 4) / 5000);
+        value = value > 1023 ? 1023 : value; // The ADC saturates
+    }
+    return value;
+}
+
+static void Sim_Digital_Write(int pin, int value){
+    // Loopback replacement for digitalWrite()
+    Sim_Pin_STATE[pin & 63] = value;
+}
+
+// Route the sensor and LED calls of the readers to the loopback sensor
+#define analogRead Sim_Analog_Read
+#define digitalWrite Sim_Digital_Write
+#endif
+
+
+// _________________________________________________
+//  Simulated Session
+// _________________________________________________
+
+static void (*Sim_Button_PRESS)(void);
+static pthread_t Sim_Session_THREAD;
+static int Sim_Hands_Free_MS = 0; // Time the reader takes to end a message by itself, 0 when the button ends it
+static int Sim_Message_MS = SIM_MESSAGE_MS; // Read window of a loopback message
+
+static inline void Sim_Session_Window(int sender_MS){
+    // Reads loopback messages until SIM_WINDOW_TAIL_MS after a sender that keys for sender_MS has finished
+    if (sender_MS + SIM_WINDOW_TAIL_MS > Sim_Message_MS){
+        Sim_Message_MS = sender_MS + SIM_WINDOW_TAIL_MS;
+    }
+}
+
+static void *Sim_Session_Driver(void *vargp){
+    // Presses the button for SIM_MESSAGES messages, then ends the process
+    (void)vargp;
+    for (int message = 0; message < SIM_MESSAGES; message++){
+        Clock_Delay(message == 0 ? SIM_START_MS : SIM_GAP_MS);
+        if (Sim_Hands_Free_MS == 0 || Sim_Loopback_COUNT > 0){
+            Sim_Button_PRESS(); // Start reading (hands-free: the LED reader's press only starts its sender)
+        }
+        if (Sim_Loopback_COUNT == 0){
+            Sim_Key_START_NS = Clock_Now_NS();
+            Clock_Delay((unsigned int)((Sim_Key_UNITS + 3) * SIM_UNIT_MS));
+            Sim_Key_START_NS = -1;
+        } else {
+            Clock_Delay((unsigned int)Sim_Message_MS);
+        }
+        if (Sim_Hands_Free_MS == 0){
+            Sim_Button_PRESS(); // Stop reading
+        } else {
+            Clock_Delay((unsigned int)Sim_Hands_Free_MS); // The reader ends the message after the silence
+        }
+    }
+    Clock_Delay(SIM_GAP_MS);
+    printf("Simulation finished after %.3f s of simulated time\n", (double)(Clock_Now_NS() - CLOCK_SIM_EPOCH_NS) / 1e9);
+    fflush(stdout);
+    exit(0);
+    return NULL;
+}
+
+static void Sim_Session_Start(void (*press)(void), int hands_Free_MS){
+    // Starts the simulated button presses (does nothing on the real clock)
+    // With hands_Free_MS the reader starts and ends messages itself and only the LED sender is started by a press
+    if (!CLOCK_SIMULATED){
+        return;
+    }
+    Sim_Button_PRESS = press;
+    Sim_Hands_Free_MS = hands_Free_MS;
+    Clock_Thread_Create(&Sim_Session_THREAD, Sim_Session_Driver, NULL);
+}
+
+#endif
@@ -0,0 +1,129 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Reader State Machine (shared by both readers)
+// *****************************************************
+
+/*  The button interrupt, the acquisition and decode threads, the silence
+    detector and main() all start and stop messages. Before, they did it
+    through two volatile ints (Program_Mode and Message_IN_PROGRESS). Two
+    writers could both act on the same press or silence, and nothing ordered
+    the writes around them. The reader now has a single atomic state, and it
+    only changes along these edges:
+
+        IDLE --> ARMING --> READING --> DRAINING --> OUTPUT --> IDLE
+                    |                      ^
+                    +----------------------+       any state --> SHUTDOWN
+
+        IDLE      waiting for the button (or, with AUTO_TRIGGER, watching)
+        ARMING    a message was started; the acquisition thread restarts its
+                  sample clock and filters and then moves on to READING
+        READING   values are sampled into the voltage array
+        DRAINING  sampling has stopped, the decoder converts what is left
+        OUTPUT    the message is shown and every per-message state is reset
+        SHUTDOWN  Ctrl-Z: every loop ends and main() cleans up
+
+    Reader_Transition() changes the state with a compare-and-swap. Only one
+    thread can win a transition. For example, when the button and the silence
+    detector end a message at the same time, only one of them writes the
+    termination symbol. An edge that is not in the table is refused.
+
+    All accesses are sequentially consistent C11 atomics. The stage status
+    flags (*_Function_STATUS) and the voltage array counters that are read
+    without the lock are atomic_int for the same reason.
+
+    The calibration values (BLACK_WHITE_Differentiator and the Initial_*_LENGTH
+    values) are atomic_int too. The decode thread keeps refining the lengths
+    while reading, and other threads read them at the same time. They are
+    read and written with Calibration_Load() and Calibration_Store(). These
+    are relaxed, so the hot loops compile to plain loads. The status flag
+    stored after the values still publishes them as a set. A thread that sees
+    the flag set sees at least those values, and later refinements arrive
+    one value at a time.
+
+    Termination_Handler() only stores SHUTDOWN. A store to a lock-free atomic
+    is async-signal-safe; printf(), digitalWrite(), exit() and pthread_exit()
+    are not. main() notices the state, switches the LEDs off and exits.
+*/
+
+#ifndef READER_STATE_H
+#define READER_STATE_H
+
+#include <stdatomic.h>
+
+
+// _________________________________________________
+//  States
+// _________________________________________________
+
+typedef enum {
+    READER_SHUTDOWN = 0,
+    READER_IDLE,
+    READER_ARMING,
+    READER_READING,
+    READER_DRAINING,
+    READER_OUTPUT,
+    READER_STATE_COUNT
+} Reader_State;
+
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2, "the signal handler needs a lock-free atomic int");
+
+static atomic_int Reader_STATE = READER_IDLE;
+
+static const unsigned char Reader_EDGES[READER_STATE_COUNT] = {
+    // Bit 'to' is set when the transition from the row's state to 'to' is allowed
+    [READER_SHUTDOWN] = 0,
+    [READER_IDLE]     = 1 << READER_ARMING,
+    [READER_ARMING]   = 1 << READER_READING | 1 << READER_DRAINING,
+    [READER_READING]  = 1 << READER_DRAINING,
+    [READER_DRAINING] = 1 << READER_OUTPUT,
+    [READER_OUTPUT]   = 1 << READER_IDLE,
+};
+
+
+// _________________________________________________
+//  State Functions
+// _________________________________________________
+
+static inline Reader_State Reader_Get(void){
+    return (Reader_State)atomic_load(&Reader_STATE);
+}
+
+static inline int Reader_Running(void){
+    // '0' once the reader is shutting down
+    return Reader_Get() != READER_SHUTDOWN;
+}
+
+static inline int Reader_Reading(void){
+    // '1' while a message is being sampled (including the restart of the acquisition)
+    Reader_State state = Reader_Get();
+    return state == READER_ARMING || state == READER_READING;
+}
+
+static int Reader_Transition(Reader_State from, Reader_State to){
+    // Moves from 'from' to 'to', returns '0' when the state was not 'from' (another thread got there first) or the edge is not allowed
+    if (!(Reader_EDGES[from] & (1 << to))){
+        return 0;
+    }
+    int expected = from;
+    return atomic_compare_exchange_strong(&Reader_STATE, &expected, to);
+}
+
+static inline void Reader_Request_Shutdown(void){
+    // Async-signal-safe: the only thing Termination_Handler() does
+    atomic_store(&Reader_STATE, READER_SHUTDOWN);
+}
+
+
+// _________________________________________________
+//  Calibration Values
+// _________________________________________________
+
+static inline int Calibration_Load(atomic_int *value){
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static inline void Calibration_Store(atomic_int *value, int new_Value){
+    atomic_store_explicit(value, new_Value, memory_order_relaxed);
+}
+
+#endif
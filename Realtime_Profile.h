@@ -0,0 +1,254 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Real-Time Scheduling Profile (shared by both readers)
+// *****************************************************
+
+/*  Opt-in real-time profile for the sampling thread. Jitter in the sampling
+    period directly changes the dot/dash counts, so when REALTIME_PROFILE is
+    '1' the reader:
+        -- runs the acquisition thread under SCHED_FIFO at REALTIME_PRIORITY
+        -- pins the acquisition thread to REALTIME_CORE (best isolated with the
+           'isolcpus=' kernel parameter)
+        -- pins the decode thread and the helper threads (metrics, JSON and
+           flight recorder writers, offline workers) to the remaining cores
+        -- locks all memory with mlockall() and prefaults the stack and buffers
+
+    The affinity calls need _GNU_SOURCE to be defined before the first system
+    header is included (both readers do this at the top of the file).
+
+    The scheduling calls need root (or CAP_SYS_NICE / CAP_IPC_LOCK). When they
+    fail a warning is printed and the reader continues with normal scheduling.
+
+    With JITTER_REPORT set to '1' the reader measures the sampling period at
+    startup once with normal scheduling and once with the profile applied and
+    prints both so the effect can be compared on the actual Pi.
+*/
+
+#ifndef REALTIME_PROFILE_H
+#define REALTIME_PROFILE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "Reader_Clock.h"
+
+
+// _________________________________________________
+//  Real-Time Configuration
+// _________________________________________________
+
+#ifndef REALTIME_PROFILE
+#define REALTIME_PROFILE 0 // Set to '1' to enable the real-time profile for the sampling thread
+#endif
+
+#ifndef REALTIME_PRIORITY
+#define REALTIME_PRIORITY 80 // SCHED_FIFO priority of the acquisition thread (1 - 99)
+#endif
+
+#ifndef REALTIME_CORE
+#define REALTIME_CORE 3 // CPU core reserved for the acquisition thread (the Pi has cores 0 - 3)
+#endif
+
+#ifndef JITTER_REPORT
+#define JITTER_REPORT 0 // Set to '1' to print the startup jitter comparison
+#endif
+
+#ifndef JITTER_SAMPLES
+#define JITTER_SAMPLES 5000 // Number of sampling periods measured per jitter pass
+#endif
+
+#define REALTIME_PREFAULT_STACK (64*1024) // Bytes of stack touched up front so it is never faulted in later
+
+
+// _________________________________________________
+//  Jitter Statistics
+// _________________________________________________
+
+typedef struct {
+    unsigned long long count;
+    long long min_ns;
+    long long max_ns;
+    double sum_ns;
+    double sum_sq_ns;
+} Jitter_Stats;
+
+static inline long long Realtime_Now_NS(void){
+    return Clock_Now_NS();
+}
+
+static void Jitter_Reset(Jitter_Stats *stats){
+    memset(stats, 0, sizeof(*stats));
+}
+
+static void Jitter_Add(Jitter_Stats *stats, long long period_ns){
+    // Adds one sampling period to the statistics
+    if (stats->count == 0 || period_ns < stats->min_ns){
+        stats->min_ns = period_ns;
+    }
+    if (period_ns > stats->max_ns){
+        stats->max_ns = period_ns;
+    }
+    stats->count += 1;
+    stats->sum_ns += (double)period_ns;
+    stats->sum_sq_ns += (double)period_ns * (double)period_ns;
+}
+
+static double Jitter_Square_Root(double value){
+    // Newton's method, avoids linking the maths library just for the standard deviation
+    if (value <= 0){
+        return 0.0;
+    }
+    double root = value;
+    for (int i = 0; i < 64; i++){
+        root = 0.5 * (root + value / root);
+    }
+    return root;
+}
+
+static void Jitter_Print(const char *label, const Jitter_Stats *stats){
+    // Prints mean, standard deviation and range of the sampling period in microseconds
+    if (stats->count == 0){
+        printf("%-22s no samples\n", label);
+        return;
+    }
+    double mean = stats->sum_ns / (double)stats->count;
+    double variance = stats->sum_sq_ns / (double)stats->count - mean * mean;
+    printf("%-22s periods: %8llu  mean: %9.2f us  stddev: %8.2f us  min: %9.2f us  max: %9.2f us\n",
+           label, stats->count, mean / 1000.0, Jitter_Square_Root(variance) / 1000.0,
+           (double)stats->min_ns / 1000.0, (double)stats->max_ns / 1000.0);
+}
+
+
+// _________________________________________________
+//  Profile Functions
+// _________________________________________________
+
+static void Realtime_Prefault(void *buffer, size_t size){
+    // Touches every page of a buffer so it is resident before sampling starts
+    volatile unsigned char *bytes = (volatile unsigned char *)buffer;
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += (size_t)page){
+        bytes[offset] = bytes[offset];
+    }
+}
+
+static void Realtime_Prefault_Stack(void){
+    unsigned char stack_Block[REALTIME_PREFAULT_STACK];
+    memset(stack_Block, 0, sizeof(stack_Block));
+    __asm__ __volatile__("" : : "r"(stack_Block) : "memory"); // Keeps the memset from being optimised out
+}
+
+static void Realtime_Setup(void){
+    // Locks the process memory (call once from main before the threads start)
+    if (!REALTIME_PROFILE){
+        return;
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+        printf("WARNING: mlockall failed (%s), memory is not locked\n", strerror(errno));
+    }
+    Realtime_Prefault_Stack();
+}
+
+static int Realtime_Apply_Acquisition(void){
+    // Applies SCHED_FIFO and the core affinity to the calling thread, returns 0 on success
+    int result = 0;
+
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(REALTIME_CORE, &cores);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) != 0){
+        printf("WARNING: could not pin the acquisition thread to core %d\n", REALTIME_CORE);
+        result = -1;
+    }
+
+    struct sched_param parameters;
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.sched_priority = REALTIME_PRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters) != 0){
+        printf("WARNING: could not set SCHED_FIFO priority %d (needs root)\n", REALTIME_PRIORITY);
+        result = -1;
+    }
+
+    Realtime_Prefault_Stack();
+    return result;
+}
+
+static void Realtime_Enter_Acquisition(void){
+    // Called at the start of the acquisition thread
+    if (REALTIME_PROFILE){
+        Realtime_Apply_Acquisition();
+    }
+}
+
+static void Realtime_Enter_Decode(void){
+    // Called once at the start of every other long-lived thread (decode loop, metrics, JSON and flight recorder writers,
+    // offline workers): keeps it off the acquisition core
+    if (!REALTIME_PROFILE){
+        return;
+    }
+    long core_COUNT = sysconf(_SC_NPROCESSORS_ONLN);
+    if (core_COUNT <= 1){
+        return;
+    }
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    for (long core = 0; core < core_COUNT; core++){
+        if (core != REALTIME_CORE){
+            CPU_SET(core, &cores);
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+}
+
+
+// _________________________________________________
+//  Startup Jitter Report
+// _________________________________________________
+
+typedef struct {
+    int (*read_Sample)(int); // Sampling function (analogRead)
+    int channel;
+    int apply_Profile;       // '1' to apply the real-time profile before measuring
+    Jitter_Stats stats;
+} Jitter_Pass;
+
+static void *Jitter_Pass_Thread(void *vargp){
+    Jitter_Pass *pass = (Jitter_Pass *)vargp;
+    if (pass->apply_Profile){
+        Realtime_Apply_Acquisition();
+    }
+    Jitter_Reset(&pass->stats);
+
+    long long previous = Realtime_Now_NS();
+    for (int i = 0; i < JITTER_SAMPLES; i++){
+        pass->read_Sample(pass->channel);
+        long long now = Realtime_Now_NS();
+        Jitter_Add(&pass->stats, now - previous);
+        previous = now;
+    }
+    return NULL;
+}
+
+static void Jitter_Report(int (*read_Sample)(int), int channel){
+    // Measures the sampling period with and without the real-time profile and prints both
+    Jitter_Pass passes[2] = {
+        { read_Sample, channel, 0, {0, 0, 0, 0, 0} },
+        { read_Sample, channel, 1, {0, 0, 0, 0, 0} }
+    };
+    pthread_t pass_THREAD;
+
+    printf("Measuring sampling jitter over %d periods...\n", JITTER_SAMPLES);
+    for (int i = 0; i < 2; i++){
+        pthread_create(&pass_THREAD, NULL, Jitter_Pass_Thread, &passes[i]);
+        pthread_join(pass_THREAD, NULL);
+    }
+    Jitter_Print("Normal scheduling:", &passes[0].stats);
+    Jitter_Print("Real-time profile:", &passes[1].stats);
+}
+
+#endif
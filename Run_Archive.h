@@ -0,0 +1,386 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Run-Length Archives (shared by both readers)
+// *****************************************************
+
+/*  A capture keeps every stored value as an int16, which adds up when months
+    of reader traffic are kept. An archive keeps only what the decoder uses,
+    the runs of the signal:
+
+        ./reader --archive <capture file> <archive file>
+        ./reader --decode-archive <archive file>
+
+    The first converts a capture (the same threshold and calibration as
+    --decode), the second decodes an archive in one sequential pass straight
+    into the offline decoder's run input, without the capture.
+
+    File layout: a Capture_Header with the magic "MCRA", followed by unsigned
+    LEB128 varints (7 bits per byte, the high bit set on all but the last).
+    Every record starts with a token:
+
+        token = payload << 3 | class << 1 | level         (level 1 = mark)
+
+        -- Runs: the class picks the nearest nominal length of the current
+           calibration (0 dot / small space, 1 dash / big space, 2 word gap)
+           and the payload is the zigzag coded difference from it, so most
+           runs take a single byte. Class 3 stores the length itself (long
+           silences, or where that is shorter).
+        -- Control records are "word gap marks" (class 2, level 1). The
+           payload is the kind and its fields follow as varints:
+               ARCHIVE_TIME         position (stored values since the start of the capture) of the next record
+               ARCHIVE_CALIBRATION  threshold, dot, dash, small space, big space, word gap
+               ARCHIVE_GAP          values were dropped; length of the run they broke
+               ARCHIVE_MESSAGE_END  the end of a message
+
+    Every message starts with a calibration snapshot: its own with
+    OFFLINE_PER_SEGMENT, otherwise the shared one from the start of the
+    capture. A time stamp follows every ARCHIVE_TIME_RUNS runs. Together with
+    the header's sample_HZ it gives the time into the recording. The decoder
+    checks each time stamp against the run lengths it has added up, so a
+    damaged archive is reported rather than misread.
+*/
+
+#ifndef RUN_ARCHIVE_H
+#define RUN_ARCHIVE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "Offline_Decode.h"
+
+
+// _________________________________________________
+//  Archive Configuration
+// _________________________________________________
+
+#ifndef ARCHIVE_TIME_RUNS
+#define ARCHIVE_TIME_RUNS 256 // Runs between two time stamps
+#endif
+
+#define ARCHIVE_MAGIC "MCRA"
+#define ARCHIVE_VERSION 1
+
+#define ARCHIVE_CLASS_RAW 3
+#define ARCHIVE_CONTROL ((2 << 1) | 1) // Class 2 with level 1: no mark is a word gap long
+
+#define ARCHIVE_TIME 0
+#define ARCHIVE_CALIBRATION 1
+#define ARCHIVE_GAP 2
+#define ARCHIVE_MESSAGE_END 3
+
+
+// _________________________________________________
+//  Varints
+// _________________________________________________
+
+static void Archive_Put(FILE *file, unsigned long long value){
+    while (value >= 0x80){
+        fputc((int)(value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc((int)value, file);
+}
+
+static inline int Archive_Get(const unsigned char **cursor, const unsigned char *end, unsigned long long *value){
+    // Reads one varint, returns -1 when the archive ends inside it
+    unsigned long long result = 0;
+    for (int shift = 0; shift < 64 && *cursor < end; shift += 7){
+        unsigned char byte = *(*cursor)++;
+        result |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)){
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline unsigned long long Archive_Zigzag(long long value){
+    return value < 0 ? ((unsigned long long)(-value) << 1) - 1 : (unsigned long long)value << 1;
+}
+
+static inline long long Archive_Unzigzag(unsigned long long value){
+    return (value & 1) ? -(long long)(value >> 1) - 1 : (long long)(value >> 1);
+}
+
+static inline int Archive_Nominal(const Offline_Calibration *calibration, int mark, int class){
+    // Nominal run length of a class
+    const Run_Lengths *lengths = &calibration->lengths;
+    if (mark){
+        return class == 0 ? lengths->dot : lengths->dash;
+    }
+    return class == 0 ? lengths->small_Space : class == 1 ? lengths->big_Space : lengths->big_Space * 7 / 3;
+}
+
+
+// _________________________________________________
+//  Archive Writer
+// _________________________________________________
+
+typedef struct {
+    FILE *file;
+    const Offline_Calibration *calibration;
+    long long position;    // Stored values before the next record
+    int runs_Since_TIME;
+    long long runs;
+} Archive_Writer;
+
+static void Archive_Control(Archive_Writer *writer, int kind){
+    Archive_Put(writer->file, ((unsigned long long)kind << 3) | ARCHIVE_CONTROL);
+}
+
+static void Archive_Run(Archive_Writer *writer, int mark, int length){
+    if (writer->runs_Since_TIME >= ARCHIVE_TIME_RUNS){
+        Archive_Control(writer, ARCHIVE_TIME);
+        Archive_Put(writer->file, (unsigned long long)writer->position);
+        writer->runs_Since_TIME = 0;
+    }
+    int best_Class = 0;
+    for (int class = 1; class < (mark ? 2 : 3); class++){
+        if (abs(length - Archive_Nominal(writer->calibration, mark, class)) < abs(length - Archive_Nominal(writer->calibration, mark, best_Class))){
+            best_Class = class;
+        }
+    }
+    unsigned long long payload = Archive_Zigzag(length - Archive_Nominal(writer->calibration, mark, best_Class));
+    if (payload >= (unsigned long long)length){
+        best_Class = ARCHIVE_CLASS_RAW;
+        payload = (unsigned long long)length;
+    }
+    Archive_Put(writer->file, (payload << 3) | ((unsigned long long)best_Class << 1) | (unsigned long long)mark);
+    writer->position += length;
+    writer->runs_Since_TIME += 1;
+    writer->runs += 1;
+}
+
+static void Archive_Snapshot(Archive_Writer *writer, const Offline_Calibration *calibration){
+    const Run_Lengths *lengths = &calibration->lengths;
+    writer->calibration = calibration;
+    Archive_Control(writer, ARCHIVE_CALIBRATION);
+    Archive_Put(writer->file, (unsigned long long)calibration->threshold);
+    Archive_Put(writer->file, (unsigned long long)lengths->dot);
+    Archive_Put(writer->file, (unsigned long long)lengths->dash);
+    Archive_Put(writer->file, (unsigned long long)lengths->small_Space);
+    Archive_Put(writer->file, (unsigned long long)lengths->big_Space);
+    Archive_Put(writer->file, (unsigned long long)calibration->word_Space);
+    writer->runs_Since_TIME = ARCHIVE_TIME_RUNS; // Every message is stamped, so it can be found on its own
+}
+
+static int Archive_Create_Main(const char *capture_Path, const char *archive_Path){
+    // Converts a capture file into an archive, returns the process exit status
+    Capture_Header header;
+    int16_t *values = Offline_Load(capture_Path, &header);
+    if (values == NULL){
+        return 1;
+    }
+    Offline_Calibration shared;
+    if (Offline_Shared_Calibration(&shared) != 0){
+        printf("Not enough runs in %s to calibrate\n", capture_Path);
+        free(values);
+        return 1;
+    }
+    FILE *file = fopen(archive_Path, "wb");
+    if (file == NULL){
+        printf("Could not create archive %s\n", archive_Path);
+        free(values);
+        return 1;
+    }
+    memcpy(header.magic, ARCHIVE_MAGIC, 4);
+    header.version = ARCHIVE_VERSION;
+    fwrite(&header, sizeof(header), 1, file);
+
+    Archive_Writer writer = { file, &shared, 0, 0, 0 };
+    int from = 0;
+    while (from < Offline_COUNT){
+        // One message at a time, each with its own calibration snapshot
+        int to = from + 1;
+        while (to < Offline_COUNT && Offline_VALUES[to - 1] != CAPTURE_MESSAGE_MARKER){
+            to += 1;
+        }
+        Offline_Calibration own;
+        Archive_Snapshot(&writer, OFFLINE_CALIBRATION == OFFLINE_PER_SEGMENT && Offline_Calibrate(from, to, AUTO_CALIBRATION_RUNS, &own) == 0 ? &own : &shared);
+
+        int run_Mark = -1;
+        int run_Length = 0;
+        for (int i = from; i < to; i++){
+            int value = Offline_VALUES[i];
+            if (value == GAP_MARKER){
+                // The broken run is not classified (like Offline_Decode_Segment()), only its length is kept
+                Archive_Control(&writer, ARCHIVE_GAP);
+                Archive_Put(file, (unsigned long long)(run_Mark != -1 ? run_Length : 0));
+                writer.position += (run_Mark != -1 ? run_Length : 0) + 1;
+                run_Mark = -1;
+                continue;
+            }
+            if (value == CAPTURE_MESSAGE_MARKER){
+                break;
+            }
+            int mark = Offline_Is_Mark(value, writer.calibration->threshold);
+            if (mark == run_Mark){
+                run_Length += 1;
+                continue;
+            }
+            if (run_Mark != -1){
+                Archive_Run(&writer, run_Mark, run_Length);
+            }
+            run_Mark = mark;
+            run_Length = 1;
+        }
+        if (run_Mark != -1){
+            Archive_Run(&writer, run_Mark, run_Length);
+        }
+        if (Offline_VALUES[to - 1] == CAPTURE_MESSAGE_MARKER){
+            Archive_Control(&writer, ARCHIVE_MESSAGE_END);
+            writer.position += 1;
+        }
+        from = to;
+    }
+    long archive_SIZE = ftell(file);
+    int failed = ferror(file);
+    failed |= fclose(file) != 0;
+    if (failed){
+        printf("Could not write archive %s\n", archive_Path);
+        free(values);
+        return 1;
+    }
+
+    long capture_SIZE = (long)sizeof(header) + (long)Offline_COUNT * (long)sizeof(int16_t);
+    printf("Archived %lld runs from %d values: %ld bytes instead of %ld (%.1fx smaller)\n",
+           writer.runs, Offline_COUNT, archive_SIZE, capture_SIZE, archive_SIZE > 0 ? (double)capture_SIZE / archive_SIZE : 0.0);
+    free(values);
+    return 0;
+}
+
+
+// _________________________________________________
+//  Archive Decoder
+// _________________________________________________
+
+static int Archive_Decode_Main(const char *path, const char *symbols, const char patterns[][8], int symbol_COUNT){
+    // Decodes an archive in one pass and prints its messages, returns the process exit status
+    FILE *file = fopen(path, "rb");
+    if (file == NULL){
+        printf("Could not open archive %s\n", path);
+        return 1;
+    }
+    Capture_Header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, ARCHIVE_MAGIC, 4) != 0 || header.version != ARCHIVE_VERSION){
+        printf("%s is not an archive\n", path);
+        fclose(file);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file) - (long)sizeof(header);
+    fseek(file, (long)sizeof(header), SEEK_SET);
+    unsigned char *bytes = malloc((size_t)size + 1);
+    size = (long)fread(bytes, 1, (size_t)size, file);
+    fclose(file);
+    Offline_MARK_LOW = (header.flags & CAPTURE_FLAG_MARK_LOW) != 0;
+    Offline_PREAMBLE = (header.flags & CAPTURE_FLAG_PREAMBLE) != 0;
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start); // Wall time on purpose, also in the simulated build
+
+    // The whole archive decodes as one segment: every record emits at most two symbols
+    Offline_Segment segment;
+    memset(&segment, 0, sizeof(segment));
+    segment.text = malloc((size_t)size * 2 + 2);
+    Offline_Calibration calibration;
+    memset(&calibration, 0, sizeof(calibration));
+    Morse_Decoder_Config config = { symbols, patterns, symbol_COUNT, Offline_MARK_LOW, Offline_PREAMBLE, Offline_Collect, &segment };
+    Morse_Decoder decoder;
+    Morse_Decoder_Init(&decoder, &config);
+
+    const unsigned char *cursor = bytes;
+    const unsigned char *bytes_END = bytes + size;
+    long long position = 0;
+    long long runs = 0;
+    int calibrated = 0;
+    int open_Message = 0; // '1' while runs of an unfinished message were decoded
+    const char *damage = NULL;
+    while (cursor < bytes_END && damage == NULL){
+        unsigned long long token;
+        if (Archive_Get(&cursor, bytes_END, &token) != 0){
+            damage = "truncated record";
+            break;
+        }
+        if ((token & 7) != ARCHIVE_CONTROL){
+            int mark = (int)(token & 1);
+            int class = (int)((token >> 1) & 3);
+            long long length = class == ARCHIVE_CLASS_RAW ? (long long)(token >> 3)
+                               : Archive_Nominal(&calibration, mark, class) + Archive_Unzigzag(token >> 3);
+            if (!calibrated || length <= 0 || length > INT32_MAX){
+                damage = "bad run";
+                break;
+            }
+            Morse_Decoder_Push_Run(&decoder, mark, (int)length);
+            position += length;
+            runs += 1;
+            open_Message = 1;
+            continue;
+        }
+        unsigned long long fields[6];
+        int field_COUNT = (token >> 3) == ARCHIVE_CALIBRATION ? 6 : (token >> 3) == ARCHIVE_MESSAGE_END ? 0 : 1;
+        for (int f = 0; f < field_COUNT; f++){
+            if (Archive_Get(&cursor, bytes_END, &fields[f]) != 0){
+                damage = "truncated record";
+            }
+        }
+        if (damage != NULL){
+            break;
+        }
+        switch (token >> 3){
+            case ARCHIVE_TIME:
+                if ((long long)fields[0] != position){
+                    damage = "time stamp does not match the runs";
+                }
+                break;
+            case ARCHIVE_CALIBRATION:
+                calibration.threshold = (int)fields[0];
+                calibration.lengths.dot = (int)fields[1];
+                calibration.lengths.dash = (int)fields[2];
+                calibration.lengths.small_Space = (int)fields[3];
+                calibration.lengths.big_Space = (int)fields[4];
+                calibration.word_Space = (int)fields[5];
+                Morse_Decoder_Calibrate(&decoder, calibration.threshold, &calibration.lengths, calibration.word_Space);
+                calibrated = 1;
+                break;
+            case ARCHIVE_GAP:
+                Morse_Decoder_Gap(&decoder); // Values were dropped while recording
+                position += (long long)fields[0] + 1;
+                open_Message = 1;
+                break;
+            case ARCHIVE_MESSAGE_END:
+                Morse_Decoder_End_Message(&decoder);
+                position += 1;
+                open_Message = 0;
+                break;
+            default:
+                damage = "unknown record";
+                break;
+        }
+    }
+    if (open_Message){
+        Morse_Decoder_End_Message(&decoder); // The capture ended inside a message
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int pending_Spaces = 0;
+    int message_COUNT = Offline_Print_Text(segment.text, segment.text_COUNT, &pending_Spaces);
+    double elapsed_MS = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("________________________________________________\n");
+    if (damage != NULL){
+        printf("WARNING: %s is damaged (%s at byte %ld), decoded up to there\n",
+               path, damage, (long)sizeof(header) + (long)(cursor - bytes));
+    }
+    printf("Decoded %d message(s) from %lld values (%.1f s at %.1f values/s)\n",
+           message_COUNT, position, header.sample_HZ > 0 ? position / header.sample_HZ : 0.0, header.sample_HZ);
+    printf("%lld runs from %ld bytes in %.1f ms\n", runs, size, elapsed_MS);
+    free(segment.text);
+    free(bytes);
+    return damage != NULL;
+}
+
+#endif
@@ -0,0 +1,192 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Run Length Calibration (shared by both readers)
+// *****************************************************
+
+/*  Infers the dot, dash, small space and big space lengths from the durations
+    of ordinary BLACK (mark) and WHITE (space) runs, so no calibration pattern
+    has to be sent in front of the message.
+
+    The durations of each kind are sorted (a cumulative histogram) and split
+    in two on a log scale where the classes are best separated (the largest
+    between-class variance), so a few runs that fall between two classes do
+    not move the split. The two classes must be CALIBRATION_CLASS_RATIO apart:
+        -- marks:  dots (1 unit) and dashes (3 units)
+        -- spaces: gaps inside a symbol (1 unit), gaps between symbols
+                   (3 units) and gaps between words (7 units); the decoder only
+                   uses the first two so word gaps are folded into the big space
+
+    The length of a class is the median of its durations. If only one class of
+    marks (or spaces) is present the other kind is used to tell which one it is
+    and the missing length is derived from the 1:3 ratio.
+
+    The functions only work on the arrays passed in, so they can be used by any
+    decoder (live or offline).
+
+    With AUTO_CALIBRATION set to '1' the readers run Auto_Calibration() in place
+    of Middle_Voltage() and DashDot_AND_Space_Length(): it waits for the first
+    AUTO_CALIBRATION_RUNS runs, derives the threshold and lengths from them and
+    the conversion then decodes the buffered runs from the start of the message.
+*/
+
+#ifndef RUN_CALIBRATION_H
+#define RUN_CALIBRATION_H
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// _________________________________________________
+//  Calibration Configuration
+// _________________________________________________
+
+#ifndef AUTO_CALIBRATION
+#define AUTO_CALIBRATION 0 // Set to '1' to derive the lengths from the message itself instead of the calibration pattern
+#endif
+
+#ifndef FRAME_MODE
+#define FRAME_MODE 0 // Set to '1' to read framed messages with their own sync preamble instead (see Frame_Sync.h)
+#endif
+
+#ifndef CALIBRATION_PREAMBLE
+#define CALIBRATION_PREAMBLE (!AUTO_CALIBRATION && !FRAME_MODE) // '1' when messages start with the dash-dot calibration pattern
+#endif
+
+#ifndef AUTO_CALIBRATION_RUNS
+#define AUTO_CALIBRATION_RUNS 24 // Runs (marks and spaces) collected before the lengths are derived
+#endif
+
+#ifndef AUTO_CALIBRATION_CONTRAST
+#define AUTO_CALIBRATION_CONTRAST 64 // Smallest spread between the highest and lowest value that counts as a mark being seen
+#endif
+
+#define AUTO_CALIBRATION_POLL_MS 20 // How often the collected runs are checked while reading
+#define CALIBRATION_CLASS_RATIO 1.6 // Smallest ratio between the medians of two classes
+#define CALIBRATION_MAX_RUNS 256    // Most runs of one kind used for a calibration
+
+typedef struct {
+    int dot;
+    int dash;
+    int small_Space;
+    int big_Space;
+} Run_Lengths;
+
+
+static int Calibration_Compare(const void *a, const void *b){
+    return *(const int *)a - *(const int *)b;
+}
+
+static int Calibration_Median(const int *sorted, int from, int to){
+    // Median of sorted[from .. to-1]
+    return sorted[from + (to - from) / 2];
+}
+
+static int Calibration_Log(int length){
+    // log2(length) in 1/256 steps, the mantissa interpolated linearly (no libm needed)
+    if (length < 1){
+        length = 1;
+    }
+    int bits = 0;
+    while ((length >> bits) > 1){
+        bits += 1;
+    }
+    return (bits << 8) + (int)(((long long)length << 8 >> bits) - 256);
+}
+
+static int Calibration_Split(const int *sorted, int count){
+    // Returns the index of the first value of the upper class, or 0 when there is a single class
+    int logs[CALIBRATION_MAX_RUNS];
+    long long total = 0;
+    for (int i = 0; i < count; i++){
+        logs[i] = Calibration_Log(sorted[i]);
+        total += logs[i];
+    }
+    int split = 0;
+    double best_Variance = 0.0;
+    long long lower_SUM = 0;
+    for (int i = 1; i < count; i++){
+        lower_SUM += logs[i - 1];
+        if (logs[i] == logs[i - 1]){
+            continue; // Equal durations stay in one class
+        }
+        double difference = (double)(total - lower_SUM) / (count - i) - (double)lower_SUM / i;
+        double variance = (double)i * (double)(count - i) * difference * difference;
+        if (variance > best_Variance){
+            best_Variance = variance;
+            split = i;
+        }
+    }
+    if (split > 0 && Calibration_Median(sorted, split, count) < CALIBRATION_CLASS_RATIO * Calibration_Median(sorted, 0, split)){
+        return 0; // The best split still leaves one class
+    }
+    return split;
+}
+
+static inline int Run_Calibrate(const int *mark_Runs, int mark_COUNT, const int *space_Runs, int space_COUNT, Run_Lengths *lengths){
+    // Derives the four lengths from the given runs, returns 0 on success and -1 when there are no marks
+    if (mark_COUNT < 1){
+        return -1;
+    }
+    if (mark_COUNT > CALIBRATION_MAX_RUNS){
+        mark_COUNT = CALIBRATION_MAX_RUNS;
+    }
+    if (space_COUNT > CALIBRATION_MAX_RUNS){
+        space_COUNT = CALIBRATION_MAX_RUNS;
+    }
+
+    int marks[CALIBRATION_MAX_RUNS];
+    int spaces[CALIBRATION_MAX_RUNS];
+    memcpy(marks, mark_Runs, (size_t)mark_COUNT * sizeof(int));
+    memcpy(spaces, space_Runs, (size_t)space_COUNT * sizeof(int));
+    qsort(marks, (size_t)mark_COUNT, sizeof(int), Calibration_Compare);
+    qsort(spaces, (size_t)space_COUNT, sizeof(int), Calibration_Compare);
+
+    // Spaces: lowest class is the small space, the class right above it the big space
+    int space_Unit = 0;
+    int space_Big = 0;
+    if (space_COUNT > 0){
+        int split = Calibration_Split(spaces, space_COUNT);
+        if (split > 0){
+            space_Unit = Calibration_Median(spaces, 0, split);
+            int upper_Split = Calibration_Split(spaces + split, space_COUNT - split); // Separates word gaps
+            int upper_End = upper_Split > 0 ? split + upper_Split : space_COUNT;
+            space_Big = Calibration_Median(spaces, split, upper_End);
+        }
+    }
+
+    // Marks: dots below the largest gap, dashes above it
+    int split = Calibration_Split(marks, mark_COUNT);
+    if (split > 0){
+        lengths->dot = Calibration_Median(marks, 0, split);
+        lengths->dash = Calibration_Median(marks, split, mark_COUNT);
+    } else {
+        // Only one kind of mark: compare it with the space unit to decide which kind it is
+        int single = Calibration_Median(marks, 0, mark_COUNT);
+        int unit = space_Unit > 0 ? space_Unit : single;
+        if (abs(single - unit) <= abs(single - 3 * unit)){
+            lengths->dot = single;
+            lengths->dash = 3 * single;
+        } else {
+            lengths->dot = single / 3 > 0 ? single / 3 : 1;
+            lengths->dash = single;
+        }
+    }
+
+    if (space_Unit > 0){
+        lengths->small_Space = space_Unit;
+        lengths->big_Space = space_Big;
+    } else {
+        // Only one kind of space (or none): use the dot as the unit
+        int single = space_COUNT > 0 ? Calibration_Median(spaces, 0, space_COUNT) : 3 * lengths->dot;
+        if (abs(single - lengths->dot) <= abs(single - 3 * lengths->dot)){
+            lengths->small_Space = single;
+            lengths->big_Space = 3 * single;
+        } else {
+            lengths->small_Space = lengths->dot;
+            lengths->big_Space = single;
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,247 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Streaming Sample Filter (shared by both readers)
+// *****************************************************
+
+/*  Digital filter between the ADC and the voltage array. Every conversion is
+    pushed with Sample_Filter_Push() and once per stored value (every
+    'decimation' conversions, see Sample_Rate.h) Sample_Filter_Output() returns
+    the filtered value that goes into Voltage_Values and on to Conversion().
+
+    Selectable with SAMPLE_FILTER:
+        FILTER_BLOCK_AVERAGE  - mean of the conversions since the last output
+        FILTER_MOVING_AVERAGE - mean of the last FILTER_WINDOW conversions
+        FILTER_MEDIAN         - median of the last FILTER_WINDOW conversions
+                                (removes single-conversion spikes)
+        FILTER_CIC            - CIC_STAGES-stage cascaded integrator-comb
+                                decimator with a decimation ratio equal to the
+                                session decimation; its first CIC_STAGES
+                                outputs after a reset are the latest
+                                conversion, until the zeroed state has
+                                filled with input
+
+    All filters use integer arithmetic and a constant amount of work per
+    conversion. With FILTER_WINDOW set to 0 the moving average/median window
+    is sized to one period of lamp flicker (FLICKER_HZ, 100 Hz for 50 Hz mains)
+    so the flicker averages out.
+*/
+
+#ifndef SAMPLE_FILTER_H
+#define SAMPLE_FILTER_H
+
+#include <stdio.h>
+#include <string.h>
+
+
+// _________________________________________________
+//  Filter Configuration
+// _________________________________________________
+
+#define FILTER_BLOCK_AVERAGE 0
+#define FILTER_MOVING_AVERAGE 1
+#define FILTER_MEDIAN 2
+#define FILTER_CIC 3
+
+#ifndef SAMPLE_FILTER
+#define SAMPLE_FILTER FILTER_BLOCK_AVERAGE // Selects one of the four filters above
+#endif
+
+#ifndef FILTER_WINDOW
+#define FILTER_WINDOW 0 // Moving average / median length in conversions, '0' sizes it to one flicker period
+#endif
+
+#ifndef FLICKER_HZ
+#define FLICKER_HZ 100 // Lamp flicker frequency (twice the mains frequency)
+#endif
+
+#ifndef CIC_STAGES
+#define CIC_STAGES 3 // Number of integrator/comb pairs of the CIC decimator
+#endif
+
+#define FILTER_MAX_WINDOW 64 // Longest moving average window
+#define FILTER_MAX_MEDIAN 15 // Longest median window (kept short since it is sorted by insertion)
+
+
+// _________________________________________________
+//  Filter State
+// _________________________________________________
+
+typedef struct {
+    int window;                          // Window length in conversions
+    int history[FILTER_MAX_WINDOW];      // Last 'window' conversions (oldest at 'oldest')
+    int oldest;
+    int filled;                          // Number of valid conversions in 'history'
+    long window_SUM;                     // Running sum of 'history'
+    int sorted[FILTER_MAX_MEDIAN];       // 'history' kept sorted for the median
+    long block_SUM;                      // Sum and count since the last output (block average)
+    int block_COUNT;
+    unsigned int integrator[CIC_STAGES]; // CIC state, wraps modulo 2^32 by design
+    unsigned int comb_Delay[CIC_STAGES];
+    int cic_Ratio;
+    int cic_Shift;                       // log2 of the CIC gain when it is a power of two, otherwise -1
+    unsigned int cic_Gain;
+    int cic_Settling;                    // Outputs left until the CIC has a full response behind it
+    int last_Conversion;
+} Sample_Filter_State;
+
+static Sample_Filter_State Reader_Filter;
+
+static const char *Sample_Filter_NAME(void){
+    switch (SAMPLE_FILTER){
+        case FILTER_MOVING_AVERAGE: return "moving average";
+        case FILTER_MEDIAN: return "median";
+        case FILTER_CIC: return "CIC";
+        default: return "block average";
+    }
+}
+
+
+// _________________________________________________
+//  Filter Functions
+// _________________________________________________
+
+static void Sample_Filter_Setup(double adc_HZ, int decimation){
+    // Sizes the filter for the selected conversion rate and decimation (call once after Session_Start)
+    int limit = (SAMPLE_FILTER == FILTER_MEDIAN) ? FILTER_MAX_MEDIAN : FILTER_MAX_WINDOW;
+    int window = FILTER_WINDOW;
+    if (window <= 0){
+        window = (int)(adc_HZ / FLICKER_HZ);
+    }
+    if (window < 1){
+        window = 1;
+    } else if (window > limit){
+        window = limit;
+    }
+
+    memset(&Reader_Filter, 0, sizeof(Reader_Filter));
+    Reader_Filter.window = window;
+    Reader_Filter.cic_Ratio = decimation;
+    Reader_Filter.cic_Gain = 1;
+    for (int stage = 0; stage < CIC_STAGES; stage++){
+        Reader_Filter.cic_Gain *= (unsigned int)decimation;
+    }
+    Reader_Filter.cic_Shift = -1;
+    Reader_Filter.cic_Settling = CIC_STAGES;
+    for (int shift = 0; shift < 32; shift++){
+        if ((1u << shift) == Reader_Filter.cic_Gain){
+            Reader_Filter.cic_Shift = shift;
+        }
+    }
+    printf("Filter: %s (window %d, decimation %d)\n", Sample_Filter_NAME(), window, decimation);
+}
+
+static void Sample_Filter_Reset(void){
+    // Clears the filter history (called whenever reading starts)
+    int window = Reader_Filter.window;
+    int ratio = Reader_Filter.cic_Ratio;
+    int shift = Reader_Filter.cic_Shift;
+    unsigned int gain = Reader_Filter.cic_Gain;
+    memset(&Reader_Filter, 0, sizeof(Reader_Filter));
+    Reader_Filter.window = window;
+    Reader_Filter.cic_Ratio = ratio;
+    Reader_Filter.cic_Shift = shift;
+    Reader_Filter.cic_Gain = gain;
+    Reader_Filter.cic_Settling = CIC_STAGES;
+}
+
+static void Sample_Filter_Median_Replace(int removed, int added, int had_Removed){
+    // Keeps 'sorted' ordered: removes one value and inserts another by shifting (O(window))
+    Sample_Filter_State *filter = &Reader_Filter;
+    int count = filter->filled;
+    if (had_Removed){
+        int index = 0;
+        while (index < count - 1 && filter->sorted[index] != removed){
+            index += 1;
+        }
+        memmove(&filter->sorted[index], &filter->sorted[index + 1], (size_t)(count - 1 - index) * sizeof(int));
+        count -= 1;
+    }
+    int position = count;
+    while (position > 0 && filter->sorted[position - 1] > added){
+        filter->sorted[position] = filter->sorted[position - 1];
+        position -= 1;
+    }
+    filter->sorted[position] = added;
+}
+
+static void Sample_Filter_Push(int conversion){
+    // Adds one ADC conversion to the filter
+    Sample_Filter_State *filter = &Reader_Filter;
+
+    switch (SAMPLE_FILTER){
+        case FILTER_MOVING_AVERAGE:
+        case FILTER_MEDIAN: {
+            int full = (filter->filled == filter->window);
+            int removed = filter->history[filter->oldest];
+            if (full){
+                filter->window_SUM -= removed;
+            }
+            if (SAMPLE_FILTER == FILTER_MEDIAN){
+                Sample_Filter_Median_Replace(removed, conversion, full);
+            }
+            filter->history[filter->oldest] = conversion;
+            filter->window_SUM += conversion;
+            filter->oldest = (filter->oldest + 1) % filter->window;
+            if (!full){
+                filter->filled += 1;
+            }
+            break;
+        }
+        case FILTER_CIC: {
+            filter->last_Conversion = conversion;
+            unsigned int value = (unsigned int)conversion;
+            for (int stage = 0; stage < CIC_STAGES; stage++){
+                filter->integrator[stage] += value;
+                value = filter->integrator[stage];
+            }
+            break;
+        }
+        default:
+            filter->block_SUM += conversion;
+            filter->block_COUNT += 1;
+            break;
+    }
+}
+
+static int Sample_Filter_Output(void){
+    // Returns the filtered value for the voltage array (never 0, which marks the end of a message)
+    Sample_Filter_State *filter = &Reader_Filter;
+    int output = 0;
+
+    switch (SAMPLE_FILTER){
+        case FILTER_MOVING_AVERAGE:
+            output = filter->filled > 0 ? (int)(filter->window_SUM / filter->filled) : 0;
+            break;
+        case FILTER_MEDIAN:
+            output = filter->filled > 0 ? filter->sorted[filter->filled / 2] : 0;
+            break;
+        case FILTER_CIC: {
+            // Combs run once per output at the decimated rate
+            unsigned int value = filter->integrator[CIC_STAGES - 1];
+            for (int stage = 0; stage < CIC_STAGES; stage++){
+                unsigned int delayed = filter->comb_Delay[stage];
+                filter->comb_Delay[stage] = value;
+                value -= delayed;
+            }
+            output = (filter->cic_Shift >= 0) ? (int)(value >> filter->cic_Shift) : (int)(value / filter->cic_Gain);
+            if (filter->cic_Settling > 0){
+                // The state starts at zero, so the first CIC_STAGES outputs ramp up from 0: the latest conversion is held instead
+                filter->cic_Settling -= 1;
+                output = filter->last_Conversion;
+            }
+            break;
+        }
+        default:
+            output = filter->block_COUNT > 0 ? (int)(filter->block_SUM / filter->block_COUNT) : 0;
+            filter->block_SUM = 0;
+            filter->block_COUNT = 0;
+            break;
+    }
+
+    if (output < 1){
+        output = 1;
+    }
+    return output;
+}
+
+#endif
@@ -0,0 +1,176 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Sample Rate Probe and Session Metadata (shared by both readers)
+// *****************************************************
+
+/*  At startup the reader measures how many ADC conversions per second it can
+    actually achieve (the LED reader runs SPI at 100 kHz, the paper reader at
+    3 MHz) and then picks:
+
+        -- an acquisition rate so that one Morse unit spans between
+           MIN_UNIT_SAMPLES (at MAX_WPM) and MAX_UNIT_SAMPLES (at MIN_WPM) values
+        -- a decimation factor: the number of ADC conversions averaged into each
+           stored value, limited to MAX_DECIMATION and to RATE_HEADROOM of the
+           probed rate so no CPU is spent on oversampling that is never used
+
+    The chosen values are kept in Reader_Session, printed at startup and
+    exported with the metrics.
+
+    One unit lasts 1200 / WPM milliseconds (PARIS standard).
+*/
+
+#ifndef SAMPLE_RATE_H
+#define SAMPLE_RATE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "Stage_Metrics.h"
+#include "Reader_Clock.h"
+#include "Edge_Timing.h"
+
+
+// _________________________________________________
+//  Rate Configuration
+// _________________________________________________
+
+#ifndef MIN_WPM
+#define MIN_WPM 2 // Slowest expected sending speed (the LED messages use 500 ms units, about 2.4 WPM)
+#endif
+
+#ifndef MAX_WPM
+#define MAX_WPM 12 // Fastest expected sending speed
+#endif
+
+#ifndef MIN_UNIT_SAMPLES
+#define MIN_UNIT_SAMPLES (EDGE_INTERPOLATION ? 2 : 4) // Fewest stored values per unit at MAX_WPM (edges between values need fewer)
+#endif
+
+#ifndef MAX_UNIT_SAMPLES
+#define MAX_UNIT_SAMPLES 25 // Most stored values per unit at MIN_WPM (keeps the calibration pattern inside array_LENGTH)
+#endif
+
+#ifndef MAX_DECIMATION
+#define MAX_DECIMATION 8 // Most ADC conversions combined into one stored value
+#endif
+
+#define RATE_HEADROOM 0.5 // Fraction of the probed conversion rate the reader is allowed to use
+#define RATE_PROBE_SAMPLES 2000 // Conversions timed by the startup probe
+
+
+// _________________________________________________
+//  Session Metadata
+// _________________________________________________
+
+typedef struct {
+    const char *reader;     // "led" or "paper"
+    int channel;            // ADC channel being read
+    time_t started;         // Wall clock time the session started
+    double probed_HZ;       // Conversions per second measured at startup
+    double sample_HZ;       // Stored values per second
+    int decimation;         // ADC conversions per stored value
+    double adc_HZ;          // Conversions per second actually requested (sample_HZ * decimation)
+} Session_Metadata;
+
+static Session_Metadata Reader_Session = { "reader", 0, 0, 0.0, 0.0, 1, 0.0 };
+
+
+// _________________________________________________
+//  Probe and Selection
+// _________________________________________________
+
+static double Rate_Probe(int (*read_Sample)(int), int channel){
+    // Times RATE_PROBE_SAMPLES back to back conversions and returns the achieved rate
+    if (CLOCK_SIMULATED){
+        return SIM_ADC_HZ; // Simulated conversions take no simulated time
+    }
+    unsigned long long start = Metrics_Now_US();
+    for (int i = 0; i < RATE_PROBE_SAMPLES; i++){
+        read_Sample(channel);
+    }
+    unsigned long long elapsed = Metrics_Now_US() - start;
+    if (elapsed == 0){
+        elapsed = 1;
+    }
+    return (double)RATE_PROBE_SAMPLES * 1000000.0 / (double)elapsed;
+}
+
+static void Rate_Select(double probed_HZ, Session_Metadata *session){
+    // Picks the stored sample rate and decimation factor for the expected WPM range
+    double shortest_Unit_S = 1.2 / MAX_WPM;
+    double longest_Unit_S = 1.2 / MIN_WPM;
+    double lowest_Rate = MIN_UNIT_SAMPLES / shortest_Unit_S;  // Slowest rate that still resolves MAX_WPM
+    double highest_Rate = MAX_UNIT_SAMPLES / longest_Unit_S;  // Fastest rate that keeps MIN_WPM units short enough
+    double usable_HZ = probed_HZ * RATE_HEADROOM;
+
+    double sample_HZ = lowest_Rate;
+    if (lowest_Rate > highest_Rate){
+        // The WPM range is too wide for the unit limits: resolving the fast units wins
+        printf("WARNING: %d - %d WPM cannot keep every unit within %d - %d samples\n",
+               MIN_WPM, MAX_WPM, MIN_UNIT_SAMPLES, MAX_UNIT_SAMPLES);
+    }
+    if (sample_HZ > usable_HZ){
+        printf("WARNING: the ADC only allows %.1f samples/s, %d WPM units will be short\n", usable_HZ, MAX_WPM);
+        sample_HZ = usable_HZ;
+    }
+
+    int decimation = (int)(usable_HZ / sample_HZ);
+    if (decimation > MAX_DECIMATION){
+        decimation = MAX_DECIMATION;
+    } else if (decimation < 1){
+        decimation = 1;
+    }
+
+    session->probed_HZ = probed_HZ;
+    session->sample_HZ = sample_HZ;
+    session->decimation = decimation;
+    session->adc_HZ = sample_HZ * decimation;
+
+    atomic_store_explicit(&Reader_Metrics.sample_rate_mhz, (unsigned long long)(sample_HZ * 1000.0), memory_order_relaxed);
+    atomic_store_explicit(&Reader_Metrics.decimation, (unsigned long long)decimation, memory_order_relaxed);
+}
+
+static void Session_Start(const char *reader, int channel, int (*read_Sample)(int)){
+    // Probes the ADC, selects the rates and prints the session metadata
+    Reader_Session.reader = reader;
+    Reader_Session.channel = channel;
+    Reader_Session.started = time(NULL);
+
+    Rate_Select(Rate_Probe(read_Sample, channel), &Reader_Session);
+
+    printf("ADC probe: %.0f conversions/s achievable on channel %d\n", Reader_Session.probed_HZ, channel);
+    printf("Sampling: %.1f values/s (%d conversions averaged per value) for %d - %d WPM\n",
+           Reader_Session.sample_HZ, Reader_Session.decimation, MIN_WPM, MAX_WPM);
+    printf("________________________________________________\n");
+}
+
+
+// _________________________________________________
+//  Sample Clock
+// _________________________________________________
+
+static long long Sample_Clock_NEXT_NS = 0; // Absolute time of the next ADC conversion
+
+static void Sample_Clock_Reset(void){
+    // Restarts the sample clock, used whenever reading (re)starts
+    Sample_Clock_NEXT_NS = 0;
+}
+
+static void Sample_Clock_Wait(void){
+    // Sleeps until the next ADC conversion is due (paced at Reader_Session.adc_HZ)
+    long long period_NS = (long long)(1000000000.0 / Reader_Session.adc_HZ);
+    long long now_NS = Clock_Now_NS();
+
+    if (Sample_Clock_NEXT_NS == 0 || now_NS - Sample_Clock_NEXT_NS > 4 * period_NS){
+        // First conversion, or too far behind to catch up: restart the schedule from now
+        Sample_Clock_NEXT_NS = now_NS;
+    }
+    Clock_Sleep_Until_NS(Sample_Clock_NEXT_NS);
+    Sample_Clock_NEXT_NS += period_NS;
+}
+
+static void Sample_Clock_Skip(int conversions){
+    // Leaves out the next 'conversions' slots of the schedule (idle sampling)
+    Sample_Clock_NEXT_NS += (long long)conversions * (long long)(1000000000.0 / Reader_Session.adc_HZ);
+}
+
+#endif
@@ -0,0 +1,251 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Stage Metrics (shared by both readers)
+// *****************************************************
+
+/*  Lock-free counters and fixed-bucket latency histograms for every stage of
+    the reader (acquisition -> calibration -> conversion -> output).
+
+    The counters are updated with relaxed atomics from whichever thread runs
+    the stage, so the cost on the sampling path is a handful of increments.
+    A separate writer thread periodically renders everything in Prometheus
+    text format into METRICS_FILE (written to a temp file and renamed so a
+    scraper never sees a half written file).
+*/
+
+#ifndef STAGE_METRICS_H
+#define STAGE_METRICS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "Reader_Clock.h"
+#include "Realtime_Profile.h"
+
+
+// _________________________________________________
+//  Metrics Configuration
+// _________________________________________________
+
+#ifndef METRICS_ENABLED
+#define METRICS_ENABLED 1 // Set to '0' to disable the metrics file writer (counters are still kept)
+#endif
+
+#ifndef METRICS_INTERVAL_MS
+#define METRICS_INTERVAL_MS 1000 // How often the metrics file is rewritten
+#endif
+
+#define METRICS_BUCKET_COUNT 16 // Number of finite histogram buckets (an extra +Inf bucket is implied)
+#define CONFIDENCE_BUCKET_COUNT 10 // Character confidence histogram buckets of 0.1 each (see Decode_Confidence.h)
+
+// Upper bounds of the histogram buckets in microseconds (1-2-5 series from 1us to 5s)
+static const unsigned long long Metrics_Bucket_BOUNDS[METRICS_BUCKET_COUNT] = {
+    1, 5, 10, 50, 100, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 500000, 1000000, 5000000
+};
+
+
+// _________________________________________________
+//  Metric Types
+// _________________________________________________
+
+typedef struct {
+    const char *name; // Stage name used as the 'stage' label
+    _Atomic unsigned long long bucket[METRICS_BUCKET_COUNT + 1]; // Last bucket is +Inf
+    _Atomic unsigned long long count;
+    _Atomic unsigned long long sum_us;
+} Stage_Histogram;
+
+typedef enum {
+    HIST_ACQUISITION = 0,   // Duration of a single analogRead() + store
+    HIST_MIDDLE,            // Duration of Middle_Voltage()
+    HIST_DASH_DOT,          // Duration of DashDot_AND_Space_Length()
+    HIST_CONVERSION_CHAR,   // Time Conversion() spends turning a finished pattern into a character
+    HIST_EDGE_TO_CHAR,      // Time from the acquisition of the last edge of a character to its emission
+    HIST_OUTPUT,            // Duration of Output()
+    HIST_COUNT
+} Stage_Histogram_ID;
+
+typedef struct {
+    _Atomic unsigned long long samples_total;    // Samples appended by fill_Array()
+    _Atomic unsigned long long analysed_total;   // Samples popped by analyse_Array()
+    _Atomic unsigned long long runs_total;       // BLACK/WHITE runs closed by Conversion()
+    _Atomic unsigned long long chars_total;      // Characters emitted by Conversion()
+    _Atomic unsigned long long overruns_total;   // Times the writer lapped the reader
+    _Atomic unsigned long long dropped_total;    // Samples lost to overruns
+    _Atomic unsigned long long messages_total;   // Messages printed by Output()
+    _Atomic unsigned long long json_dropped_total; // JSON Lines records dropped because the consumer was too slow
+    _Atomic unsigned long long low_confidence_chars_total;  // Characters below CONFIDENCE_LOW
+    _Atomic unsigned long long confidence_permille_total;   // Sum of the character confidences (x1000)
+    _Atomic unsigned long long residual_abs_permille_total; // Sum of the absolute run residuals (x1000)
+    _Atomic unsigned long long confidence_bucket[CONFIDENCE_BUCKET_COUNT]; // Characters per confidence tenth
+    _Atomic unsigned long long sample_rate_mhz;  // Selected sample rate in millihertz (set by Sample_Rate.h)
+    _Atomic unsigned long long decimation;       // ADC conversions per stored value (set by Sample_Rate.h)
+    Stage_Histogram hist[HIST_COUNT];
+} Stage_Metrics;
+
+static Stage_Metrics Reader_Metrics = {
+    .hist = {
+        [HIST_ACQUISITION] = { .name = "acquisition" },
+        [HIST_MIDDLE] = { .name = "middle_voltage" },
+        [HIST_DASH_DOT] = { .name = "dash_dot_space" },
+        [HIST_CONVERSION_CHAR] = { .name = "conversion_char" },
+        [HIST_EDGE_TO_CHAR] = { .name = "edge_to_char" },
+        [HIST_OUTPUT] = { .name = "output" },
+    }
+};
+
+
+// _________________________________________________
+//  Recording Functions
+// _________________________________________________
+
+static inline unsigned long long Metrics_Now_US(void){
+    // Monotonic time in microseconds, used for all stage timings
+    return Clock_Now_US();
+}
+
+static inline void Metrics_Count(_Atomic unsigned long long *counter, unsigned long long amount){
+    atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+static inline void Metrics_Observe(Stage_Histogram_ID id, unsigned long long elapsed_us){
+    // Adds one observation to the histogram of the given stage
+    Stage_Histogram *hist = &Reader_Metrics.hist[id];
+    int index = 0;
+    while (index < METRICS_BUCKET_COUNT && elapsed_us > Metrics_Bucket_BOUNDS[index]){
+        index += 1;
+    }
+    atomic_fetch_add_explicit(&hist->bucket[index], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_us, elapsed_us, memory_order_relaxed);
+}
+
+static inline unsigned long long Metrics_Load(_Atomic unsigned long long *counter){
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+
+// _________________________________________________
+//  Prometheus Text Writer
+// _________________________________________________
+
+static const char *Metrics_Reader_NAME = "reader"; // 'reader' label, set by Metrics_Start()
+static int Metrics_Channel = 0;                    // 'channel' label, set by Metrics_Start()
+static pthread_t Metrics_Writer_THREAD;
+
+static void Metrics_Write_Counter(FILE *file, const char *name, const char *help, unsigned long long value){
+    fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    fprintf(file, "%s{reader=\"%s\",channel=\"%d\"} %llu\n", name, Metrics_Reader_NAME, Metrics_Channel, value);
+}
+
+static void Metrics_Write_Gauge(FILE *file, const char *name, const char *help, double value){
+    fprintf(file, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+    fprintf(file, "%s{reader=\"%s\",channel=\"%d\"} %.3f\n", name, Metrics_Reader_NAME, Metrics_Channel, value);
+}
+
+static void Metrics_Write_File(const char *path, const double rates[3]){
+    // Renders every metric into 'path' in the Prometheus text exposition format
+    char temp_Path[256];
+    snprintf(temp_Path, sizeof(temp_Path), "%s.tmp", path);
+    FILE *file = fopen(temp_Path, "w");
+    if (file == NULL){
+        return;
+    }
+
+    unsigned long long samples = Metrics_Load(&Reader_Metrics.samples_total);
+    unsigned long long analysed = Metrics_Load(&Reader_Metrics.analysed_total);
+
+    Metrics_Write_Counter(file, "morse_samples_total", "Samples appended to the voltage array", samples);
+    Metrics_Write_Counter(file, "morse_runs_total", "BLACK/WHITE runs closed by the conversion stage", Metrics_Load(&Reader_Metrics.runs_total));
+    Metrics_Write_Counter(file, "morse_chars_total", "Characters emitted by the conversion stage", Metrics_Load(&Reader_Metrics.chars_total));
+    Metrics_Write_Counter(file, "morse_overruns_total", "Times the acquisition writer lapped the conversion reader", Metrics_Load(&Reader_Metrics.overruns_total));
+    Metrics_Write_Counter(file, "morse_dropped_samples_total", "Samples lost to overruns", Metrics_Load(&Reader_Metrics.dropped_total));
+    Metrics_Write_Counter(file, "morse_messages_total", "Messages printed by the output stage", Metrics_Load(&Reader_Metrics.messages_total));
+    Metrics_Write_Counter(file, "morse_json_dropped_total", "JSON Lines records dropped because the consumer was too slow", Metrics_Load(&Reader_Metrics.json_dropped_total));
+    Metrics_Write_Counter(file, "morse_low_confidence_chars_total", "Characters decoded below the confidence limit", Metrics_Load(&Reader_Metrics.low_confidence_chars_total));
+    Metrics_Write_Counter(file, "morse_run_residual_abs_permille_total", "Summed absolute timing residual of the classified runs (per mille of the chosen length)", Metrics_Load(&Reader_Metrics.residual_abs_permille_total));
+    Metrics_Write_Gauge(file, "morse_samples_per_second", "Acquisition throughput over the last interval", rates[0]);
+    Metrics_Write_Gauge(file, "morse_runs_per_second", "Run throughput over the last interval", rates[1]);
+    Metrics_Write_Gauge(file, "morse_chars_per_second", "Character throughput over the last interval", rates[2]);
+    Metrics_Write_Gauge(file, "morse_sample_rate_hz", "Stored values per second selected at startup", (double)Metrics_Load(&Reader_Metrics.sample_rate_mhz) / 1000.0);
+    Metrics_Write_Gauge(file, "morse_decimation", "ADC conversions combined into each stored value", (double)Metrics_Load(&Reader_Metrics.decimation));
+    Metrics_Write_Gauge(file, "morse_ring_occupancy", "Samples appended but not yet analysed", samples >= analysed ? (double)(samples - analysed) : 0.0);
+
+    fprintf(file, "# HELP morse_stage_latency_us Per-stage latency in microseconds\n# TYPE morse_stage_latency_us histogram\n");
+    for (int id = 0; id < HIST_COUNT; id++){
+        Stage_Histogram *hist = &Reader_Metrics.hist[id];
+        unsigned long long cumulative = 0;
+        for (int index = 0; index <= METRICS_BUCKET_COUNT; index++){
+            cumulative += Metrics_Load(&hist->bucket[index]);
+            if (index < METRICS_BUCKET_COUNT){
+                fprintf(file, "morse_stage_latency_us_bucket{reader=\"%s\",channel=\"%d\",stage=\"%s\",le=\"%llu\"} %llu\n",
+                        Metrics_Reader_NAME, Metrics_Channel, hist->name, Metrics_Bucket_BOUNDS[index], cumulative);
+            } else {
+                fprintf(file, "morse_stage_latency_us_bucket{reader=\"%s\",channel=\"%d\",stage=\"%s\",le=\"+Inf\"} %llu\n",
+                        Metrics_Reader_NAME, Metrics_Channel, hist->name, cumulative);
+            }
+        }
+        fprintf(file, "morse_stage_latency_us_sum{reader=\"%s\",channel=\"%d\",stage=\"%s\"} %llu\n",
+                Metrics_Reader_NAME, Metrics_Channel, hist->name, Metrics_Load(&hist->sum_us));
+        fprintf(file, "morse_stage_latency_us_count{reader=\"%s\",channel=\"%d\",stage=\"%s\"} %llu\n",
+                Metrics_Reader_NAME, Metrics_Channel, hist->name, Metrics_Load(&hist->count));
+    }
+
+    fprintf(file, "# HELP morse_char_confidence Confidence of the decoded characters (0 = on a decision boundary, 1 = exact)\n# TYPE morse_char_confidence histogram\n");
+    unsigned long long confident = 0;
+    for (int index = 0; index < CONFIDENCE_BUCKET_COUNT; index++){
+        confident += Metrics_Load(&Reader_Metrics.confidence_bucket[index]);
+        fprintf(file, "morse_char_confidence_bucket{reader=\"%s\",channel=\"%d\",le=\"%.1f\"} %llu\n",
+                Metrics_Reader_NAME, Metrics_Channel, (index + 1) / (double)CONFIDENCE_BUCKET_COUNT, confident);
+    }
+    fprintf(file, "morse_char_confidence_bucket{reader=\"%s\",channel=\"%d\",le=\"+Inf\"} %llu\n", Metrics_Reader_NAME, Metrics_Channel, confident);
+    fprintf(file, "morse_char_confidence_sum{reader=\"%s\",channel=\"%d\"} %.3f\n",
+            Metrics_Reader_NAME, Metrics_Channel, Metrics_Load(&Reader_Metrics.confidence_permille_total) / 1000.0);
+    fprintf(file, "morse_char_confidence_count{reader=\"%s\",channel=\"%d\"} %llu\n", Metrics_Reader_NAME, Metrics_Channel, confident);
+
+    fclose(file);
+    rename(temp_Path, path); // Atomically replace the previous snapshot
+}
+
+static void *Metrics_Writer(void *vargp){
+    // Thread that rewrites the metrics file every METRICS_INTERVAL_MS
+    Realtime_Enter_Decode();
+    const char *path = (const char *)vargp;
+    unsigned long long previous[3] = {0, 0, 0};
+    unsigned long long previous_Time = Metrics_Now_US();
+
+    while (1){
+        usleep(METRICS_INTERVAL_MS * 1000);
+
+        unsigned long long now = Metrics_Now_US();
+        unsigned long long current[3] = {
+            Metrics_Load(&Reader_Metrics.samples_total),
+            Metrics_Load(&Reader_Metrics.runs_total),
+            Metrics_Load(&Reader_Metrics.chars_total)
+        };
+        double seconds = (double)(now - previous_Time) / 1000000.0;
+        double rates[3];
+        for (int i = 0; i < 3; i++){
+            rates[i] = seconds > 0 ? (double)(current[i] - previous[i]) / seconds : 0.0;
+            previous[i] = current[i];
+        }
+        previous_Time = now;
+
+        Metrics_Write_File(path, rates);
+    }
+    return NULL;
+}
+
+static void Metrics_Start(const char *reader_Name, int channel, const char *path){
+    // Starts the periodic metrics writer (does nothing when METRICS_ENABLED is '0')
+    Metrics_Reader_NAME = reader_Name;
+    Metrics_Channel = channel;
+    if (METRICS_ENABLED){
+        pthread_create(&Metrics_Writer_THREAD, NULL, Metrics_Writer, (void *)path);
+        pthread_detach(Metrics_Writer_THREAD);
+    }
+}
+
+#endif
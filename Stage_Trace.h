@@ -0,0 +1,293 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Stage Trace Profiler (shared by both readers)
+// *****************************************************
+
+/*  With STAGE_TRACE set to '1' every stage of the reader (fill_Array,
+    Middle_Voltage, DashDot_AND_Space_Length, Auto_Calibration, Conversion,
+    Output, Reset_Message_State and the thread creation) is timed with a
+    scoped trace point:
+
+        TRACE_SCOPE(TRACE_OUTPUT);   // at the top of the function or block
+
+    which records the wall time and the CPU time of the calling thread
+    (CLOCK_THREAD_CPUTIME_ID) when the scope is left. Every thread writes into
+    its own ring of TRACE_EVENTS events, so recording takes no lock; the
+    newest events win when a ring is full. The time from the last edge of a
+    character to its emission is recorded on its own track.
+
+    After every message Trace_Report() prints the CPU and wall time per stage
+    and the edge-to-character latency, and Trace_Dump() writes the rings as
+    Chrome trace-event JSON to STAGE_TRACE_DIR/morse_<reader>_<channel>.trace.json
+    (open it in chrome://tracing or ui.perfetto.dev).
+
+    With STAGE_TRACE at '0' the trace points compile to nothing.
+*/
+
+#ifndef STAGE_TRACE_H
+#define STAGE_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "Reader_Clock.h"
+
+
+// _________________________________________________
+//  Trace Configuration
+// _________________________________________________
+
+#ifndef STAGE_TRACE
+#define STAGE_TRACE 0 // Set to '1' to record the stage trace and print the per-stage summary
+#endif
+
+#ifndef STAGE_TRACE_DIR
+#define STAGE_TRACE_DIR "/var/tmp"
+#endif
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 16384 // Events kept per thread (a power of two)
+#endif
+
+#define TRACE_MAX_THREADS 16
+#define TRACE_DUMP_MARGIN 64 // Oldest events skipped when a ring may be overwritten while dumping
+
+typedef enum {
+    TRACE_FILL_ARRAY = 0,
+    TRACE_MIDDLE_VOLTAGE,
+    TRACE_DASH_DOT,
+    TRACE_AUTO_CALIBRATION,
+    TRACE_CONVERSION,
+    TRACE_OUTPUT,
+    TRACE_RESET,
+    TRACE_THREAD_CREATE,
+    TRACE_EDGE_TO_CHAR,     // Latency, recorded by Trace_Latency()
+    TRACE_STAGE_COUNT
+} Trace_Stage_ID;
+
+static const char *Trace_Stage_NAMES[TRACE_STAGE_COUNT] = {
+    [TRACE_FILL_ARRAY] = "fill_Array",
+    [TRACE_MIDDLE_VOLTAGE] = "Middle_Voltage",
+    [TRACE_DASH_DOT] = "DashDot_AND_Space_Length",
+    [TRACE_AUTO_CALIBRATION] = "Auto_Calibration",
+    [TRACE_CONVERSION] = "Conversion",
+    [TRACE_OUTPUT] = "Output",
+    [TRACE_RESET] = "Reset_Message_State",
+    [TRACE_THREAD_CREATE] = "thread_create",
+    [TRACE_EDGE_TO_CHAR] = "edge_to_char",
+};
+
+
+// _________________________________________________
+//  Trace State
+// _________________________________________________
+
+typedef struct {
+    long long start_NS;     // Reader clock
+    long long wall_NS;
+    long long cpu_NS;
+    int stage;
+} Trace_Event;
+
+typedef struct {
+    Trace_Event events[TRACE_EVENTS];
+    atomic_ullong written;  // Events recorded so far (published after each event)
+    const char *name;       // Thread name in the trace
+    int tid;
+} Trace_Buffer;
+
+typedef struct {
+    atomic_ullong count;
+    atomic_ullong wall_NS;
+    atomic_ullong cpu_NS;
+    atomic_ullong max_NS;
+} Trace_Total;
+
+typedef struct {
+    Trace_Stage_ID stage;
+    long long start_NS;
+    long long cpu_NS;
+} Trace_Scope;
+
+static Trace_Buffer *Trace_BUFFERS[TRACE_MAX_THREADS];
+static atomic_int Trace_Buffer_COUNT = 0;
+static __thread Trace_Buffer *Trace_LOCAL = NULL; // Ring of the calling thread
+static Trace_Total Trace_TOTALS[TRACE_STAGE_COUNT];
+static atomic_llong Trace_START_NS = 0;           // Start of the first event, used for the CPU share
+
+
+// _________________________________________________
+//  Recording Functions
+// _________________________________________________
+
+static inline long long Trace_Thread_CPU_NS(void){
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static Trace_Buffer *Trace_Local_Buffer(void){
+    // Returns the ring of the calling thread, allocated on its first event (NULL when all are taken)
+    if (Trace_LOCAL == NULL){
+        int tid = atomic_fetch_add(&Trace_Buffer_COUNT, 1);
+        if (tid >= TRACE_MAX_THREADS){
+            return NULL;
+        }
+        Trace_Buffer *buffer = calloc(1, sizeof(Trace_Buffer));
+        if (buffer == NULL){
+            return NULL;
+        }
+        buffer->tid = tid + 1;
+        Trace_BUFFERS[tid] = buffer;
+        Trace_LOCAL = buffer;
+    }
+    return Trace_LOCAL;
+}
+
+static void Trace_Thread_Name(const char *name){
+    // Names the calling thread in the trace
+    if (STAGE_TRACE){
+        Trace_Buffer *buffer = Trace_Local_Buffer();
+        if (buffer != NULL){
+            buffer->name = name;
+        }
+    }
+}
+
+static void Trace_Record(Trace_Stage_ID stage, long long start_NS, long long wall_NS, long long cpu_NS){
+    // Appends one event to the ring of the calling thread and adds it to the stage totals
+    Trace_Buffer *buffer = Trace_Local_Buffer();
+    if (buffer == NULL){
+        return;
+    }
+    unsigned long long written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+    Trace_Event *event = &buffer->events[written & (TRACE_EVENTS - 1)];
+    event->start_NS = start_NS;
+    event->wall_NS = wall_NS;
+    event->cpu_NS = cpu_NS;
+    event->stage = stage;
+    atomic_store_explicit(&buffer->written, written + 1, memory_order_release);
+
+    long long none = 0;
+    atomic_compare_exchange_strong_explicit(&Trace_START_NS, &none, start_NS, memory_order_relaxed, memory_order_relaxed);
+    Trace_Total *total = &Trace_TOTALS[stage];
+    atomic_fetch_add_explicit(&total->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&total->wall_NS, (unsigned long long)wall_NS, memory_order_relaxed);
+    atomic_fetch_add_explicit(&total->cpu_NS, (unsigned long long)cpu_NS, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&total->max_NS, memory_order_relaxed);
+    while ((unsigned long long)wall_NS > max
+           && !atomic_compare_exchange_weak_explicit(&total->max_NS, &max, (unsigned long long)wall_NS, memory_order_relaxed, memory_order_relaxed)){
+    }
+}
+
+static inline Trace_Scope Trace_Scope_Begin(Trace_Stage_ID stage){
+    return (Trace_Scope){ stage, Clock_Now_NS(), Trace_Thread_CPU_NS() };
+}
+
+static inline void Trace_Scope_End(Trace_Scope *scope){
+    // Called by the compiler when a TRACE_SCOPE goes out of scope
+    Trace_Record(scope->stage, scope->start_NS, Clock_Now_NS() - scope->start_NS, Trace_Thread_CPU_NS() - scope->cpu_NS);
+}
+
+static inline void Trace_Latency(unsigned long long edge_US, unsigned long long emitted_US){
+    // Records the edge-to-character latency of an emitted character
+    if (STAGE_TRACE && edge_US != 0 && emitted_US >= edge_US){
+        Trace_Record(TRACE_EDGE_TO_CHAR, (long long)edge_US * 1000LL, (long long)(emitted_US - edge_US) * 1000LL, 0);
+    }
+}
+
+#if STAGE_TRACE
+#define TRACE_SCOPE(stage) Trace_Scope trace_SCOPE __attribute__((cleanup(Trace_Scope_End))) = Trace_Scope_Begin(stage)
+#else
+#define TRACE_SCOPE(stage) ((void)0)
+#endif
+
+
+// _________________________________________________
+//  Summary and Chrome Trace Output
+// _________________________________________________
+
+static void Trace_Report(void){
+    // Prints the CPU and wall time of every stage so far (nothing when STAGE_TRACE is off)
+    long long start_NS = atomic_load_explicit(&Trace_START_NS, memory_order_relaxed);
+    if (!STAGE_TRACE || start_NS == 0){
+        return;
+    }
+    double elapsed_MS = (Clock_Now_NS() - start_NS) / 1e6;
+    printf("Stage trace over %.0f ms:\n", elapsed_MS);
+    printf("  %-26s %8s %9s %5s %9s %8s %8s\n", "stage", "calls", "cpu ms", "cpu %", "wall ms", "mean us", "max us");
+    for (int stage = 0; stage < TRACE_STAGE_COUNT; stage++){
+        Trace_Total *total = &Trace_TOTALS[stage];
+        unsigned long long count = atomic_load_explicit(&total->count, memory_order_relaxed);
+        if (count == 0){
+            continue;
+        }
+        double cpu_MS = atomic_load_explicit(&total->cpu_NS, memory_order_relaxed) / 1e6;
+        double wall_MS = atomic_load_explicit(&total->wall_NS, memory_order_relaxed) / 1e6;
+        double max_US = atomic_load_explicit(&total->max_NS, memory_order_relaxed) / 1e3;
+        if (stage == TRACE_EDGE_TO_CHAR){
+            printf("  %-26s %8llu  latency mean %.0f us, max %.0f us\n", Trace_Stage_NAMES[stage], count, wall_MS * 1e3 / count, max_US);
+        } else {
+            printf("  %-26s %8llu %9.2f %5.1f %9.1f %8.1f %8.0f\n", Trace_Stage_NAMES[stage], count, cpu_MS,
+                   elapsed_MS > 0 ? 100.0 * cpu_MS / elapsed_MS : 0.0, wall_MS, wall_MS * 1e3 / count, max_US);
+        }
+    }
+}
+
+static void Trace_Dump(const char *reader, int channel){
+    // Writes every ring as Chrome trace-event JSON (written to a temp file and renamed)
+    if (!STAGE_TRACE){
+        return;
+    }
+    char path[256];
+    char temp_Path[264];
+    snprintf(path, sizeof(path), "%s/morse_%s_%d.trace.json", STAGE_TRACE_DIR, reader, channel);
+    snprintf(temp_Path, sizeof(temp_Path), "%s.tmp", path);
+    FILE *file = fopen(temp_Path, "w");
+    if (file == NULL){
+        printf("WARNING: could not write the stage trace %s\n", temp_Path);
+        return;
+    }
+    int pid = (int)getpid();
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"morse %s %d\"}},\n", pid, reader, channel);
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"edge to character\"}}", pid);
+
+    int buffers = atomic_load(&Trace_Buffer_COUNT);
+    for (int b = 0; b < buffers && b < TRACE_MAX_THREADS; b++){
+        Trace_Buffer *buffer = Trace_BUFFERS[b];
+        if (buffer == NULL){
+            continue;
+        }
+        unsigned long long written = atomic_load_explicit(&buffer->written, memory_order_acquire);
+        unsigned long long first = 0;
+        if (written > TRACE_EVENTS){
+            first = written - TRACE_EVENTS + TRACE_DUMP_MARGIN; // The writer may be overwriting the oldest ones
+        }
+        if (buffer->name != NULL){
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid, buffer->tid, buffer->name);
+        }
+        for (unsigned long long i = first; i < written; i++){
+            const Trace_Event *event = &buffer->events[i & (TRACE_EVENTS - 1)];
+            int edge = event->stage == TRACE_EDGE_TO_CHAR;
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    Trace_Stage_NAMES[event->stage], edge ? "latency" : "stage", pid, edge ? 0 : buffer->tid,
+                    event->start_NS / 1e3, event->wall_NS / 1e3);
+            if (!edge){
+                fprintf(file, ",\"args\":{\"cpu_us\":%.3f}", event->cpu_NS / 1e3);
+            }
+            fprintf(file, "}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    if (rename(temp_Path, path) != 0){
+        printf("WARNING: could not write the stage trace %s\n", path);
+        return;
+    }
+    printf("Stage trace written to %s\n", path);
+}
+
+#endif
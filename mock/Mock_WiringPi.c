@@ -0,0 +1,512 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Mock wiringPi / MCP3004 (off-device builds)
+// *****************************************************
+
+/*  A stand-in for wiringPi, wiringPiSPI and the MCP3004/3008 extension, so both
+    readers build and run unmodified on any Linux machine:
+
+        gcc -std=gnu11 -O2 -Imock LED_Input_Reader.c mock/Mock_WiringPi.c -lpthread -o led_reader
+
+    Unlike the simulated clock (CLOCK_SIMULATED in Reader_Clock.h) everything
+    runs on wall time: the real acquisition thread, the real sleeps and the real
+    button interrupt path, so the readers can be timed and profiled on a build
+    machine.
+
+    The hardware is replaced by a signal model read from the script named in
+    MOCK_WIRINGPI_SCRIPT (examples are in this directory). One command per
+    line, '#' starts a comment, channels count from the mcp3004Setup() pin base
+    and times are milliseconds since wiringPiSetupGpio():
+
+        levels <channel> <mark> <space>         ADC values for a mark and a space
+        noise <channel> <peak_to_peak>          Uniform noise added to every conversion
+        ambient <channel> <peak> <period_ms>    Slow triangle swell of ambient light plus 100 Hz flicker
+        loopback <channel> <gpio> [gpio ...]    Channel reads a mark while any of these pins is HIGH
+        morse <channel> <start_ms> <unit_ms> <text>    Channel keys 'text' by itself
+        press <at_ms> [hold_ms]                 Button press (falling edge) and release (rising edge)
+        conversion_us <microseconds>            Time one analogRead() takes (default: 24 SPI clocks)
+        exit <at_ms>                            Ends the process
+
+    Without a script channel 0 loops back GPIO 5 and 6 (the LED reader's LEDs)
+    and the button is pressed at 1.5 s and 16 s, which reads one 'TEST' message.
+
+    Only the calls the readers make are modelled; everything else is accepted
+    and ignored.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "wiringPi.h"
+#include "wiringPiSPI.h"
+#include "mcp3004.h"
+
+
+// _________________________________________________
+//  Mock Configuration
+// _________________________________________________
+
+#define MOCK_PINS 64
+#define MOCK_CHANNELS 8
+#define MOCK_LOOPBACK_PINS 8
+#define MOCK_MAX_MARKS 4096   // Keyed marks per channel
+#define MOCK_MAX_EVENTS 256   // Button edges and exits
+#define MOCK_ADC_MAX 1023
+#define MOCK_DEFAULT_HOLD_MS 150
+
+
+// _________________________________________________
+//  Mock State
+// _________________________________________________
+
+typedef struct {
+    int mark;
+    int space;
+    int noise;
+    int ambient_Peak;
+    int ambient_Period_MS;
+    int loopback_PINS[MOCK_LOOPBACK_PINS];
+    int loopback_COUNT;
+    long long *mark_Start_MS; // Keyed marks as [start, end) intervals, in order
+    long long *mark_End_MS;
+    int mark_COUNT;
+} Mock_Channel;
+
+typedef enum {
+    MOCK_EVENT_PRESS,
+    MOCK_EVENT_RELEASE,
+    MOCK_EVENT_EXIT
+} Mock_Event_Type;
+
+typedef struct {
+    long long at_MS;
+    Mock_Event_Type type;
+} Mock_Event;
+
+static Mock_Channel Mock_CHANNELS[MOCK_CHANNELS];
+static Mock_Event Mock_EVENTS[MOCK_MAX_EVENTS];
+static int Mock_Event_COUNT = 0;
+static _Atomic int Mock_PIN_LEVELS[MOCK_PINS];
+static _Atomic int Mock_PIN_PULLS[MOCK_PINS];
+static _Atomic int Mock_BUTTON_DOWN = 0;        // Button level is LOW while pressed (pulled up otherwise)
+static int Mock_ISR_PIN = -1;
+static int Mock_ISR_EDGE = INT_EDGE_SETUP;
+static void (*_Atomic Mock_ISR)(void) = NULL;
+static int Mock_PIN_BASE = 100;
+static int Mock_SPI_SPEED = 1000000;
+static int Mock_CONVERSION_US = -1;             // -1 derives it from the SPI speed
+static struct timespec Mock_START;
+static pthread_once_t Mock_ONCE = PTHREAD_ONCE_INIT;
+static __thread unsigned int Mock_SEED = 0;
+
+
+// _________________________________________________
+//  Time
+// _________________________________________________
+
+static long long Mock_Now_US(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)(now.tv_sec - Mock_START.tv_sec) * 1000000LL + (now.tv_nsec - Mock_START.tv_nsec) / 1000;
+}
+
+static void Mock_Sleep_Until_US(long long at_US){
+    struct timespec until = Mock_START;
+    long long nanoseconds = until.tv_nsec + at_US * 1000LL;
+    until.tv_sec += nanoseconds / 1000000000LL;
+    until.tv_nsec = nanoseconds % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0){
+        // Interrupted by a signal, sleep the rest
+    }
+}
+
+static void Mock_Sleep_US(long long microseconds){
+    if (microseconds > 0){
+        Mock_Sleep_Until_US(Mock_Now_US() + microseconds);
+    }
+}
+
+
+// _________________________________________________
+//  Script
+// _________________________________________________
+
+static const char *Mock_Morse_Pattern(char character){
+    // International Morse, '.' dot and '-' dash
+    static const char *letters[26] = { ".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..", ".---", "-.-",
+                                       ".-..", "--", "-.", "---", ".--.", "--.-", ".-.", "...", "-", "..-", "...-",
+                                       ".--", "-..-", "-.--", "--.." };
+    static const char *digits[10] = { "-----", ".----", "..---", "...--", "....-", ".....", "-....", "--...",
+                                      "---..", "----." };
+    character = (char)toupper((unsigned char)character);
+    if (character >= 'A' && character <= 'Z'){
+        return letters[character - 'A'];
+    }
+    if (character >= '0' && character <= '9'){
+        return digits[character - '0'];
+    }
+    return NULL;
+}
+
+static void Mock_Add_Mark(Mock_Channel *channel, long long start_MS, long long end_MS){
+    if (channel->mark_COUNT >= MOCK_MAX_MARKS){
+        return;
+    }
+    if (channel->mark_Start_MS == NULL){
+        channel->mark_Start_MS = calloc(MOCK_MAX_MARKS, sizeof(long long));
+        channel->mark_End_MS = calloc(MOCK_MAX_MARKS, sizeof(long long));
+        if (channel->mark_Start_MS == NULL || channel->mark_End_MS == NULL){
+            fprintf(stderr, "mock wiringPi: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    channel->mark_Start_MS[channel->mark_COUNT] = start_MS;
+    channel->mark_End_MS[channel->mark_COUNT] = end_MS;
+    channel->mark_COUNT += 1;
+}
+
+static void Mock_Key_Text(Mock_Channel *channel, long long at_MS, long long unit_MS, const char *text){
+    // Keys 'text' with 1:3 dots and dashes, 1 unit between symbols, 3 between letters and 7 between words
+    for (const char *c = text; *c != '\0'; c++){
+        if (*c == ' '){
+            at_MS += 4 * unit_MS; // 7 with the letter gap already added
+            continue;
+        }
+        const char *pattern = Mock_Morse_Pattern(*c);
+        if (pattern == NULL){
+            continue;
+        }
+        for (const char *symbol = pattern; *symbol != '\0'; symbol++){
+            long long length = *symbol == '-' ? 3 * unit_MS : unit_MS;
+            Mock_Add_Mark(channel, at_MS, at_MS + length);
+            at_MS += length + unit_MS;
+        }
+        at_MS += 2 * unit_MS;
+    }
+}
+
+static void Mock_Add_Event(long long at_MS, Mock_Event_Type type){
+    if (Mock_Event_COUNT >= MOCK_MAX_EVENTS){
+        return;
+    }
+    // Kept in time order (insertion sort, scripts are short)
+    int i = Mock_Event_COUNT++;
+    while (i > 0 && Mock_EVENTS[i - 1].at_MS > at_MS){
+        Mock_EVENTS[i] = Mock_EVENTS[i - 1];
+        i -= 1;
+    }
+    Mock_EVENTS[i].at_MS = at_MS;
+    Mock_EVENTS[i].type = type;
+}
+
+static Mock_Channel *Mock_Script_Channel(const char *arguments, int line_NUMBER, int *consumed){
+    int index = -1;
+    if (sscanf(arguments, "%d%n", &index, consumed) != 1 || index < 0 || index >= MOCK_CHANNELS){
+        fprintf(stderr, "mock wiringPi: line %d: channel must be 0 to %d\n", line_NUMBER, MOCK_CHANNELS - 1);
+        exit(EXIT_FAILURE);
+    }
+    return &Mock_CHANNELS[index];
+}
+
+static void Mock_Script_Line(char *line, int line_NUMBER){
+    char *comment = strchr(line, '#');
+    if (comment != NULL){
+        *comment = '\0';
+    }
+    char command[32];
+    int used = 0;
+    if (sscanf(line, " %31s%n", command, &used) != 1){
+        return; // Blank line
+    }
+    char *arguments = line + used;
+    int consumed = 0;
+    int ok = 1;
+
+    if (strcmp(command, "levels") == 0){
+        Mock_Channel *channel = Mock_Script_Channel(arguments, line_NUMBER, &consumed);
+        ok = sscanf(arguments + consumed, "%d %d", &channel->mark, &channel->space) == 2;
+    } else if (strcmp(command, "noise") == 0){
+        Mock_Channel *channel = Mock_Script_Channel(arguments, line_NUMBER, &consumed);
+        ok = sscanf(arguments + consumed, "%d", &channel->noise) == 1 && channel->noise >= 0;
+    } else if (strcmp(command, "ambient") == 0){
+        Mock_Channel *channel = Mock_Script_Channel(arguments, line_NUMBER, &consumed);
+        ok = sscanf(arguments + consumed, "%d %d", &channel->ambient_Peak, &channel->ambient_Period_MS) == 2
+             && channel->ambient_Period_MS > 0;
+    } else if (strcmp(command, "loopback") == 0){
+        Mock_Channel *channel = Mock_Script_Channel(arguments, line_NUMBER, &consumed);
+        char *rest = arguments + consumed;
+        int pin = 0;
+        channel->loopback_COUNT = 0;
+        while (sscanf(rest, "%d%n", &pin, &consumed) == 1 && channel->loopback_COUNT < MOCK_LOOPBACK_PINS){
+            ok = ok && pin >= 0 && pin < MOCK_PINS;
+            channel->loopback_PINS[channel->loopback_COUNT++] = pin;
+            rest += consumed;
+        }
+        ok = ok && channel->loopback_COUNT > 0;
+    } else if (strcmp(command, "morse") == 0){
+        Mock_Channel *channel = Mock_Script_Channel(arguments, line_NUMBER, &consumed);
+        long long start_MS = 0;
+        long long unit_MS = 0;
+        int text_AT = 0;
+        ok = sscanf(arguments + consumed, "%lld %lld %n", &start_MS, &unit_MS, &text_AT) == 2 && unit_MS > 0;
+        if (ok){
+            char *text = arguments + consumed + text_AT;
+            text[strcspn(text, "\r\n")] = '\0';
+            Mock_Key_Text(channel, start_MS, unit_MS, text);
+        }
+    } else if (strcmp(command, "press") == 0){
+        long long at_MS = 0;
+        long long hold_MS = MOCK_DEFAULT_HOLD_MS;
+        ok = sscanf(arguments, "%lld %lld", &at_MS, &hold_MS) >= 1 && hold_MS > 0;
+        if (ok){
+            Mock_Add_Event(at_MS, MOCK_EVENT_PRESS);
+            Mock_Add_Event(at_MS + hold_MS, MOCK_EVENT_RELEASE);
+        }
+    } else if (strcmp(command, "conversion_us") == 0){
+        ok = sscanf(arguments, "%d", &Mock_CONVERSION_US) == 1 && Mock_CONVERSION_US >= 0;
+    } else if (strcmp(command, "exit") == 0){
+        long long at_MS = 0;
+        ok = sscanf(arguments, "%lld", &at_MS) == 1;
+        if (ok){
+            Mock_Add_Event(at_MS, MOCK_EVENT_EXIT);
+        }
+    } else {
+        ok = 0;
+    }
+
+    if (!ok){
+        fprintf(stderr, "mock wiringPi: line %d: cannot read '%s %s'\n", line_NUMBER, command, arguments);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void Mock_Load_Script(void){
+    for (int i = 0; i < MOCK_CHANNELS; i++){
+        Mock_CHANNELS[i].mark = 800;
+        Mock_CHANNELS[i].space = 200;
+        Mock_CHANNELS[i].noise = 20;
+    }
+    const char *path = getenv("MOCK_WIRINGPI_SCRIPT");
+    if (path == NULL || path[0] == '\0'){
+        // LED reader loopback, one message
+        Mock_CHANNELS[0].loopback_PINS[0] = 5;
+        Mock_CHANNELS[0].loopback_PINS[1] = 6;
+        Mock_CHANNELS[0].loopback_COUNT = 2;
+        Mock_Add_Event(1500, MOCK_EVENT_PRESS);
+        Mock_Add_Event(1500 + MOCK_DEFAULT_HOLD_MS, MOCK_EVENT_RELEASE);
+        Mock_Add_Event(16000, MOCK_EVENT_PRESS);
+        Mock_Add_Event(16000 + MOCK_DEFAULT_HOLD_MS, MOCK_EVENT_RELEASE);
+        return;
+    }
+    FILE *script = fopen(path, "r");
+    if (script == NULL){
+        fprintf(stderr, "mock wiringPi: cannot open script '%s'\n", path);
+        exit(EXIT_FAILURE);
+    }
+    char line[512];
+    int line_NUMBER = 0;
+    while (fgets(line, sizeof(line), script) != NULL){
+        line_NUMBER += 1;
+        Mock_Script_Line(line, line_NUMBER);
+    }
+    fclose(script);
+    fprintf(stderr, "mock wiringPi: script '%s', %d button/exit events\n", path, Mock_Event_COUNT);
+}
+
+
+// _________________________________________________
+//  Button Events
+// _________________________________________________
+
+static void *Mock_Event_Thread(void *unused){
+    (void)unused;
+    for (int i = 0; i < Mock_Event_COUNT; i++){
+        Mock_Sleep_Until_US(Mock_EVENTS[i].at_MS * 1000LL);
+        if (Mock_EVENTS[i].type == MOCK_EVENT_EXIT){
+            fprintf(stderr, "mock wiringPi: scripted exit at %lld ms\n", Mock_EVENTS[i].at_MS);
+            fflush(stdout);
+            exit(EXIT_SUCCESS);
+        }
+        int pressed = Mock_EVENTS[i].type == MOCK_EVENT_PRESS;
+        atomic_store(&Mock_BUTTON_DOWN, pressed);
+        // A press pulls the pin LOW (falling edge), the release lets it back up (rising edge)
+        int wanted = pressed ? INT_EDGE_FALLING : INT_EDGE_RISING;
+        void (*isr)(void) = atomic_load(&Mock_ISR);
+        if (isr != NULL && (Mock_ISR_EDGE == INT_EDGE_BOTH || Mock_ISR_EDGE == wanted)){
+            isr(); // Runs on this thread, like wiringPi's interrupt thread
+        }
+    }
+    return NULL;
+}
+
+static void Mock_Start(void){
+    clock_gettime(CLOCK_MONOTONIC, &Mock_START);
+    for (int pin = 0; pin < MOCK_PINS; pin++){
+        atomic_store(&Mock_PIN_PULLS[pin], PUD_OFF);
+    }
+    Mock_Load_Script();
+    pthread_t events;
+    if (pthread_create(&events, NULL, Mock_Event_Thread, NULL) != 0){
+        fprintf(stderr, "mock wiringPi: cannot start the button event thread\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(events);
+}
+
+
+// _________________________________________________
+//  Signal Model
+// _________________________________________________
+
+static int Mock_Keyed(const Mock_Channel *channel, long long now_MS){
+    // Binary search for the last mark starting at or before now
+    int low = 0;
+    int high = channel->mark_COUNT - 1;
+    int found = -1;
+    while (low <= high){
+        int middle = (low + high) / 2;
+        if (channel->mark_Start_MS[middle] <= now_MS){
+            found = middle;
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return found >= 0 && now_MS < channel->mark_End_MS[found];
+}
+
+static int Mock_Sample(const Mock_Channel *channel, long long now_US){
+    long long now_MS = now_US / 1000;
+    int mark = Mock_Keyed(channel, now_MS);
+    for (int i = 0; i < channel->loopback_COUNT && !mark; i++){
+        mark = atomic_load_explicit(&Mock_PIN_LEVELS[channel->loopback_PINS[i]], memory_order_relaxed) == HIGH;
+    }
+    int value = mark ? channel->mark : channel->space;
+
+    if (channel->ambient_Peak > 0){
+        long long phase = now_MS % channel->ambient_Period_MS;
+        long long half = channel->ambient_Period_MS / 2;
+        long long swell = phase < half ? phase : channel->ambient_Period_MS - phase;
+        long long flicker = (now_US % 10000) < 5000 ? now_US % 5000 : 5000 - now_US % 5000; // 100 Hz triangle
+        value += (int)(swell * channel->ambient_Peak * 3 / (4 * (half > 0 ? half : 1))
+                       + flicker * channel->ambient_Peak / (4 * 5000));
+    }
+    if (channel->noise > 0){
+        value += (int)(rand_r(&Mock_SEED) % (unsigned int)(channel->noise + 1)) - channel->noise / 2;
+    }
+    return value < 0 ? 0 : (value > MOCK_ADC_MAX ? MOCK_ADC_MAX : value);
+}
+
+
+// _________________________________________________
+//  wiringPi
+// _________________________________________________
+
+int wiringPiSetup(void){
+    pthread_once(&Mock_ONCE, Mock_Start);
+    return 0;
+}
+
+int wiringPiSetupGpio(void){
+    pthread_once(&Mock_ONCE, Mock_Start);
+    return 0;
+}
+
+void pinMode(int pin, int mode){
+    (void)pin;
+    (void)mode;
+}
+
+void pullUpDnControl(int pin, int pud){
+    if (pin >= 0 && pin < MOCK_PINS){
+        atomic_store(&Mock_PIN_PULLS[pin], pud);
+    }
+}
+
+void digitalWrite(int pin, int value){
+    if (pin >= 0 && pin < MOCK_PINS){
+        atomic_store_explicit(&Mock_PIN_LEVELS[pin], value ? HIGH : LOW, memory_order_relaxed);
+    }
+}
+
+int digitalRead(int pin){
+    if (pin < 0 || pin >= MOCK_PINS){
+        return LOW;
+    }
+    if (pin == Mock_ISR_PIN){
+        return atomic_load(&Mock_BUTTON_DOWN) ? LOW : HIGH;
+    }
+    if (atomic_load(&Mock_PIN_PULLS[pin]) == PUD_UP && atomic_load(&Mock_PIN_LEVELS[pin]) == LOW){
+        return HIGH; // Unconnected input with the pull-up on
+    }
+    return atomic_load_explicit(&Mock_PIN_LEVELS[pin], memory_order_relaxed);
+}
+
+int analogRead(int pin){
+    int index = pin - Mock_PIN_BASE;
+    if (index < 0 || index >= MOCK_CHANNELS){
+        return 0;
+    }
+    pthread_once(&Mock_ONCE, Mock_Start);
+    // One conversion is a 3 byte SPI transfer
+    int conversion_US = Mock_CONVERSION_US >= 0 ? Mock_CONVERSION_US : (int)(24000000LL / Mock_SPI_SPEED);
+    Mock_Sleep_US(conversion_US);
+    if (Mock_SEED == 0){
+        Mock_SEED = 12345u + (unsigned int)index;
+    }
+    return Mock_Sample(&Mock_CHANNELS[index], Mock_Now_US());
+}
+
+int wiringPiISR(int pin, int mode, void (*function)(void)){
+    pthread_once(&Mock_ONCE, Mock_Start);
+    Mock_ISR_PIN = pin;
+    Mock_ISR_EDGE = mode;
+    atomic_store(&Mock_ISR, function);
+    return 0;
+}
+
+int piHiPri(const int priority){
+    (void)priority;
+    return 0;
+}
+
+unsigned int millis(void){
+    pthread_once(&Mock_ONCE, Mock_Start);
+    return (unsigned int)(Mock_Now_US() / 1000);
+}
+
+unsigned int micros(void){
+    pthread_once(&Mock_ONCE, Mock_Start);
+    return (unsigned int)Mock_Now_US();
+}
+
+void delay(unsigned int howLong){
+    Mock_Sleep_US((long long)howLong * 1000LL);
+}
+
+void delayMicroseconds(unsigned int howLong){
+    Mock_Sleep_US(howLong);
+}
+
+
+// _________________________________________________
+//  wiringPiSPI / MCP3004
+// _________________________________________________
+
+int wiringPiSPISetup(int channel, int speed){
+    (void)channel;
+    if (speed > 0){
+        Mock_SPI_SPEED = speed;
+    }
+    return 0;
+}
+
+int mcp3004Setup(int pinBase, int spiChannel){
+    (void)spiChannel;
+    Mock_PIN_BASE = pinBase;
+    return 1;
+}
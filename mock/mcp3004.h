@@ -0,0 +1,19 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Mock MCP3004/3008 (off-device builds, see Mock_WiringPi.c)
+// *****************************************************
+
+#ifndef MOCK_MCP3004_H
+#define MOCK_MCP3004_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int mcp3004Setup(int pinBase, int spiChannel); // analogRead(pinBase + n) reads channel n
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
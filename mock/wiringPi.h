@@ -0,0 +1,53 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Mock wiringPi (off-device builds, see Mock_WiringPi.c)
+// *****************************************************
+
+/*  Same declarations as the parts of wiringPi the readers use, so they build
+    unchanged on any Linux machine with  -Imock  and  mock/Mock_WiringPi.c .
+*/
+
+#ifndef MOCK_WIRINGPI_H
+#define MOCK_WIRINGPI_H
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0
+#define OUTPUT 1
+
+#define PUD_OFF 0
+#define PUD_DOWN 1
+#define PUD_UP 2
+
+#define INT_EDGE_SETUP 0
+#define INT_EDGE_FALLING 1
+#define INT_EDGE_RISING 2
+#define INT_EDGE_BOTH 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int wiringPiSetup(void);
+extern int wiringPiSetupGpio(void);
+
+extern void pinMode(int pin, int mode);
+extern void pullUpDnControl(int pin, int pud);
+extern void digitalWrite(int pin, int value);
+extern int digitalRead(int pin);
+extern int analogRead(int pin);
+
+extern int wiringPiISR(int pin, int mode, void (*function)(void));
+extern int piHiPri(const int priority);
+
+extern unsigned int millis(void);
+extern unsigned int micros(void);
+extern void delay(unsigned int howLong);
+extern void delayMicroseconds(unsigned int howLong);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
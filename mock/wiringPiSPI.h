@@ -0,0 +1,19 @@
+// *****************************************************
+// Title: RASPBERRY PI - MORSE CODE READER
+// Module: Mock wiringPiSPI (off-device builds, see Mock_WiringPi.c)
+// *****************************************************
+
+#ifndef MOCK_WIRINGPISPI_H
+#define MOCK_WIRINGPISPI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int wiringPiSPISetup(int channel, int speed); // The speed sets how long a mock conversion takes
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif